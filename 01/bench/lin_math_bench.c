@@ -0,0 +1,143 @@
+// Built three times by `make bench`: as is, with -DLIN_MATH_NO_AVX for the 4-lane path alone,
+// and with -DLIN_MATH_NO_SIMD for the scalar baseline
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/common/common.c"
+#include "../src/common/util.h"
+
+#define MATRIX_COUNT 100000
+#define POINT_COUNT 1000000
+#define ITERATIONS 20
+
+static f64 now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, f64 start, u32 ops, f32 checksum)
+{
+    f64 ns_per_op = (now_sec() - start) * 1e9 / ((f64)ops * ITERATIONS);
+    printf("  %-28s %8.2f ns/op   (checksum %g)\n", name, ns_per_op, checksum);
+}
+
+int main()
+{
+    m4 *translates = xmalloc(MATRIX_COUNT * sizeof(m4));
+    m4 *rotates = xmalloc(MATRIX_COUNT * sizeof(m4));
+    m4 *models = xmalloc(MATRIX_COUNT * sizeof(m4));
+    m4 *inverses = xmalloc(MATRIX_COUNT * sizeof(m4));
+    m3 *normals = xmalloc(MATRIX_COUNT * sizeof(m3));
+    v3 *points = xmalloc(POINT_COUNT * sizeof(v3));
+    v3 *out_points = xmalloc(POINT_COUNT * sizeof(v3));
+
+    for (u32 i = 0; i < MATRIX_COUNT; i++)
+    {
+        translates[i] = m4_translate(rand_float() * 3.0f, rand_float() * 3.0f, rand_float() * 3.0f);
+        rotates[i] = m4_rotate(deg_to_rad(rand_float() * 360.0f), rand_v3(1.0f));
+    }
+    for (u32 i = 0; i < POINT_COUNT; i++)
+    {
+        points[i] = rand_v3(10.0f);
+    }
+
+#if defined(LIN_MATH_AVX)
+    printf("lin_math (SIMD, AVX when available)\n");
+#elif defined(LIN_MATH_SIMD)
+    printf("lin_math (SIMD)\n");
+#else
+    printf("lin_math (scalar)\n");
+#endif
+
+    f64 start;
+    f32 checksum;
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        for (u32 i = 0; i < MATRIX_COUNT; i++)
+        {
+            models[i] = m4_mul(translates[i], rotates[i]);
+        }
+        checksum += models[it].d[12];
+    }
+    report("m4_mul", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        m4_mul_batch(models, translates, rotates, MATRIX_COUNT);
+        checksum += models[it].d[12];
+    }
+    report("m4_mul_batch", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        for (u32 i = 0; i < MATRIX_COUNT; i++)
+        {
+            v4 v = m4_mul_v4(models[i], V4(1.0f, 2.0f, 3.0f, 1.0f));
+            checksum += v.x;
+        }
+    }
+    report("m4_mul_v4", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        for (u32 i = 0; i < MATRIX_COUNT; i++)
+        {
+            models[i] = m4_transpose(models[i]);
+        }
+        checksum += models[it].d[3];
+    }
+    report("m4_transpose", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        for (u32 i = 0; i < MATRIX_COUNT; i++)
+        {
+            inverses[i] = m4_inverse(models[i]);
+        }
+        checksum += inverses[it].d[12];
+    }
+    report("m4_inverse", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        m4_inverse_batch(inverses, models, MATRIX_COUNT);
+        checksum += inverses[it].d[12];
+    }
+    report("m4_inverse_batch", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        m3_normal_from_m4_batch(models, sizeof(m4), normals, sizeof(m3), MATRIX_COUNT);
+        checksum += normals[it].d[0];
+    }
+    report("m3_normal_from_m4_batch", start, MATRIX_COUNT, checksum);
+
+    start = now_sec();
+    checksum = 0.0f;
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        m4_transform_points(out_points, models[it], points, POINT_COUNT);
+        checksum += out_points[it].x;
+    }
+    report("m4_transform_points", start, POINT_COUNT, checksum);
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+// Text emission throughput: cached glyphs vs looking up stb_truetype metrics for every character,
+// and the one-time cost of rasterizing a glyph into the atlas, as a bitmap and as a distance field.
+// The per-character path is a reference point, not the font_loader path the glyph cache replaced,
+// so the ratio between the two says nothing about that change. Run from the project root so res/ resolves.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/common/common.c"
+#include "../src/e2r_draw.c"
+#include "../src/e2r_font.c"
+
+#define ITERATIONS 2000
+#define FONT_PATH "res/DMMono-Regular.ttf"
+#define COLD_FONT_SIZES 5 // few enough that the atlas never has to evict
+
+// e2r_draw.c and e2r_font.c only need these from core
+u64 e2r_get_current_frame() { return 0; }
+E2R_TextureHandle e2r_get_default_texture() { return 0; }
+E2R_TextureHandle e2r_get_ui_atlas_texture() { return 0; }
+E2R_TextureHandle e2r_get_font_atlas_texture() { return 0; }
+u32 e2r_texture_get_shader_index(E2R_TextureHandle texture) { return texture; }
+E2R_MeshHandle e2r_mesh_create(const Vertex3D *verts, u32 vert_count, const VertIndex *indices, u32 index_count)
+{
+    (void)verts; (void)vert_count; (void)indices; (void)index_count;
+    return 0;
+}
+
+static f64 now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static f64 report(const char *name, f64 start, u32 chars, f32 checksum)
+{
+    f64 ns_per_char = (now_sec() - start) * 1e9 / ((f64)chars * ITERATIONS);
+    printf("  %-28s %8.2f ns/char   (checksum %g)\n", name, ns_per_char, checksum);
+    return ns_per_char;
+}
+
+// Emission without a glyph cache: stb_truetype metrics for every character, no rasterization at all
+static void _draw_string_uncached(E2R_UIInstanceList *list, const char *str, f32 *pen_x, f32 *pen_y, E2R_FontHandle font_handle, v4 color)
+{
+    const _Font *font = &font_ctx.fonts.data[font_handle];
+    const stbtt_fontinfo *info = &font_ctx.faces.data[font->face].info;
+    u32 packed_color = _pack_color(color);
+    u32 tex_index = e2r_texture_get_shader_index(e2r_get_font_atlas_texture());
+    f32 starting_x = *pen_x;
+
+    while (*str)
+    {
+        if (*str == '\n')
+        {
+            str++;
+            *pen_y += font->ascender;
+            *pen_x = starting_x;
+            continue;
+        }
+
+        int stb_glyph = stbtt_FindGlyphIndex(info, (int)e2r_font_next_codepoint(&str));
+        int advance, left_side_bearing;
+        stbtt_GetGlyphHMetrics(info, stb_glyph, &advance, &left_side_bearing);
+        int x0, y0, x1, y1;
+        stbtt_GetGlyphBitmapBox(info, stb_glyph, font->scale, font->scale, &x0, &y0, &x1, &y1);
+        if (x1 > x0 && y1 > y0)
+        {
+            f32 y = *pen_y + font->ascender;
+            list_append(list, ((InstanceUI){
+                .pos_min = V2(*pen_x + x0, y + y0),
+                .pos_max = V2(*pen_x + x1, y + y1),
+                .color = packed_color,
+                .tex_index = tex_index
+            }));
+        }
+        *pen_x += advance * font->scale;
+    }
+}
+
+static f32 _checksum(const E2R_UIInstanceList *list)
+{
+    f32 sum = 0.0f;
+    for (size_t i = 0; i < list->size; i++)
+    {
+        sum += list->data[i].pos_max.x - list->data[i].pos_min.x;
+    }
+    return sum;
+}
+
+int main()
+{
+    e2r_font_init(1024);
+    E2R_FontHandle font = e2r_font_create(FONT_PATH, 18.0f, 0);
+
+    // A UI-sized block of text: short labels and a few longer lines
+    char text[4096];
+    size_t text_len = 0;
+    for (int line = 0; line < 48; line++)
+    {
+        int n = snprintf(text + text_len, sizeof(text) - text_len, "Widget %02d: value = %d.%03d, state ok\n", line, line * 37, line * 113 % 1000);
+        text_len += n;
+    }
+    u32 char_count = (u32)text_len;
+
+    E2R_UIInstanceList uncached_list = {};
+    v4 color = V4(1.0f, 1.0f, 1.0f, 1.0f);
+
+    printf("text emission (%u chars per string)\n", char_count);
+
+    f64 start = now_sec();
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        list_clear(&uncached_list);
+        f32 pen_x = 10.0f, pen_y = 10.0f;
+        _draw_string_uncached(&uncached_list, text, &pen_x, &pen_y, font, color);
+    }
+    f64 uncached_ns = report("stb_truetype per char", start, char_count, _checksum(&uncached_list));
+
+    // Rasterize everything once outside the timed loop, like the first frame that shows this text
+    {
+        f32 pen_x = 10.0f, pen_y = 10.0f;
+        e2r_draw_string(text, &pen_x, &pen_y, font, color);
+        e2r_reset_ui_data();
+        e2r_font_clear_atlas_updates();
+    }
+
+    start = now_sec();
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        e2r_reset_ui_data();
+        f32 pen_x = 10.0f, pen_y = 10.0f;
+        e2r_draw_string(text, &pen_x, &pen_y, font, color);
+    }
+    f64 cached_ns = report("glyph cache", start, char_count, _checksum(e2r_get_ui_render_data().instance_list));
+
+    printf("  glyph cache vs stb_truetype per char %.1fx\n", uncached_ns / cached_ns);
+
+    // First use: every printable ASCII glyph at a size that isn't cached yet, including the atlas upload data
+    const u32 first_codepoint = 0x21;
+    const u32 glyph_count = 0x7F - first_codepoint;
+    f32 size = 19.0f;
+    start = now_sec();
+    for (int it = 0; it < COLD_FONT_SIZES; it++)
+    {
+        E2R_FontHandle cold_font = e2r_font_create(FONT_PATH, size, 0);
+        for (u32 c = first_codepoint; c < first_codepoint + glyph_count; c++)
+        {
+            e2r_font_get_glyph(cold_font, c);
+        }
+        e2r_font_clear_atlas_updates();
+        size += 1.0f;
+    }
+    f64 ns_per_glyph = (now_sec() - start) * 1e9 / ((f64)glyph_count * COLD_FONT_SIZES);
+    printf("  %-28s %8.2f ns/glyph\n", "rasterize on first use", ns_per_glyph);
+
+    // SDF fonts rasterize once per face, so only the first size pays for the distance fields
+    start = now_sec();
+    E2R_FontHandle sdf_font = e2r_font_create(FONT_PATH, 18.0f, E2R_FONT_SDF);
+    for (u32 c = first_codepoint; c < first_codepoint + glyph_count; c++)
+    {
+        e2r_font_get_glyph(sdf_font, c);
+    }
+    e2r_font_clear_atlas_updates();
+    ns_per_glyph = (now_sec() - start) * 1e9 / glyph_count;
+    printf("  %-28s %8.2f ns/glyph\n", "SDF rasterize on first use", ns_per_glyph);
+
+    size = 19.0f;
+    start = now_sec();
+    for (int it = 0; it < COLD_FONT_SIZES; it++)
+    {
+        E2R_FontHandle sdf_size_font = e2r_font_create(FONT_PATH, size, E2R_FONT_SDF);
+        for (u32 c = first_codepoint; c < first_codepoint + glyph_count; c++)
+        {
+            e2r_font_get_glyph(sdf_size_font, c);
+        }
+        size += 1.0f;
+    }
+    ns_per_glyph = (now_sec() - start) * 1e9 / ((f64)glyph_count * COLD_FONT_SIZES);
+    printf("  %-28s %8.2f ns/glyph\n", "SDF at a new size", ns_per_glyph);
+
+    start = now_sec();
+    for (int it = 0; it < ITERATIONS; it++)
+    {
+        e2r_reset_ui_data();
+        f32 pen_x = 10.0f, pen_y = 10.0f;
+        e2r_draw_string(text, &pen_x, &pen_y, sdf_font, color);
+    }
+    report("glyph cache (SDF)", start, char_count, _checksum(e2r_get_ui_render_data().instance_list));
+
+    list_free(&uncached_list);
+    e2r_font_destroy();
+    return 0;
+}
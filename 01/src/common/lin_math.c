@@ -1,5 +1,36 @@
 #include "lin_math.h"
 
+// GCC/clang vector extensions; these compile to SSE on x86 and NEON on ARM.
+// Everything below also has a scalar path, used when LIN_MATH_NO_SIMD is defined and on GCC
+// before 12, which lacks __builtin_shufflevector.
+#if !defined(LIN_MATH_NO_SIMD) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12))
+#define LIN_MATH_SIMD 1
+typedef f32 _f32x4 __attribute__((vector_size(16)));
+typedef f32 _f32x4u __attribute__((vector_size(16), aligned(4))); // for unaligned loads/stores
+typedef i32 _i32x4 __attribute__((vector_size(16)));
+
+// On x86, m4_inverse_batch also has an 8-lane AVX kernel, picked at runtime when the CPU supports it.
+// The other batches measured no faster with AVX. LIN_MATH_NO_AVX leaves only the 4-lane path, for comparing the two.
+#if !defined(LIN_MATH_NO_AVX) && (defined(__x86_64__) || defined(__i386__))
+#define LIN_MATH_AVX 1
+#define _AVX __attribute__((target("avx")))
+typedef f32 _f32x8 __attribute__((vector_size(32)));
+typedef f32 _f32x8u __attribute__((vector_size(32), aligned(4)));
+typedef i32 _i32x8 __attribute__((vector_size(32)));
+
+static bool _has_avx()
+{
+    static int has_avx = -1; // racing threads all store the same answer
+    if (has_avx < 0)
+    {
+        __builtin_cpu_init();
+        has_avx = __builtin_cpu_supports("avx") != 0;
+    }
+    return has_avx;
+}
+#endif
+#endif
+
 v3 v3_normalize(v3 v)
 {
     f32 mag = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
@@ -78,7 +109,22 @@ m4 m4_scale(v3 scale)
 
 // --------------------------------------------
 
-m4 m4_mul(m4 a, m4 b)
+#ifdef LIN_MATH_SIMD
+// Result column = a's columns weighted by b's column
+static inline void _m4_mul_simd(f32 *out, const f32 *a, const f32 *b)
+{
+    _f32x4 a0 = *(const _f32x4u *)(a + 0);
+    _f32x4 a1 = *(const _f32x4u *)(a + 4);
+    _f32x4 a2 = *(const _f32x4u *)(a + 8);
+    _f32x4 a3 = *(const _f32x4u *)(a + 12);
+    for (int col = 0; col < 4; col++)
+    {
+        const f32 *bc = b + col * 4;
+        *(_f32x4u *)(out + col * 4) = a0 * bc[0] + a1 * bc[1] + a2 * bc[2] + a3 * bc[3];
+    }
+}
+#else
+static m4 _m4_mul_scalar(m4 a, m4 b)
 {
     m4 m;
     for (int col = 0; col < 4; col++)
@@ -94,6 +140,293 @@ m4 m4_mul(m4 a, m4 b)
     }
     return m;
 }
+#endif
+
+m4 m4_mul(m4 a, m4 b)
+{
+#ifdef LIN_MATH_SIMD
+    m4 m;
+    _m4_mul_simd(m.d, a.d, b.d);
+    return m;
+#else
+    return _m4_mul_scalar(a, b);
+#endif
+}
+
+// Scalar on purpose: a single vector is too little work to pay for the lane moves (see bench/lin_math_bench.c)
+v4 m4_mul_v4(m4 m, v4 v)
+{
+    v4 r;
+    for (int row = 0; row < 4; row++)
+    {
+        r.d[row] = m.d[row] * v.x + m.d[4 + row] * v.y + m.d[8 + row] * v.z + m.d[12 + row] * v.w;
+    }
+    return r;
+}
+
+m4 m4_transpose(m4 m)
+{
+    m4 t;
+#ifdef LIN_MATH_SIMD
+    _f32x4 c0 = *(const _f32x4u *)(m.d + 0);
+    _f32x4 c1 = *(const _f32x4u *)(m.d + 4);
+    _f32x4 c2 = *(const _f32x4u *)(m.d + 8);
+    _f32x4 c3 = *(const _f32x4u *)(m.d + 12);
+
+    // Interleave column pairs, then take the matching halves
+    _f32x4 lo01 = __builtin_shufflevector(c0, c1, 0, 4, 1, 5);
+    _f32x4 hi01 = __builtin_shufflevector(c0, c1, 2, 6, 3, 7);
+    _f32x4 lo23 = __builtin_shufflevector(c2, c3, 0, 4, 1, 5);
+    _f32x4 hi23 = __builtin_shufflevector(c2, c3, 2, 6, 3, 7);
+
+    *(_f32x4u *)(t.d + 0) = __builtin_shufflevector(lo01, lo23, 0, 1, 4, 5);
+    *(_f32x4u *)(t.d + 4) = __builtin_shufflevector(lo01, lo23, 2, 3, 6, 7);
+    *(_f32x4u *)(t.d + 8) = __builtin_shufflevector(hi01, hi23, 0, 1, 4, 5);
+    *(_f32x4u *)(t.d + 12) = __builtin_shufflevector(hi01, hi23, 2, 3, 6, 7);
+#else
+    for (int col = 0; col < 4; col++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            t.d[row * 4 + col] = m.d[col * 4 + row];
+        }
+    }
+#endif
+    return t;
+}
+
+void m4_mul_batch(m4 *out, const m4 *a, const m4 *b, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+#ifdef LIN_MATH_SIMD
+        _m4_mul_simd(out[i].d, a[i].d, b[i].d);
+#else
+        out[i] = _m4_mul_scalar(a[i], b[i]);
+#endif
+    }
+}
+
+// Plain loop on purpose: with v3 input, gathering points into lanes costs more than
+// the SIMD math saves (see bench/lin_math_bench.c), and the compiler vectorizes this well
+void m4_transform_points(v3 *out, m4 m, const v3 *points, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        v3 p = points[i];
+        out[i] = V3(
+            m.d[0] * p.x + m.d[4] * p.y + m.d[8]  * p.z + m.d[12],
+            m.d[1] * p.x + m.d[5] * p.y + m.d[9]  * p.z + m.d[13],
+            m.d[2] * p.x + m.d[6] * p.y + m.d[10] * p.z + m.d[14]);
+    }
+}
+
+// --------------------------------------------
+
+// Cofactor expansion, shared by the single and the 4-lane batched inverse.
+// Works on f32 and _f32x4 alike.
+#define _M4_INVERSE_BODY(D, INV) do { \
+    INV[0]  =  D[5]*D[10]*D[15] - D[5]*D[11]*D[14] - D[9]*D[6]*D[15] + D[9]*D[7]*D[14] + D[13]*D[6]*D[11] - D[13]*D[7]*D[10]; \
+    INV[4]  = -D[4]*D[10]*D[15] + D[4]*D[11]*D[14] + D[8]*D[6]*D[15] - D[8]*D[7]*D[14] - D[12]*D[6]*D[11] + D[12]*D[7]*D[10]; \
+    INV[8]  =  D[4]*D[9]*D[15]  - D[4]*D[11]*D[13] - D[8]*D[5]*D[15] + D[8]*D[7]*D[13] + D[12]*D[5]*D[11] - D[12]*D[7]*D[9]; \
+    INV[12] = -D[4]*D[9]*D[14]  + D[4]*D[10]*D[13] + D[8]*D[5]*D[14] - D[8]*D[6]*D[13] - D[12]*D[5]*D[10] + D[12]*D[6]*D[9]; \
+    INV[1]  = -D[1]*D[10]*D[15] + D[1]*D[11]*D[14] + D[9]*D[2]*D[15] - D[9]*D[3]*D[14] - D[13]*D[2]*D[11] + D[13]*D[3]*D[10]; \
+    INV[5]  =  D[0]*D[10]*D[15] - D[0]*D[11]*D[14] - D[8]*D[2]*D[15] + D[8]*D[3]*D[14] + D[12]*D[2]*D[11] - D[12]*D[3]*D[10]; \
+    INV[9]  = -D[0]*D[9]*D[15]  + D[0]*D[11]*D[13] + D[8]*D[1]*D[15] - D[8]*D[3]*D[13] - D[12]*D[1]*D[11] + D[12]*D[3]*D[9]; \
+    INV[13] =  D[0]*D[9]*D[14]  - D[0]*D[10]*D[13] - D[8]*D[1]*D[14] + D[8]*D[2]*D[13] + D[12]*D[1]*D[10] - D[12]*D[2]*D[9]; \
+    INV[2]  =  D[1]*D[6]*D[15]  - D[1]*D[7]*D[14]  - D[5]*D[2]*D[15] + D[5]*D[3]*D[14] + D[13]*D[2]*D[7]  - D[13]*D[3]*D[6]; \
+    INV[6]  = -D[0]*D[6]*D[15]  + D[0]*D[7]*D[14]  + D[4]*D[2]*D[15] - D[4]*D[3]*D[14] - D[12]*D[2]*D[7]  + D[12]*D[3]*D[6]; \
+    INV[10] =  D[0]*D[5]*D[15]  - D[0]*D[7]*D[13]  - D[4]*D[1]*D[15] + D[4]*D[3]*D[13] + D[12]*D[1]*D[7]  - D[12]*D[3]*D[5]; \
+    INV[14] = -D[0]*D[5]*D[14]  + D[0]*D[6]*D[13]  + D[4]*D[1]*D[14] - D[4]*D[2]*D[13] - D[12]*D[1]*D[6]  + D[12]*D[2]*D[5]; \
+    INV[3]  = -D[1]*D[6]*D[11]  + D[1]*D[7]*D[10]  + D[5]*D[2]*D[11] - D[5]*D[3]*D[10] - D[9]*D[2]*D[7]   + D[9]*D[3]*D[6]; \
+    INV[7]  =  D[0]*D[6]*D[11]  - D[0]*D[7]*D[10]  - D[4]*D[2]*D[11] + D[4]*D[3]*D[10] + D[8]*D[2]*D[7]   - D[8]*D[3]*D[6]; \
+    INV[11] = -D[0]*D[5]*D[11]  + D[0]*D[7]*D[9]   + D[4]*D[1]*D[11] - D[4]*D[3]*D[9]  - D[8]*D[1]*D[7]   + D[8]*D[3]*D[5]; \
+    INV[15] =  D[0]*D[5]*D[10]  - D[0]*D[6]*D[9]   - D[4]*D[1]*D[10] + D[4]*D[2]*D[9]  + D[8]*D[1]*D[6]   - D[8]*D[2]*D[5]; \
+} while (0)
+
+// Cofactor expansion; returns the zero matrix for singular input
+m4 m4_inverse(m4 m)
+{
+    const f32 *d = m.d;
+    f32 inv[16];
+    _M4_INVERSE_BODY(d, inv);
+
+    f32 det = d[0]*inv[0] + d[1]*inv[4] + d[2]*inv[8] + d[3]*inv[12];
+    f32 inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+
+    m4 result;
+    for (int i = 0; i < 16; i++) result.d[i] = inv[i] * inv_det;
+    return result;
+}
+
+#ifdef LIN_MATH_SIMD
+// Batches run one matrix per lane. The AoS <-> SoA conversion goes through 4x4 transposes of whole columns,
+// which is much cheaper than moving elements into lanes one at a time.
+static inline void _transpose_x4(_f32x4 r[4])
+{
+    _f32x4 lo01 = __builtin_shufflevector(r[0], r[1], 0, 4, 1, 5);
+    _f32x4 hi01 = __builtin_shufflevector(r[0], r[1], 2, 6, 3, 7);
+    _f32x4 lo23 = __builtin_shufflevector(r[2], r[3], 0, 4, 1, 5);
+    _f32x4 hi23 = __builtin_shufflevector(r[2], r[3], 2, 6, 3, 7);
+    r[0] = __builtin_shufflevector(lo01, lo23, 0, 1, 4, 5);
+    r[1] = __builtin_shufflevector(lo01, lo23, 2, 3, 6, 7);
+    r[2] = __builtin_shufflevector(hi01, hi23, 0, 1, 4, 5);
+    r[3] = __builtin_shufflevector(hi01, hi23, 2, 3, 6, 7);
+}
+
+// Column col of 4 consecutive strided m4s; out[row] holds that element of each
+static inline void _gather_col_x4(_f32x4 out[4], const u8 *src, size_t stride, int col)
+{
+    for (int lane = 0; lane < 4; lane++) out[lane] = *(const _f32x4u *)(((const m4 *)(src + lane * stride))->d + col * 4);
+    _transpose_x4(out);
+}
+
+// The reverse: 4 floats per lane, written float_offset floats into each strided element
+static inline void _scatter_x4(u8 *dst, size_t stride, int float_offset, _f32x4 v[4])
+{
+    _transpose_x4(v);
+    for (int lane = 0; lane < 4; lane++) *(_f32x4u *)((f32 *)(dst + lane * stride) + float_offset) = v[lane];
+}
+
+#ifdef LIN_MATH_AVX
+_AVX static inline void _gather_col_x8(_f32x8 out[4], const u8 *src, size_t stride, int col)
+{
+    _f32x4 lo[4], hi[4];
+    _gather_col_x4(lo, src, stride, col);
+    _gather_col_x4(hi, src + 4 * stride, stride, col);
+    for (int row = 0; row < 4; row++) out[row] = __builtin_shufflevector(lo[row], hi[row], 0, 1, 2, 3, 4, 5, 6, 7);
+}
+
+_AVX static inline void _scatter_x8(u8 *dst, size_t stride, int float_offset, _f32x8 v[4])
+{
+    _f32x4 lo[4], hi[4];
+    for (int row = 0; row < 4; row++)
+    {
+        lo[row] = __builtin_shufflevector(v[row], v[row], 0, 1, 2, 3);
+        hi[row] = __builtin_shufflevector(v[row], v[row], 4, 5, 6, 7);
+    }
+    _scatter_x4(dst, stride, float_offset, lo);
+    _scatter_x4(dst + 4 * stride, stride, float_offset, hi);
+}
+#endif
+
+// Returns how many matrices it did, a multiple of LANES
+#define _M4_INVERSE_BATCH_LANES(VEC, IVEC, LANES, SUFFIX, out, m, count) do { \
+    u32 i = 0; \
+    for (; i + LANES <= count; i += LANES) \
+    { \
+        VEC d[16]; \
+        for (int col = 0; col < 4; col++) _gather_col_##SUFFIX(d + col * 4, (const u8 *)(m + i), sizeof(m4), col); \
+\
+        VEC inv[16]; \
+        _M4_INVERSE_BODY(d, inv); \
+\
+        VEC det = d[0]*inv[0] + d[1]*inv[4] + d[2]*inv[8] + d[3]*inv[12]; \
+        VEC inv_det = (VEC)((IVEC)(1.0f / det) & (IVEC)(det != 0.0f)); \
+        for (int k = 0; k < 16; k++) inv[k] *= inv_det; \
+\
+        for (int col = 0; col < 4; col++) _scatter_##SUFFIX((u8 *)(out + i), sizeof(m4), col * 4, inv + col * 4); \
+    } \
+    return i; \
+} while (0)
+
+static u32 _m4_inverse_batch_x4(m4 *out, const m4 *m, u32 count)
+{
+    _M4_INVERSE_BATCH_LANES(_f32x4, _i32x4, 4, x4, out, m, count);
+}
+
+#ifdef LIN_MATH_AVX
+_AVX static u32 _m4_inverse_batch_x8(m4 *out, const m4 *m, u32 count)
+{
+    _M4_INVERSE_BATCH_LANES(_f32x8, _i32x8, 8, x8, out, m, count);
+}
+#endif
+#endif
+
+void m4_inverse_batch(m4 *out, const m4 *m, u32 count)
+{
+    u32 i = 0;
+#ifdef LIN_MATH_AVX
+    if (_has_avx()) i = _m4_inverse_batch_x8(out, m, count);
+#endif
+#ifdef LIN_MATH_SIMD
+    i += _m4_inverse_batch_x4(out + i, m + i, count - i);
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = m4_inverse(m[i]);
+    }
+}
+
+// --------------------------------------------
+
+// transpose(inverse(upper 3x3)). With columns a, b, c that is (b x c, c x a, a x b) / det,
+// which skips the full 4x4 inverse
+m3 m3_normal_from_m4(m4 m)
+{
+    v3 a = V3(m.d[0], m.d[1], m.d[2]);
+    v3 b = V3(m.d[4], m.d[5], m.d[6]);
+    v3 c = V3(m.d[8], m.d[9], m.d[10]);
+
+    v3 bc = v3_cross(b, c);
+    v3 ca = v3_cross(c, a);
+    v3 ab = v3_cross(a, b);
+
+    f32 det = v3_dot(a, bc);
+    f32 inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+
+    m3 n = {{
+        bc.x * inv_det, bc.y * inv_det, bc.z * inv_det,
+        ca.x * inv_det, ca.y * inv_det, ca.z * inv_det,
+        ab.x * inv_det, ab.y * inv_det, ab.z * inv_det
+    }};
+    return n;
+}
+
+#ifdef LIN_MATH_SIMD
+// The normal matrix of one model per lane; returns how many it did, a multiple of 4
+static u32 _m3_normal_from_m4_batch_x4(const u8 *src, size_t model_stride, u8 *dst, size_t out_stride, u32 count)
+{
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _f32x4 a[4], b[4], c[4];
+        _gather_col_x4(a, src + i * model_stride, model_stride, 0);
+        _gather_col_x4(b, src + i * model_stride, model_stride, 1);
+        _gather_col_x4(c, src + i * model_stride, model_stride, 2);
+
+        _f32x4 n[9];
+        n[0] = b[1]*c[2] - b[2]*c[1]; n[1] = b[2]*c[0] - b[0]*c[2]; n[2] = b[0]*c[1] - b[1]*c[0];
+        n[3] = c[1]*a[2] - c[2]*a[1]; n[4] = c[2]*a[0] - c[0]*a[2]; n[5] = c[0]*a[1] - c[1]*a[0];
+        n[6] = a[1]*b[2] - a[2]*b[1]; n[7] = a[2]*b[0] - a[0]*b[2]; n[8] = a[0]*b[1] - a[1]*b[0];
+
+        _f32x4 det = a[0]*n[0] + a[1]*n[1] + a[2]*n[2];
+        _f32x4 inv_det = (_f32x4)((_i32x4)(1.0f / det) & (_i32x4)(det != 0.0f));
+        for (int k = 0; k < 9; k++) n[k] *= inv_det;
+
+        u8 *o = dst + i * out_stride;
+        for (int lane = 0; lane < 4; lane++) ((m3 *)(o + lane * out_stride))->d[8] = n[8][lane];
+        _scatter_x4(o, out_stride, 0, n);
+        _scatter_x4(o, out_stride, 4, n + 4);
+    }
+    return i;
+}
+#endif
+
+void m3_normal_from_m4_batch(const m4 *models, size_t model_stride, m3 *out, size_t out_stride, u32 count)
+{
+    const u8 *src = (const u8 *)models;
+    u8 *dst = (u8 *)out;
+
+    u32 i = 0;
+#ifdef LIN_MATH_SIMD
+    i = _m3_normal_from_m4_batch_x4(src, model_stride, dst, out_stride, count);
+#endif
+    for (; i < count; i++)
+    {
+        *(m3 *)(dst + i * out_stride) = m3_normal_from_m4(*(const m4 *)(src + i * model_stride));
+    }
+}
 
 // --------------------------------------------
 
@@ -172,3 +505,27 @@ m4 m4_look_at(v3 eye, v3 target, v3 up)
 
     return m;
 }
+
+// --------------------------------------------
+
+// Gribb/Hartmann: left, right, bottom, top, near, far. Normals point inwards, xyz normalized.
+void m4_frustum_planes(m4 view_proj, v4 out_planes[6])
+{
+    const f32 *d = view_proj.d;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            f32 sign = side == 0 ? 1.0f : -1.0f;
+            v4 plane = {
+                .x = d[3]  + sign * d[i],
+                .y = d[7]  + sign * d[4 + i],
+                .z = d[11] + sign * d[8 + i],
+                .w = d[15] + sign * d[12 + i]
+            };
+            f32 mag = sqrtf(plane.x*plane.x + plane.y*plane.y + plane.z*plane.z);
+            f32 i_mag = mag > 0.0f ? 1.0f / mag : 0.0f;
+            out_planes[i * 2 + side] = (v4){{{plane.x * i_mag, plane.y * i_mag, plane.z * i_mag, plane.w * i_mag}}};
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <math.h>
+#include <stddef.h>
 
 #include "types.h"
 
@@ -97,8 +98,22 @@ m4 m4_rotate(float angle_rad, v3 axis);
 m4 m4_scale(v3 scale);
 
 m4 m4_mul(m4 a, m4 b);
+v4 m4_mul_v4(m4 m, v4 v);
+m4 m4_transpose(m4 m);
+m4 m4_inverse(m4 m);
+
+// Batched forms, SIMD unless LIN_MATH_NO_SIMD is defined; m4_inverse_batch uses AVX when the CPU has it
+void m4_mul_batch(m4 *out, const m4 *a, const m4 *b, u32 count);
+void m4_inverse_batch(m4 *out, const m4 *m, u32 count);
+void m4_transform_points(v3 *out, m4 m, const v3 *points, u32 count);
+
+m3 m3_normal_from_m4(m4 m);
+// Strides are in bytes, so the matrices can live inside larger structs
+void m3_normal_from_m4_batch(const m4 *models, size_t model_stride, m3 *out, size_t out_stride, u32 count);
 
 m4 m4_proj_ortho(f32 left, f32 right, f32 bottom, f32 top, f32 near, f32 far);
 m4 m4_proj_perspective(f32 fov, f32 aspect, f32 znear, f32 zfar);
 
 m4 m4_look_at(v3 eye, v3 target, v3 up);
+
+void m4_frustum_planes(m4 view_proj, v4 out_planes[6]);
@@ -34,6 +34,9 @@ typedef struct v4i { union { struct { i32 x; i32 y; i32 z; i32 w; }; struct { i3
  */
 typedef struct m4 { f32 d[16]; } m4;
 
+// Column-major like m4, m3[col * 3 + row]
+typedef struct m3 { f32 d[9]; } m3;
+
 static inline v2 V2(f32 x, f32 y) { return (v2){{{x, y}}}; }
 static inline v3 V3(f32 x, f32 y, f32 z) { return (v3){{{x, y, z}}}; }
 static inline v4 V4(f32 x, f32 y, f32 z, f32 w) { return (v4){{{x, y, z, w}}}; }
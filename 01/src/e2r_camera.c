@@ -58,3 +58,12 @@ m4 e2r_camera_get_view(const E2R_Camera *c)
     m4 view = m4_look_at(c->pos, v3_add(c->pos, dir), up);
     return view;
 }
+
+E2R_Frustum e2r_camera_get_frustum(const E2R_Camera *c, f32 fov_rad, f32 aspect, f32 znear, f32 zfar)
+{
+    m4 proj = m4_proj_perspective(fov_rad, aspect, znear, zfar);
+    m4 view_proj = m4_mul(proj, e2r_camera_get_view(c));
+    E2R_Frustum frustum;
+    m4_frustum_planes(view_proj, frustum.planes);
+    return frustum;
+}
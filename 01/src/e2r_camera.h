@@ -11,8 +11,16 @@ typedef struct E2R_Camera
 
 } E2R_Camera;
 
+// Planes point inwards: left, right, bottom, top, near, far
+typedef struct E2R_Frustum
+{
+    v4 planes[6];
+
+} E2R_Frustum;
+
 E2R_Camera e2r_camera_set_from_pos_target(v3 pos, v3 target);
 v3 e2r_camera_get_dir(const E2R_Camera *c);
 v3 e2r_camera_get_right(const E2R_Camera *c);
 v3 e2r_camera_get_up(const E2R_Camera *c);
 m4 e2r_camera_get_view(const E2R_Camera *c);
+E2R_Frustum e2r_camera_get_frustum(const E2R_Camera *c, f32 fov_rad, f32 aspect, f32 znear, f32 zfar);
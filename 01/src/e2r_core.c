@@ -1,5 +1,6 @@
 #include "e2r_core.h"
 #include "e2r_camera.h"
+#include "e2r_cull.h"
 
 #include <string.h>
 
@@ -9,20 +10,84 @@
 #include <stb_image.h>
 #include <vulkan/vulkan_core.h>
 
-#include <font_loader.h>
-
 #include "common/lin_math.h"
 #include "common/print_helpers.h"
 #include "common/random.h"
 #include "common/types.h"
 #include "common/util.h"
 #include "e2r_draw.h"
+#include "e2r_font.h"
 #include "e2r_input.h"
+#include "e2r_jobs.h"
 #include "vertex.h"
 
 #define FRAMES_IN_FLIGHT 2
-#define MAX_VERTEX_COUNT 1024
-#define MAX_INDEX_COUNT 4096
+#define INITIAL_STREAM_BUFFER_SIZE (1024 * 1024)
+#define STREAM_ALLOCATION_ALIGNMENT 16
+#define STREAM_BUFFER_USAGE (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+#define INITIAL_CULLED_INSTANCE_CAPACITY 1024
+#define CULL_WORKGROUP_SIZE 64
+#define TIMESTAMPS_PER_FRAME 2
+#define DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+#define PIPELINE_CACHE_PATH "bin/pipeline_cache.bin"
+#define UPLOAD_STAGING_CHUNK_SIZE (16 * 1024 * 1024)
+#define UPLOAD_STAGING_ALIGNMENT 16
+#define MAX_SAMPLER_ANISOTROPY 16.0f
+#define MAX_BINDLESS_TEXTURES 1024
+#define MIN_MESH_DRAWS_PER_RECORDING_SLICE 16 // under GPU culling
+#define MIN_INSTANCES_PER_RECORDING_SLICE 256 // under CPU or no culling
+#define FRAME_TIMING_SMOOTHING 0.05f
+#define MEMORY_BLOCK_SIZE (64 * 1024 * 1024)
+#define GLYPH_ATLAS_SIZE 1024
+#define DEFAULT_FONT_PATH "res/DMMono-Regular.ttf"
+#define DEFAULT_FONT_SIZE 18.0f
+
+typedef struct Vk_MemoryRange
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+
+} Vk_MemoryRange;
+
+list_define_type(Vk_MemoryRangeList, Vk_MemoryRange);
+
+// One vkAllocateMemory, sub-allocated unless dedicated.
+// Host-visible blocks stay mapped for their whole lifetime.
+typedef struct Vk_MemoryBlock
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void *data_ptr;
+    u32 memory_type;
+    bool is_linear; // buffers and optimal images never share a block, so bufferImageGranularity can be ignored
+    bool is_dedicated;
+    Vk_MemoryRangeList free_ranges; // sorted by offset
+
+} Vk_MemoryBlock;
+
+list_define_type(Vk_MemoryBlockPtrList, Vk_MemoryBlock *);
+
+typedef struct Vk_MemoryAllocator
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    Vk_MemoryBlockPtrList blocks;
+
+    u32 allocation_count;
+    u32 dedicated_allocation_count;
+    VkDeviceSize bytes_reserved;
+    VkDeviceSize bytes_used;
+
+} Vk_MemoryAllocator;
+
+typedef struct Vk_Allocation
+{
+    Vk_MemoryBlock *block;
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *data_ptr;
+
+} Vk_Allocation;
 
 typedef struct Vk_SwapchainBundle
 {
@@ -39,7 +104,7 @@ typedef struct Vk_SwapchainBundle
 typedef struct Vk_DepthImageBundle
 {
     VkImage *images;
-    VkDeviceMemory *memory_list;
+    Vk_Allocation *allocations;
     VkImageView *image_views;
     u32 image_count;
     VkFormat depth_format;
@@ -49,17 +114,34 @@ typedef struct Vk_DepthImageBundle
 typedef struct Vk_RenderPassBundle
 {
     VkRenderPass render_pass;
-    VkFramebuffer *framebuffers;
-    u32 framebuffer_count;
     VkFormat color_format;
     VkFormat depth_format;
 
 } Vk_RenderPassBundle;
 
+typedef struct Vk_FramebufferBundle
+{
+    VkFramebuffer *framebuffers;
+    u32 framebuffer_count;
+
+} Vk_FramebufferBundle;
+
+// Swapchain-dependent objects replaced by a rebuild, destroyed once no frame in flight can use them
+typedef struct Vk_RetiredSwapchain
+{
+    Vk_SwapchainBundle swapchain_bundle;
+    Vk_DepthImageBundle depth_image_bundle;
+    Vk_FramebufferBundle framebuffer_bundle;
+    u64 retire_serial; // the last submit that may still use them
+
+} Vk_RetiredSwapchain;
+
+list_define_type(Vk_RetiredSwapchainList, Vk_RetiredSwapchain);
+
 typedef struct Vk_BufferBundle
 {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    Vk_Allocation allocation;
     void *data_ptr;
     VkDeviceSize size;
 
@@ -78,6 +160,8 @@ typedef struct Vk_Frame
     VkFence in_flight_fence;
     bool should_wait_on_fence;
     VkSemaphore acquire_semaphore;
+    u64 submitted_serial; // of the last submit on this frame, 0 if none yet
+    u64 completed_serial; // of the last submit whose fence was waited on
 
 } Vk_Frame;
 
@@ -88,16 +172,84 @@ typedef struct Vk_FrameList
 
 } Vk_FrameList;
 
+// One pool and secondary command buffer per recording slot and frame in flight.
+// Every slot is recorded by a single job, so its pool is never touched by two threads at once.
+typedef struct Vk_RecordingBundle
+{
+    VkCommandPool *command_pools[FRAMES_IN_FLIGHT];
+    VkCommandBuffer *command_buffers[FRAMES_IN_FLIGHT];
+    u32 slot_count;
+
+} Vk_RecordingBundle;
+
 typedef struct Vk_TextureBundle
 {
     VkImage image;
-    VkDeviceMemory memory;
+    Vk_Allocation allocation;
     VkImageView image_view;
-    VkSampler sampler;
+    VkSampler sampler; // owned by the sampler cache
     VkFormat format;
+    u32 mip_levels;
+    bool is_resident; // written into the texture table once its upload batch completes
 
 } Vk_TextureBundle;
 
+list_define_type(Vk_TextureBundleList, Vk_TextureBundle);
+
+list_define_type(E2R_TextureHandleList, E2R_TextureHandle);
+
+// One descriptor set with every texture, bound as set 1 by the graphics pipelines and indexed by E2R_TextureHandle.
+// Slots are only written while no frame references them, which update-unused-while-pending allows.
+typedef struct Vk_TextureTable
+{
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+
+} Vk_TextureTable;
+
+typedef struct Vk_SamplerCacheEntry
+{
+    u32 flags; // E2R_TextureFlags
+    VkSampler sampler;
+
+} Vk_SamplerCacheEntry;
+
+list_define_type(Vk_SamplerCache, Vk_SamplerCacheEntry);
+
+list_define_type(Vk_StagingBufferList, Vk_BufferBundle);
+
+// A buffer or image released by the transfer queue family that the graphics family still has to acquire
+typedef struct Vk_OwnershipTransfer
+{
+    VkImage image; // VK_NULL_HANDLE for buffers
+    VkBuffer buffer;
+    u32 w, h, mip_levels; // images only; the graphics family generates the mips after the acquire
+
+} Vk_OwnershipTransfer;
+
+list_define_type(Vk_OwnershipTransferList, Vk_OwnershipTransfer);
+
+list_define_type(Vk_BufferImageCopyList, VkBufferImageCopy);
+
+list_define_type(E2R_MeshHandleList, E2R_MeshHandle);
+
+// Uploads recorded between e2r_upload_begin and e2r_upload_flush share one command buffer and one submit.
+// Staging chunks are kept until the fence shows the copies are done.
+typedef struct Vk_UploadBatch
+{
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    Vk_StagingBufferList staging_buffers;
+    VkDeviceSize staging_offset; // into the last staging buffer
+    Vk_OwnershipTransferList releases;
+    E2R_MeshHandleList meshes; // become resident when the batch completes
+    E2R_TextureHandleList textures; // same
+    bool is_recording;
+    bool is_in_flight;
+
+} Vk_UploadBatch;
+
 typedef struct Vk_PipelineBundle
 {
     VkDescriptorSetLayout descriptor_set_layout;
@@ -109,16 +261,65 @@ typedef struct Vk_PipelineBundle
 
     VkPipeline pipeline;
 
-    u32 max_vertex_count;
-    Vk_BufferBundle vertex_buffer_bundle;
+} Vk_PipelineBundle;
+
+list_define_type(Vk_RetiredBufferBundleList, Vk_BufferBundle);
+
+// Persistently mapped, linearly sub-allocated buffer for data written every frame.
+// There is one per frame in flight, reset only after that frame's fence was waited on.
+typedef struct Vk_StreamBuffer
+{
+    Vk_BufferBundle buffer_bundle;
+    VkDeviceSize offset;
+
+    // Outgrown buffers may still be referenced by the frame being recorded
+    Vk_RetiredBufferBundleList retired_buffer_bundles;
+
+} Vk_StreamBuffer;
+
+typedef struct Vk_StreamAllocation
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data_ptr;
 
-    u32 max_index_count;
+} Vk_StreamAllocation;
+
+typedef struct Vk_MeshBundle
+{
+    Vk_BufferBundle vertex_buffer_bundle;
     Vk_BufferBundle index_buffer_bundle;
+    u32 index_count;
+    v4 bounding_sphere; // mesh space center, radius
+    bool is_resident; // draws are skipped until its upload batch has completed
 
-} Vk_PipelineBundle;
+} Vk_MeshBundle;
+
+list_define_type(Vk_MeshBundleList, Vk_MeshBundle);
+
+typedef struct E2R_MeshDraw
+{
+    E2R_MeshHandle mesh;
+    u32 first_instance;
+    u32 instance_count;
+
+} E2R_MeshDraw;
+
+list_define_type(E2R_MeshDrawList, E2R_MeshDraw);
 
 // ------------------------------------
 
+// Matches the push constant block in cull.comp
+typedef struct CullPushConstants
+{
+    v4 frustum_planes[6];
+    v4 bounding_sphere;
+    u32 first_instance;
+    u32 instance_count;
+    u32 draw_index;
+
+} CullPushConstants;
+
 typedef struct UBOLayoutGlobal2D
 {
     m4 proj;
@@ -152,19 +353,27 @@ typedef struct E2R_Ctx
     VkSurfaceKHR vk_surface;
     VkPhysicalDevice vk_physical_device;
     u32 vk_queue_family_index;
+    u32 vk_transfer_queue_family_index; // same as vk_queue_family_index if there is no separate family
+    VkQueue vk_transfer_queue;
     VkDevice vk_device;
     VkQueue vk_queue;
+    VkDeviceSize vk_storage_buffer_alignment;
+    f32 vk_timestamp_period_ns;
+    f32 vk_max_sampler_anisotropy; // 0 when the device doesn't support anisotropic filtering
+    VkPipelineCache vk_pipeline_cache;
+
+    Vk_MemoryAllocator vk_memory_allocator;
 
     Vk_SwapchainBundle vk_swapchain_bundle;
     Vk_DepthImageBundle vk_depth_image_bundle;
-    Vk_RenderPassBundle vk_clear_render_pass_bundle;
-    Vk_RenderPassBundle vk_2d_render_pass_bundle;
-    Vk_RenderPassBundle vk_3d_render_pass_bundle;
-    Vk_RenderPassBundle vk_final_render_pass_bundle;
+    Vk_FramebufferBundle vk_framebuffer_bundle;
+    Vk_RenderPassBundle vk_render_pass_bundle;
+    Vk_RetiredSwapchainList retired_swapchains;
 
     bool first_swapchain_use;
 
     VkCommandPool vk_command_pool;
+    VkCommandPool vk_transfer_command_pool;
 
     Vk_FrameList vk_frame_list;
 
@@ -173,23 +382,49 @@ typedef struct E2R_Ctx
 
     Vk_BufferBundleList ubo_lighting;
 
-    Vk_TextureBundle ducks_texture;
-    Vk_TextureBundle ui_atlas_texture;
-    Vk_TextureBundle font_atlas_texture;
+    Vk_StreamBuffer stream_buffers[FRAMES_IN_FLIGHT];
+
+    Vk_MeshBundleList mesh_list;
+
+    Vk_TextureBundleList texture_list;
+    Vk_TextureTable vk_texture_table;
+    Vk_SamplerCache vk_sampler_cache;
+    Vk_UploadBatch upload_batch;
+    Vk_OwnershipTransferList pending_acquires; // recorded at the start of the next frame
+
+    E2R_TextureHandle white_texture; // stands in for textures that are still uploading
+    E2R_TextureHandle ducks_texture;
+    E2R_TextureHandle ui_atlas_texture;
+    E2R_TextureHandle font_atlas_texture;
 
     Vk_PipelineBundle vk_ui_pipeline_bundle;
     Vk_PipelineBundle vk_cubes_pipeline_bundle;
+    Vk_PipelineBundle vk_cull_pipeline_bundle;
 
     bool rebuild_swapchain;
 
     u32 current_vk_frame;
     u32 current_swapchain_image;
+    u64 submit_serial; // counts graphics submits, so retired objects know which frames came before them
+
+    Vk_StreamAllocation instance_allocation;
+    u32 instance_count;
+    E2R_MeshDrawList mesh_draw_list;
+
+    // GPU culling: compacted instances and indirect commands, one per mesh draw
+    Vk_BufferBundle culled_instance_buffers[FRAMES_IN_FLIGHT];
+    Vk_StreamAllocation draw_command_allocation;
+    E2R_Frustum frustum;
 
-    u32 cubes_index_count;
-    u32 ui_index_count;
+    E2R_CullingMode culling_mode;
+    E2R_CullStats cull_stats;
+
+    Vk_StreamAllocation ui_instance_allocation;
+    u32 ui_quad_count;
     u32 text_index_count;
 
-    FontAtlas font_atlas;
+    E2R_FontHandle default_font;
+    Vk_BufferImageCopyList glyph_atlas_regions; // rebuilt every frame with atlas updates
 
     m4 view_transform;
     v3 view_pos;
@@ -202,10 +437,21 @@ typedef struct E2R_Ctx
 
     u64 current_app_frame;
 
+    E2R_RecordingMode recording_mode;
+    Vk_RecordingBundle vk_recording_bundle;
+
+    // Frame timing; the query pool is VK_NULL_HANDLE without timestamp support
+    VkQueryPool vk_timestamp_query_pool;
+    bool timestamps_pending[FRAMES_IN_FLIGHT];
+    f64 last_frame_start_time;
+    E2R_FrameTimings frame_timings;
+
 } E2R_Ctx;
 
 globvar E2R_Ctx ctx;
 
+E2R_TextureHandle _e2r_texture_create_with_format(const void *pixels, u32 w, u32 h, VkFormat format, u32 bytes_per_pixel, u32 flags);
+
 GLFWwindow *_glfw_create_window(int width, int height, const char *window_name)
 {
     glfwInit();
@@ -316,7 +562,10 @@ u32 _vk_get_queue_family_index()
     {
         VkBool32 present_support;
         vkGetPhysicalDeviceSurfaceSupportKHR(ctx.vk_physical_device, i, ctx.vk_surface, &present_support);
-        if ((queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && present_support)
+        // Graphics and compute on one queue, for the culling pass
+        if ((queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+            (queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+            present_support)
         {
             vk_queue_family_index = i;
         }
@@ -329,14 +578,62 @@ u32 _vk_get_queue_family_index()
     return vk_queue_family_index;
 }
 
+// Prefers a transfer-only family (usually a DMA engine), then any other family that can copy,
+// then falls back to the graphics family
+u32 _vk_get_transfer_queue_family_index()
+{
+    u32 count;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx.vk_physical_device, &count, NULL);
+
+    VkQueueFamilyProperties *queue_families = xmalloc(count * sizeof(queue_families[0]));
+
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx.vk_physical_device, &count, queue_families);
+
+    u32 dedicated_index = UINT32_MAX;
+    u32 secondary_index = UINT32_MAX;
+    for (u32 i = 0; i < count; i++)
+    {
+        if (i == ctx.vk_queue_family_index || queue_families[i].queueCount == 0) continue;
+
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        // Graphics and compute imply transfer support
+        bool can_transfer = flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+        if (!can_transfer) continue;
+
+        if (!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+        {
+            if (dedicated_index == UINT32_MAX) dedicated_index = i;
+        }
+        else if (secondary_index == UINT32_MAX)
+        {
+            secondary_index = i;
+        }
+    }
+
+    free(queue_families);
+
+    if (dedicated_index != UINT32_MAX) return dedicated_index;
+    if (secondary_index != UINT32_MAX) return secondary_index;
+    return ctx.vk_queue_family_index;
+}
+
+bool _vk_has_transfer_queue()
+{
+    return ctx.vk_transfer_queue_family_index != ctx.vk_queue_family_index;
+}
+
 VkDevice _vk_create_device()
 {
     float priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_create_info = {};
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.queueFamilyIndex = ctx.vk_queue_family_index;
-    queue_create_info.queueCount = 1;
-    queue_create_info.pQueuePriorities = &priority;
+    VkDeviceQueueCreateInfo queue_create_infos[2] = {};
+    queue_create_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_create_infos[0].queueFamilyIndex = ctx.vk_queue_family_index;
+    queue_create_infos[0].queueCount = 1;
+    queue_create_infos[0].pQueuePriorities = &priority;
+    queue_create_infos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_create_infos[1].queueFamilyIndex = ctx.vk_transfer_queue_family_index;
+    queue_create_infos[1].queueCount = 1;
+    queue_create_infos[1].pQueuePriorities = &priority;
 
     // VK_KHR_portability_subset must be enabled because physical device VkPhysicalDevice 0x600001667be0 supports it.
     const char *device_extensions[] = {
@@ -347,11 +644,40 @@ VkDevice _vk_create_device()
     };
     VkDeviceCreateInfo device_create_info = {};
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.queueCreateInfoCount = 1;
-    device_create_info.pQueueCreateInfos = &queue_create_info;
+    device_create_info.queueCreateInfoCount = _vk_has_transfer_queue() ? 2 : 1;
+    device_create_info.pQueueCreateInfos = queue_create_infos;
     device_create_info.enabledExtensionCount = array_count(device_extensions);
     device_create_info.ppEnabledExtensionNames = device_extensions;
 
+    VkPhysicalDeviceDescriptorIndexingFeatures supported_indexing_features = {};
+    supported_indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    VkPhysicalDeviceFeatures2 supported_features = {};
+    supported_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supported_features.pNext = &supported_indexing_features;
+    vkGetPhysicalDeviceFeatures2(ctx.vk_physical_device, &supported_features);
+
+    // The bindless texture table
+    if (!supported_indexing_features.shaderSampledImageArrayNonUniformIndexing ||
+        !supported_indexing_features.descriptorBindingSampledImageUpdateAfterBind ||
+        !supported_indexing_features.descriptorBindingUpdateUnusedWhilePending ||
+        !supported_indexing_features.descriptorBindingPartiallyBound ||
+        !supported_indexing_features.runtimeDescriptorArray)
+    {
+        fatal("Device doesn't support the descriptor indexing features needed for bindless textures");
+    }
+    VkPhysicalDeviceDescriptorIndexingFeatures enabled_indexing_features = {};
+    enabled_indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    enabled_indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    enabled_indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    enabled_indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    enabled_indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    enabled_indexing_features.runtimeDescriptorArray = VK_TRUE;
+    device_create_info.pNext = &enabled_indexing_features;
+
+    VkPhysicalDeviceFeatures enabled_features = {};
+    enabled_features.samplerAnisotropy = supported_features.features.samplerAnisotropy;
+    device_create_info.pEnabledFeatures = &enabled_features;
+
     VkDevice vk_device;
     VkResult result = vkCreateDevice(ctx.vk_physical_device, &device_create_info, NULL, &vk_device);
     if (result != VK_SUCCESS) fatal("Failed to create logical device");
@@ -359,21 +685,17 @@ VkDevice _vk_create_device()
     return vk_device;
 }
 
-VkQueue _vk_get_queue()
+VkQueue _vk_get_queue(u32 queue_family_index)
 {
-    VkQueue vk_graphics_queue;
-    vkGetDeviceQueue(ctx.vk_device, ctx.vk_queue_family_index, 0, &vk_graphics_queue);
-    return vk_graphics_queue;
+    VkQueue vk_queue;
+    vkGetDeviceQueue(ctx.vk_device, queue_family_index, 0, &vk_queue);
+    return vk_queue;
 }
 
-Vk_SwapchainBundle _vk_create_swapchain_bundle()
+VkSurfaceFormatKHR _vk_get_surface_format()
 {
-    VkSurfaceCapabilitiesKHR capabilities;
-    VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctx.vk_physical_device, ctx.vk_surface, &capabilities);
-    if (result != VK_SUCCESS) fatal("Failed to get physical device-surface capabilities");
-
     uint32_t format_count;
-    result = vkGetPhysicalDeviceSurfaceFormatsKHR(ctx.vk_physical_device, ctx.vk_surface, &format_count, NULL);
+    VkResult result = vkGetPhysicalDeviceSurfaceFormatsKHR(ctx.vk_physical_device, ctx.vk_surface, &format_count, NULL);
     if (result != VK_SUCCESS) fatal("Failed to get physical device-surface formats");
 
     VkSurfaceFormatKHR *formats = xmalloc(format_count * sizeof(formats[0]));
@@ -385,6 +707,17 @@ Vk_SwapchainBundle _vk_create_swapchain_bundle()
 
     free(formats);
 
+    return surface_format;
+}
+
+Vk_SwapchainBundle _vk_create_swapchain_bundle(VkSwapchainKHR old_swapchain)
+{
+    VkSurfaceCapabilitiesKHR capabilities;
+    VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctx.vk_physical_device, ctx.vk_surface, &capabilities);
+    if (result != VK_SUCCESS) fatal("Failed to get physical device-surface capabilities");
+
+    VkSurfaceFormatKHR surface_format = _vk_get_surface_format();
+
     u32 image_count = capabilities.minImageCount + 1;
     if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount)
     {
@@ -405,6 +738,7 @@ Vk_SwapchainBundle _vk_create_swapchain_bundle()
     swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapchain_create_info.presentMode = VK_PRESENT_MODE_FIFO_KHR; // vsync
     swapchain_create_info.clipped = VK_TRUE;
+    swapchain_create_info.oldSwapchain = old_swapchain;
 
     VkSwapchainKHR swapchain;
     result = vkCreateSwapchainKHR(ctx.vk_device, &swapchain_create_info, NULL, &swapchain);
@@ -461,14 +795,15 @@ Vk_SwapchainBundle _vk_create_swapchain_bundle()
     };
 }
 
-u32 _vk_find_memory_type(VkPhysicalDevice physical_device, u32 type_filter, VkMemoryPropertyFlags props)
+// GPU memory -----------------------------
+
+u32 _vk_find_memory_type(u32 type_filter, VkMemoryPropertyFlags props)
 {
-    VkPhysicalDeviceMemoryProperties mem_props;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
-    for (u32 i = 0; i < mem_props.memoryTypeCount; i++)
+    const VkPhysicalDeviceMemoryProperties *mem_props = &ctx.vk_memory_allocator.memory_properties;
+    for (u32 i = 0; i < mem_props->memoryTypeCount; i++)
     {
         if ((type_filter & (1 << i)) &&
-            (mem_props.memoryTypes[i].propertyFlags & props) == props)
+            (mem_props->memoryTypes[i].propertyFlags & props) == props)
         {
             return i;
         }
@@ -477,198 +812,569 @@ u32 _vk_find_memory_type(VkPhysicalDevice physical_device, u32 type_filter, VkMe
     return 0;
 }
 
-Vk_DepthImageBundle _vk_create_depth_image_bundle()
+Vk_MemoryAllocator _vk_create_memory_allocator()
 {
-    VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
-
-    Vk_DepthImageBundle depth_image_bundle =
-    {
-        .image_count = ctx.vk_swapchain_bundle.image_count,
-        .depth_format = depth_format
-    };
-
-    VkResult result;
+    Vk_MemoryAllocator allocator = {};
+    vkGetPhysicalDeviceMemoryProperties(ctx.vk_physical_device, &allocator.memory_properties);
+    return allocator;
+}
 
-    VkImage *images = xmalloc(depth_image_bundle.image_count * sizeof(images[0]));
-    VkDeviceMemory *memory_list = xmalloc(depth_image_bundle.image_count * sizeof(memory_list[0]));
-    VkImageView *image_views = xmalloc(depth_image_bundle.image_count * sizeof(image_views[0]));
-    for (u32 i = 0; i < depth_image_bundle.image_count; i++)
+void _vk_memory_range_list_insert(Vk_MemoryRangeList *list, size_t index, Vk_MemoryRange range)
+{
+    list_append(list, range);
+    for (size_t i = list->size - 1; i > index; i--)
     {
-        VkImageCreateInfo image_create_info = {};
-        image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        image_create_info.imageType = VK_IMAGE_TYPE_2D;
-        image_create_info.extent.width = ctx.vk_swapchain_bundle.extent.width;
-        image_create_info.extent.height = ctx.vk_swapchain_bundle.extent.height;
-        image_create_info.extent.depth = 1;
-        image_create_info.mipLevels = 1;
-        image_create_info.arrayLayers = 1;
-        image_create_info.format = depth_format;
-        image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-        image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-        image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        result = vkCreateImage(ctx.vk_device, &image_create_info, NULL, &images[i]);
-        if (result != VK_SUCCESS) fatal("Failed to create depth buffer image");
-
-        VkMemoryRequirements mem_req;
-        vkGetImageMemoryRequirements(ctx.vk_device, images[i], &mem_req);
+        list->data[i] = list->data[i - 1];
+    }
+    list->data[index] = range;
+}
 
-        VkMemoryAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocate_info.allocationSize = mem_req.size;
-        allocate_info.memoryTypeIndex = _vk_find_memory_type(
-            ctx.vk_physical_device,
-            mem_req.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+Vk_MemoryBlock *_vk_memory_block_create(u32 memory_type, VkDeviceSize size, bool is_linear, const VkMemoryDedicatedAllocateInfo *dedicated_info)
+{
+    Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
 
-        result = vkAllocateMemory(ctx.vk_device, &allocate_info, NULL, &memory_list[i]);
-        if (result != VK_SUCCESS) fatal("Failed to allocate memory for depth buffer image");
+    VkMemoryAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.pNext = dedicated_info;
+    allocate_info.allocationSize = size;
+    allocate_info.memoryTypeIndex = memory_type;
 
-        result = vkBindImageMemory(ctx.vk_device, images[i], memory_list[i], 0);
-        if (result != VK_SUCCESS) fatal("Failed to bind memory for depth buffer image");
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(ctx.vk_device, &allocate_info, NULL, &memory);
+    if (result != VK_SUCCESS) fatal("Failed to allocate device memory block of %llu bytes", (unsigned long long)size);
 
-        VkImageViewCreateInfo create_info = {};
-        create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        create_info.image = images[i];
-        create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        create_info.format = depth_format;
-        create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        create_info.subresourceRange.baseMipLevel = 0;
-        create_info.subresourceRange.levelCount = 1;
-        create_info.subresourceRange.baseArrayLayer = 0;
-        create_info.subresourceRange.layerCount = 1;
+    void *data_ptr = NULL;
+    if (allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        result = vkMapMemory(ctx.vk_device, memory, 0, VK_WHOLE_SIZE, 0, &data_ptr);
+        if (result != VK_SUCCESS) fatal("Failed to map device memory block");
+    }
 
-        VkResult result = vkCreateImageView(ctx.vk_device, &create_info, NULL, &image_views[i]);
-        if (result != VK_SUCCESS) fatal("Failed to create image view");
+    Vk_MemoryBlock *block = xcalloc(sizeof(*block));
+    block->memory = memory;
+    block->size = size;
+    block->data_ptr = data_ptr;
+    block->memory_type = memory_type;
+    block->is_linear = is_linear;
+    block->is_dedicated = (dedicated_info != NULL);
+    if (!block->is_dedicated)
+    {
+        list_append(&block->free_ranges, ((Vk_MemoryRange){ .offset = 0, .size = size }));
     }
 
-    depth_image_bundle.images = images;
-    depth_image_bundle.memory_list = memory_list;
-    depth_image_bundle.image_views = image_views;
+    list_append(&allocator->blocks, block);
+    allocator->bytes_reserved += size;
 
-    return depth_image_bundle;
+    return block;
 }
 
-Vk_RenderPassBundle _vk_create_render_pass_bundle(const Vk_DepthImageBundle *depth_image_bundle, bool with_clear, bool is_final)
+void _vk_memory_block_destroy(Vk_MemoryBlock *block)
 {
-    bool with_depth = (depth_image_bundle != NULL);
-    Vk_RenderPassBundle render_pass_bundle =
-    {
-        .color_format = ctx.vk_swapchain_bundle.format.format,
-        .depth_format = with_depth ? depth_image_bundle->depth_format : VK_FORMAT_UNDEFINED,
-        .framebuffer_count = ctx.vk_swapchain_bundle.image_count
-    };
+    Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
 
-    VkResult result;
-
-    VkRenderPass render_pass;
+    if (block->data_ptr != NULL)
     {
-        VkAttachmentDescription color_attachment_description = {};
-        color_attachment_description.format = render_pass_bundle.color_format;
-        color_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
-        color_attachment_description.loadOp = with_clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
-        color_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        color_attachment_description.initialLayout = with_clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        color_attachment_description.finalLayout = is_final ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        vkUnmapMemory(ctx.vk_device, block->memory);
+    }
+    vkFreeMemory(ctx.vk_device, block->memory, NULL);
+    allocator->bytes_reserved -= block->size;
 
-        VkAttachmentReference color_attachment_reference = {};
-        color_attachment_reference.attachment = 0;
-        color_attachment_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    list_free(&block->free_ranges);
+    free(block);
+}
 
-        VkAttachmentDescription depth_attachment_description = {};
-        depth_attachment_description.format = render_pass_bundle.depth_format;
-        depth_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
-        depth_attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depth_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depth_attachment_description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depth_attachment_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depth_attachment_description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depth_attachment_description.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+// First fit; alignment padding stays in the free list as its own range
+bool _vk_memory_block_alloc(Vk_MemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset)
+{
+    Vk_MemoryRange *range;
+    list_iterate(&block->free_ranges, range_i, range)
+    {
+        VkDeviceSize aligned_offset = (range->offset + alignment - 1) & ~(alignment - 1);
+        VkDeviceSize padding = aligned_offset - range->offset;
+        if (padding + size > range->size) continue;
 
-        VkAttachmentReference depth_attachment_reference = {};
-        depth_attachment_reference.attachment = 1;
-        depth_attachment_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        VkDeviceSize range_end = range->offset + range->size;
+        VkDeviceSize alloc_end = aligned_offset + size;
 
-        VkSubpassDescription subpass_description = {};
-        subpass_description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass_description.colorAttachmentCount = 1;
-        subpass_description.pColorAttachments = &color_attachment_reference;
-        if (with_depth)
+        if (padding > 0)
         {
-            subpass_description.pDepthStencilAttachment = &depth_attachment_reference;
+            range->size = padding;
+            if (alloc_end < range_end)
+            {
+                _vk_memory_range_list_insert(&block->free_ranges, range_i + 1, (Vk_MemoryRange){ .offset = alloc_end, .size = range_end - alloc_end });
+            }
         }
-
-        VkRenderPassCreateInfo render_pass_create_info = {};
-        render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        render_pass_create_info.subpassCount = 1;
-        render_pass_create_info.pSubpasses = &subpass_description;
-        if (with_depth)
+        else if (alloc_end < range_end)
         {
-            VkAttachmentDescription render_pass_attachments[] = { color_attachment_description, depth_attachment_description };
-            render_pass_create_info.attachmentCount = array_count(render_pass_attachments);
-            render_pass_create_info.pAttachments = render_pass_attachments;
+            range->offset = alloc_end;
+            range->size = range_end - alloc_end;
         }
         else
         {
-            render_pass_create_info.attachmentCount = 1;
-            render_pass_create_info.pAttachments = &color_attachment_description;
+            list_erase(&block->free_ranges, range_i);
         }
 
-        result = vkCreateRenderPass(ctx.vk_device, &render_pass_create_info, NULL, &render_pass);
-        if (result != VK_SUCCESS) fatal("Failed to create render pass");
+        *out_offset = aligned_offset;
+        return true;
     }
-    render_pass_bundle.render_pass = render_pass;
 
-    VkFramebuffer *framebuffers = xmalloc(render_pass_bundle.framebuffer_count * sizeof(framebuffers[0]));
-    for (u32 i = 0; i < render_pass_bundle.framebuffer_count; i++)
-    {
-        VkFramebufferCreateInfo create_info = {};
-        create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        create_info.renderPass = render_pass;
-        create_info.width = ctx.vk_swapchain_bundle.extent.width;
-        create_info.height = ctx.vk_swapchain_bundle.extent.height;
-        create_info.layers = 1;
+    return false;
+}
 
-        if (with_depth)
-        {
-            VkImageView attachments[] =
-            {
-                ctx.vk_swapchain_bundle.image_views[i],
-                depth_image_bundle->image_views[i]
-            };
-            create_info.attachmentCount = array_count(attachments);
-            create_info.pAttachments = attachments;
-        }
-        else
-        {
-            create_info.attachmentCount = 1;
-            create_info.pAttachments = &ctx.vk_swapchain_bundle.image_views[i];
-        }
+// Keeps the free list sorted by offset and merges adjacent ranges
+void _vk_memory_block_free(Vk_MemoryBlock *block, VkDeviceSize offset, VkDeviceSize size)
+{
+    Vk_MemoryRangeList *free_ranges = &block->free_ranges;
 
-        result = vkCreateFramebuffer(ctx.vk_device, &create_info, NULL, &framebuffers[i]);
-        if (result != VK_SUCCESS) fatal("Failed to create framebuffer");
+    size_t index = 0;
+    while (index < free_ranges->size && free_ranges->data[index].offset < offset) index++;
+
+    _vk_memory_range_list_insert(free_ranges, index, (Vk_MemoryRange){ .offset = offset, .size = size });
+
+    if (index + 1 < free_ranges->size &&
+        free_ranges->data[index].offset + free_ranges->data[index].size == free_ranges->data[index + 1].offset)
+    {
+        free_ranges->data[index].size += free_ranges->data[index + 1].size;
+        list_erase(free_ranges, index + 1);
     }
-    render_pass_bundle.framebuffers = framebuffers;
 
-    return render_pass_bundle;
+    if (index > 0 &&
+        free_ranges->data[index - 1].offset + free_ranges->data[index - 1].size == free_ranges->data[index].offset)
+    {
+        free_ranges->data[index - 1].size += free_ranges->data[index].size;
+        list_erase(free_ranges, index);
+    }
 }
 
-VkCommandPool _vk_create_command_pool()
+VkDeviceSize _vk_memory_get_block_size(u32 memory_type)
 {
-    VkCommandPoolCreateInfo create_info = {};
-    create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    create_info.queueFamilyIndex = ctx.vk_queue_family_index;
-    create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // allows resetting individual buffers
+    const VkPhysicalDeviceMemoryProperties *mem_props = &ctx.vk_memory_allocator.memory_properties;
+    VkDeviceSize heap_size = mem_props->memoryHeaps[mem_props->memoryTypes[memory_type].heapIndex].size;
 
-    VkCommandPool command_pool;
+    // Small heaps (e.g. host-visible VRAM windows) get smaller blocks
+    VkDeviceSize block_size = MEMORY_BLOCK_SIZE;
+    while (block_size > heap_size / 8 && block_size > 1024 * 1024) block_size /= 2;
+    return block_size;
+}
+
+Vk_Allocation _vk_memory_alloc(const VkMemoryRequirements *mem_req, VkMemoryPropertyFlags props, bool is_linear, const VkMemoryDedicatedAllocateInfo *dedicated_info)
+{
+    Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
+
+    u32 memory_type = _vk_find_memory_type(mem_req->memoryTypeBits, props);
+    VkDeviceSize block_size = _vk_memory_get_block_size(memory_type);
+
+    Vk_MemoryBlock *block = NULL;
+    VkDeviceSize offset = 0;
+
+    if (mem_req->size >= block_size / 2)
+    {
+        block = _vk_memory_block_create(memory_type, mem_req->size, is_linear, dedicated_info);
+        allocator->dedicated_allocation_count++;
+    }
+    else
+    {
+        Vk_MemoryBlock **it;
+        list_iterate(&allocator->blocks, block_i, it)
+        {
+            Vk_MemoryBlock *candidate = *it;
+            if (candidate->is_dedicated || candidate->memory_type != memory_type || candidate->is_linear != is_linear) continue;
+            if (_vk_memory_block_alloc(candidate, mem_req->size, mem_req->alignment, &offset))
+            {
+                block = candidate;
+                break;
+            }
+        }
+
+        if (block == NULL)
+        {
+            block = _vk_memory_block_create(memory_type, block_size, is_linear, NULL);
+            bool ok = _vk_memory_block_alloc(block, mem_req->size, mem_req->alignment, &offset);
+            assert(ok);
+        }
+    }
+
+    allocator->allocation_count++;
+    allocator->bytes_used += mem_req->size;
+
+    return (Vk_Allocation){
+        .block = block,
+        .memory = block->memory,
+        .offset = offset,
+        .size = mem_req->size,
+        .data_ptr = block->data_ptr ? (u8 *)block->data_ptr + offset : NULL
+    };
+}
+
+// An empty block goes back to the driver unless it's the last one of its kind, which is kept so that
+// freeing and reallocating the same resource doesn't round-trip through vkAllocateMemory
+void _vk_memory_release_if_empty(Vk_MemoryBlock *block)
+{
+    Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
+
+    bool is_empty = block->free_ranges.size == 1 && block->free_ranges.data[0].size == block->size;
+    if (!is_empty) return;
+
+    size_t block_index = 0;
+    bool has_sibling = false;
+    Vk_MemoryBlock **it;
+    list_iterate(&allocator->blocks, block_i, it)
+    {
+        Vk_MemoryBlock *other = *it;
+        if (other == block) block_index = block_i;
+        else if (!other->is_dedicated && other->memory_type == block->memory_type && other->is_linear == block->is_linear) has_sibling = true;
+    }
+    if (!has_sibling) return;
+
+    list_erase(&allocator->blocks, block_index);
+    _vk_memory_block_destroy(block);
+}
+
+void _vk_memory_free(Vk_Allocation *allocation)
+{
+    Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
+    Vk_MemoryBlock *block = allocation->block;
+
+    allocator->allocation_count--;
+    allocator->bytes_used -= allocation->size;
+
+    if (block->is_dedicated)
+    {
+        Vk_MemoryBlock **it;
+        list_iterate(&allocator->blocks, block_i, it)
+        {
+            if (*it == block)
+            {
+                list_erase(&allocator->blocks, block_i);
+                break;
+            }
+        }
+        _vk_memory_block_destroy(block);
+        allocator->dedicated_allocation_count--;
+    }
+    else
+    {
+        _vk_memory_block_free(block, allocation->offset, allocation->size);
+        _vk_memory_release_if_empty(block);
+    }
+
+    *allocation = (Vk_Allocation){};
+}
+
+Vk_Allocation _vk_memory_alloc_for_buffer(VkBuffer buffer, VkMemoryPropertyFlags props)
+{
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(ctx.vk_device, buffer, &mem_req);
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {};
+    dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicated_info.buffer = buffer;
+
+    Vk_Allocation allocation = _vk_memory_alloc(&mem_req, props, true, &dedicated_info);
+
+    VkResult result = vkBindBufferMemory(ctx.vk_device, buffer, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS) fatal("Failed to bind memory to buffer");
+
+    return allocation;
+}
+
+Vk_Allocation _vk_memory_alloc_for_image(VkImage image, VkMemoryPropertyFlags props)
+{
+    VkMemoryRequirements mem_req;
+    vkGetImageMemoryRequirements(ctx.vk_device, image, &mem_req);
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {};
+    dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicated_info.image = image;
+
+    // All images here use optimal tiling, so they never share a block with buffers
+    Vk_Allocation allocation = _vk_memory_alloc(&mem_req, props, false, &dedicated_info);
+
+    VkResult result = vkBindImageMemory(ctx.vk_device, image, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS) fatal("Failed to bind memory to image");
+
+    return allocation;
+}
+
+void _vk_destroy_memory_allocator(Vk_MemoryAllocator *allocator)
+{
+    if (allocator->allocation_count != 0)
+    {
+        warning("%u device memory allocations still alive", allocator->allocation_count);
+    }
+
+    Vk_MemoryBlock **it;
+    list_iterate(&allocator->blocks, block_i, it)
+    {
+        _vk_memory_block_destroy(*it);
+    }
+    list_free(&allocator->blocks);
+
+    *allocator = (Vk_MemoryAllocator){};
+}
+
+// ----------------------------------------
+
+Vk_DepthImageBundle _vk_create_depth_image_bundle()
+{
+    VkFormat depth_format = DEPTH_FORMAT;
+
+    Vk_DepthImageBundle depth_image_bundle =
+    {
+        .image_count = ctx.vk_swapchain_bundle.image_count,
+        .depth_format = depth_format
+    };
+
+    VkResult result;
+
+    VkImage *images = xmalloc(depth_image_bundle.image_count * sizeof(images[0]));
+    Vk_Allocation *allocations = xmalloc(depth_image_bundle.image_count * sizeof(allocations[0]));
+    VkImageView *image_views = xmalloc(depth_image_bundle.image_count * sizeof(image_views[0]));
+    for (u32 i = 0; i < depth_image_bundle.image_count; i++)
+    {
+        VkImageCreateInfo image_create_info = {};
+        image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_create_info.imageType = VK_IMAGE_TYPE_2D;
+        image_create_info.extent.width = ctx.vk_swapchain_bundle.extent.width;
+        image_create_info.extent.height = ctx.vk_swapchain_bundle.extent.height;
+        image_create_info.extent.depth = 1;
+        image_create_info.mipLevels = 1;
+        image_create_info.arrayLayers = 1;
+        image_create_info.format = depth_format;
+        image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        result = vkCreateImage(ctx.vk_device, &image_create_info, NULL, &images[i]);
+        if (result != VK_SUCCESS) fatal("Failed to create depth buffer image");
+
+        allocations[i] = _vk_memory_alloc_for_image(images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkImageViewCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        create_info.image = images[i];
+        create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        create_info.format = depth_format;
+        create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        create_info.subresourceRange.baseMipLevel = 0;
+        create_info.subresourceRange.levelCount = 1;
+        create_info.subresourceRange.baseArrayLayer = 0;
+        create_info.subresourceRange.layerCount = 1;
+
+        VkResult result = vkCreateImageView(ctx.vk_device, &create_info, NULL, &image_views[i]);
+        if (result != VK_SUCCESS) fatal("Failed to create image view");
+    }
+
+    depth_image_bundle.images = images;
+    depth_image_bundle.allocations = allocations;
+    depth_image_bundle.image_views = image_views;
+
+    return depth_image_bundle;
+}
+
+// One pass for the whole frame: subpass 0 draws 3D with depth, subpass 1 draws the UI on top.
+// The clear is the color loadOp and the final layout does the transition for present.
+// Only depends on the formats, so it outlives swapchain rebuilds.
+Vk_RenderPassBundle _vk_create_render_pass_bundle(VkFormat color_format, VkFormat depth_format)
+{
+    Vk_RenderPassBundle render_pass_bundle =
+    {
+        .color_format = color_format,
+        .depth_format = depth_format
+    };
+
+    VkResult result;
+
+    VkRenderPass render_pass;
+    {
+        VkAttachmentDescription color_attachment_description = {};
+        color_attachment_description.format = render_pass_bundle.color_format;
+        color_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
+        color_attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        color_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        color_attachment_description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        color_attachment_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        color_attachment_description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        color_attachment_description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference color_attachment_reference = {};
+        color_attachment_reference.attachment = 0;
+        color_attachment_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentDescription depth_attachment_description = {};
+        depth_attachment_description.format = render_pass_bundle.depth_format;
+        depth_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
+        depth_attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depth_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depth_attachment_description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depth_attachment_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depth_attachment_description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depth_attachment_description.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depth_attachment_reference = {};
+        depth_attachment_reference.attachment = 1;
+        depth_attachment_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass_descriptions[2] = {};
+        // 3D
+        subpass_descriptions[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass_descriptions[0].colorAttachmentCount = 1;
+        subpass_descriptions[0].pColorAttachments = &color_attachment_reference;
+        subpass_descriptions[0].pDepthStencilAttachment = &depth_attachment_reference;
+        // UI
+        subpass_descriptions[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass_descriptions[1].colorAttachmentCount = 1;
+        subpass_descriptions[1].pColorAttachments = &color_attachment_reference;
+
+        VkSubpassDependency subpass_dependencies[2] = {};
+        // Wait for the acquired image (and the previous use of the depth image) before writing
+        subpass_dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        subpass_dependencies[0].dstSubpass = 0;
+        subpass_dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        subpass_dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        subpass_dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        subpass_dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        // UI blends over the 3D result
+        subpass_dependencies[1].srcSubpass = 0;
+        subpass_dependencies[1].dstSubpass = 1;
+        subpass_dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpass_dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpass_dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        subpass_dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        subpass_dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkAttachmentDescription render_pass_attachments[] = { color_attachment_description, depth_attachment_description };
+
+        VkRenderPassCreateInfo render_pass_create_info = {};
+        render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        render_pass_create_info.attachmentCount = array_count(render_pass_attachments);
+        render_pass_create_info.pAttachments = render_pass_attachments;
+        render_pass_create_info.subpassCount = array_count(subpass_descriptions);
+        render_pass_create_info.pSubpasses = subpass_descriptions;
+        render_pass_create_info.dependencyCount = array_count(subpass_dependencies);
+        render_pass_create_info.pDependencies = subpass_dependencies;
+
+        result = vkCreateRenderPass(ctx.vk_device, &render_pass_create_info, NULL, &render_pass);
+        if (result != VK_SUCCESS) fatal("Failed to create render pass");
+    }
+    render_pass_bundle.render_pass = render_pass;
+
+    return render_pass_bundle;
+}
+
+Vk_FramebufferBundle _vk_create_framebuffer_bundle(const Vk_RenderPassBundle *render_pass_bundle, const Vk_DepthImageBundle *depth_image_bundle)
+{
+    Vk_FramebufferBundle framebuffer_bundle =
+    {
+        .framebuffer_count = ctx.vk_swapchain_bundle.image_count
+    };
+
+    VkFramebuffer *framebuffers = xmalloc(framebuffer_bundle.framebuffer_count * sizeof(framebuffers[0]));
+    for (u32 i = 0; i < framebuffer_bundle.framebuffer_count; i++)
+    {
+        VkImageView attachments[] =
+        {
+            ctx.vk_swapchain_bundle.image_views[i],
+            depth_image_bundle->image_views[i]
+        };
+
+        VkFramebufferCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        create_info.renderPass = render_pass_bundle->render_pass;
+        create_info.attachmentCount = array_count(attachments);
+        create_info.pAttachments = attachments;
+        create_info.width = ctx.vk_swapchain_bundle.extent.width;
+        create_info.height = ctx.vk_swapchain_bundle.extent.height;
+        create_info.layers = 1;
+
+        VkResult result = vkCreateFramebuffer(ctx.vk_device, &create_info, NULL, &framebuffers[i]);
+        if (result != VK_SUCCESS) fatal("Failed to create framebuffer");
+    }
+    framebuffer_bundle.framebuffers = framebuffers;
+
+    return framebuffer_bundle;
+}
+
+// Two timestamps per frame in flight, bracketing its command buffer
+VkQueryPool _vk_create_timestamp_query_pool()
+{
+    u32 count;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx.vk_physical_device, &count, NULL);
+    VkQueueFamilyProperties *queue_families = xmalloc(count * sizeof(queue_families[0]));
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx.vk_physical_device, &count, queue_families);
+    u32 timestamp_valid_bits = queue_families[ctx.vk_queue_family_index].timestampValidBits;
+    free(queue_families);
+
+    if (timestamp_valid_bits == 0)
+    {
+        warning("Queue has no timestamp support, GPU frame times won't be measured");
+        return VK_NULL_HANDLE;
+    }
+
+    VkQueryPoolCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    create_info.queryCount = FRAMES_IN_FLIGHT * TIMESTAMPS_PER_FRAME;
+
+    VkQueryPool query_pool;
+    VkResult result = vkCreateQueryPool(ctx.vk_device, &create_info, NULL, &query_pool);
+    if (result != VK_SUCCESS) fatal("Failed to create timestamp query pool");
+
+    return query_pool;
+}
+
+VkCommandPool _vk_create_command_pool(u32 queue_family_index)
+{
+    VkCommandPoolCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    create_info.queueFamilyIndex = queue_family_index;
+    create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // allows resetting individual buffers
+
+    VkCommandPool command_pool;
     VkResult result = vkCreateCommandPool(ctx.vk_device, &create_info, NULL, &command_pool);
     if (result != VK_SUCCESS) fatal("Failed to create command pool");
 
     return command_pool;
 }
 
+Vk_RecordingBundle _vk_create_recording_bundle(u32 slot_count)
+{
+    Vk_RecordingBundle recording_bundle =
+    {
+        .slot_count = slot_count,
+    };
+
+    for (u32 frame_i = 0; frame_i < FRAMES_IN_FLIGHT; frame_i++)
+    {
+        recording_bundle.command_pools[frame_i] = xmalloc(slot_count * sizeof(recording_bundle.command_pools[frame_i][0]));
+        recording_bundle.command_buffers[frame_i] = xmalloc(slot_count * sizeof(recording_bundle.command_buffers[frame_i][0]));
+
+        for (u32 slot_i = 0; slot_i < slot_count; slot_i++)
+        {
+            VkCommandPoolCreateInfo pool_create_info = {};
+            pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            pool_create_info.queueFamilyIndex = ctx.vk_queue_family_index;
+            pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // reset as a whole every frame
+
+            VkResult result = vkCreateCommandPool(ctx.vk_device, &pool_create_info, NULL, &recording_bundle.command_pools[frame_i][slot_i]);
+            if (result != VK_SUCCESS) fatal("Failed to create recording command pool");
+
+            VkCommandBufferAllocateInfo allocate_info = {};
+            allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocate_info.commandPool = recording_bundle.command_pools[frame_i][slot_i];
+            allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocate_info.commandBufferCount = 1;
+
+            result = vkAllocateCommandBuffers(ctx.vk_device, &allocate_info, &recording_bundle.command_buffers[frame_i][slot_i]);
+            if (result != VK_SUCCESS) fatal("Failed to allocate secondary command buffer");
+        }
+    }
+
+    return recording_bundle;
+}
+
 Vk_FrameList _vk_create_frame_list()
 {
     Vk_FrameList frame_list =
@@ -717,28 +1423,79 @@ Vk_FrameList _vk_create_frame_list()
     return frame_list;
 }
 
-void _vk_frame_list_reset_sync_objects(Vk_FrameList *frame_list)
+// Seeded from PIPELINE_CACHE_PATH if the file was written by the same driver and device
+VkPipelineCache _vk_create_pipeline_cache()
 {
-    VkResult result;
-    for (u32 i = 0; i < frame_list->count; i++)
+    void *initial_data = NULL;
+    size_t initial_data_size = 0;
+
+    FILE *file = fopen(PIPELINE_CACHE_PATH, "rb");
+    if (file)
     {
-        vkDestroyFence(ctx.vk_device, frame_list->frames[i].in_flight_fence, NULL);
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        rewind(file);
 
-        VkFenceCreateInfo fence_create_info = {};
-        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        if (size >= (long)sizeof(VkPipelineCacheHeaderVersionOne))
+        {
+            initial_data = xmalloc(size);
+            if (fread(initial_data, 1, size, file) == (size_t)size)
+            {
+                initial_data_size = (size_t)size;
+            }
+        }
+        fclose(file);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(ctx.vk_physical_device, &properties);
+
+        VkPipelineCacheHeaderVersionOne header;
+        if (initial_data_size > 0) memcpy(&header, initial_data, sizeof(header));
+        bool is_valid = initial_data_size > 0 &&
+            header.headerSize >= sizeof(header) &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == properties.vendorID &&
+            header.deviceID == properties.deviceID &&
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+        if (!is_valid)
+        {
+            trace("Discarding pipeline cache %s, it doesn't match this device or driver", PIPELINE_CACHE_PATH);
+            initial_data_size = 0;
+        }
+    }
 
-        result = vkCreateFence(ctx.vk_device, &fence_create_info, NULL, &frame_list->frames[i].in_flight_fence);
-        if (result != VK_SUCCESS) fatal("Failed to create in flight fence");
+    VkPipelineCacheCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = initial_data_size;
+    create_info.pInitialData = initial_data_size > 0 ? initial_data : NULL;
 
-        vkDestroySemaphore(ctx.vk_device, frame_list->frames[i].acquire_semaphore, NULL);
+    VkPipelineCache pipeline_cache;
+    VkResult result = vkCreatePipelineCache(ctx.vk_device, &create_info, NULL, &pipeline_cache);
+    if (result != VK_SUCCESS) fatal("Failed to create pipeline cache");
 
-        VkSemaphoreCreateInfo semaphore_create_info = {};
-        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    free(initial_data);
+    return pipeline_cache;
+}
 
-        result = vkCreateSemaphore(ctx.vk_device, &semaphore_create_info, NULL, &frame_list->frames[i].acquire_semaphore);
-        if (result != VK_SUCCESS) fatal("Failed to create acquire semaphore");
+void _vk_save_pipeline_cache()
+{
+    size_t size;
+    VkResult result = vkGetPipelineCacheData(ctx.vk_device, ctx.vk_pipeline_cache, &size, NULL);
+    if (result != VK_SUCCESS || size == 0) return;
+
+    void *data = xmalloc(size);
+    result = vkGetPipelineCacheData(ctx.vk_device, ctx.vk_pipeline_cache, &size, data);
+    if (result == VK_SUCCESS)
+    {
+        FILE *file = fopen(PIPELINE_CACHE_PATH, "wb");
+        if (file)
+        {
+            fwrite(data, 1, size, file);
+            fclose(file);
+        }
+        else warning("Failed to write pipeline cache %s", PIPELINE_CACHE_PATH);
     }
+    free(data);
 }
 
 VkShaderModule _vk_create_shader_module(const char *path)
@@ -782,35 +1539,12 @@ Vk_BufferBundle _vk_create_buffer_bundle(VkDeviceSize size, VkBufferUsageFlags u
         if (result != VK_SUCCESS) fatal("Failed to create uniform buffer");
     }
 
-    VkDeviceMemory device_memory;
-    {
-        VkMemoryRequirements memory_requirements;
-        vkGetBufferMemoryRequirements(ctx.vk_device, buffer, &memory_requirements);
-
-        VkMemoryAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocate_info.allocationSize = memory_requirements.size;
-        allocate_info.memoryTypeIndex = _vk_find_memory_type(
-            ctx.vk_physical_device,
-            memory_requirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        result = vkAllocateMemory(ctx.vk_device, &allocate_info, NULL, &device_memory);
-        if (result != VK_SUCCESS) fatal("Failed to allocate memory for uniform buffer");
-    }
-
-    result = vkBindBufferMemory(ctx.vk_device, buffer, device_memory, 0);
-    if (result != VK_SUCCESS) fatal("Failed to bind memory to uniform buffer");
-
-    void *data;
-    result = vkMapMemory(ctx.vk_device, device_memory, 0, size, 0, &data);
-    if (result != VK_SUCCESS) fatal("Failed to map vertex buffer memory");
+    Vk_Allocation allocation = _vk_memory_alloc_for_buffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
     return (Vk_BufferBundle){
         .buffer = buffer,
-        .memory = device_memory,
-        .data_ptr = data,
+        .allocation = allocation,
+        .data_ptr = allocation.data_ptr,
         .size = size
     };
 }
@@ -836,165 +1570,126 @@ Vk_BufferBundleList _vk_create_buffer_bundle_list(VkDeviceSize max_size, VkBuffe
 
 void _vk_destroy_buffer_bundle(Vk_BufferBundle *bundle);
 
-Vk_TextureBundle _vk_load_texture_from_pixels(void *pixels, u32 w, u32 h, VkDeviceSize image_size, VkFormat format)
+Vk_StreamBuffer _vk_create_stream_buffer(VkDeviceSize size)
 {
-    VkResult result;
-
-    Vk_BufferBundle texture_staging_buffer = _vk_create_buffer_bundle(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    return (Vk_StreamBuffer){
+        .buffer_bundle = _vk_create_buffer_bundle(size, STREAM_BUFFER_USAGE),
+        .offset = 0
+    };
+}
 
-    memcpy(texture_staging_buffer.data_ptr, pixels, (size_t)image_size);
+Vk_StreamAllocation _vk_stream_buffer_alloc(Vk_StreamBuffer *stream_buffer, VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkDeviceSize offset = (stream_buffer->offset + alignment - 1) & ~(alignment - 1);
 
-    // Create image for the texture
-    VkImage texture_image;
+    if (offset + size > stream_buffer->buffer_bundle.size)
     {
-        VkImageCreateInfo texture_image_create_info = {};
-        texture_image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        texture_image_create_info.imageType = VK_IMAGE_TYPE_2D;
-        texture_image_create_info.format = format;
-        texture_image_create_info.extent = (VkExtent3D){ w, h, 1 };
-        texture_image_create_info.mipLevels = 1;
-        texture_image_create_info.arrayLayers = 1;
-        texture_image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-        texture_image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-        texture_image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-        texture_image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        texture_image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkDeviceSize new_size = stream_buffer->buffer_bundle.size * 2;
+        while (new_size < size) new_size *= 2;
 
-        result = vkCreateImage(ctx.vk_device, &texture_image_create_info, NULL, &texture_image);
-        if (result != VK_SUCCESS) fatal("Failed to create texture image");
+        trace("Growing stream buffer to %llu bytes", (unsigned long long)new_size);
+
+        list_append(&stream_buffer->retired_buffer_bundles, stream_buffer->buffer_bundle);
+        stream_buffer->buffer_bundle = _vk_create_buffer_bundle(new_size, STREAM_BUFFER_USAGE);
+        offset = 0;
     }
 
-    VkDeviceMemory texture_image_memory;
-    {
-        VkMemoryRequirements mem_req;
-        vkGetImageMemoryRequirements(ctx.vk_device, texture_image, &mem_req);
+    stream_buffer->offset = offset + size;
 
-        VkMemoryAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocate_info.allocationSize = mem_req.size;
-        allocate_info.memoryTypeIndex = _vk_find_memory_type(
-            ctx.vk_physical_device,
-            mem_req.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
+    return (Vk_StreamAllocation){
+        .buffer = stream_buffer->buffer_bundle.buffer,
+        .offset = offset,
+        .data_ptr = (u8 *)stream_buffer->buffer_bundle.data_ptr + offset
+    };
+}
 
-        result = vkAllocateMemory(ctx.vk_device, &allocate_info, NULL, &texture_image_memory);
-        if (result != VK_SUCCESS) fatal("Failed to allocate memory for texture image");
+// Only call after the fence of the frame owning this stream buffer was waited on
+void _vk_stream_buffer_reset(Vk_StreamBuffer *stream_buffer)
+{
+    Vk_BufferBundle *retired;
+    list_iterate(&stream_buffer->retired_buffer_bundles, retired_i, retired)
+    {
+        _vk_destroy_buffer_bundle(retired);
     }
+    list_clear(&stream_buffer->retired_buffer_bundles);
 
-    result = vkBindImageMemory(ctx.vk_device, texture_image, texture_image_memory, 0);
-    if (result != VK_SUCCESS) fatal("Failed to bind memory to texture image");
-
-    VkCommandBuffer command_buffer;
-    {
-        VkCommandBufferAllocateInfo texture_command_buffer_allocate_info = {};
-        texture_command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        texture_command_buffer_allocate_info.commandPool = ctx.vk_command_pool;
-        texture_command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        texture_command_buffer_allocate_info.commandBufferCount = 1;
+    stream_buffer->offset = 0;
+}
 
-        result = vkAllocateCommandBuffers(ctx.vk_device, &texture_command_buffer_allocate_info, &command_buffer);
-        if (result != VK_SUCCESS) fatal("Failed to allocate command buffer for texture");
-    }
+// Not mapped; only the GPU writes to it
+Vk_BufferBundle _vk_create_device_buffer_bundle(VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    VkResult result;
 
-    // Record commands for copying texture from staging buffer to device-local image memory
+    VkBuffer buffer;
     {
-        {
-            VkCommandBufferBeginInfo begin_info = {};
-            begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            result = vkBeginCommandBuffer(command_buffer, &begin_info);
-            if (result != VK_SUCCESS) fatal("Failed to begin texture command buffer");
-        }
+        VkBufferCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        create_info.size = size;
+        create_info.usage = usage;
+        create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        {
-            VkImageMemoryBarrier barrier1 = {};
-            barrier1.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            barrier1.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            barrier1.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier1.srcAccessMask = 0;
-            barrier1.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier1.image = texture_image;
-            barrier1.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            barrier1.subresourceRange.baseMipLevel = 0;
-            barrier1.subresourceRange.levelCount = 1;
-            barrier1.subresourceRange.baseArrayLayer = 0;
-            barrier1.subresourceRange.layerCount = 1;
+        result = vkCreateBuffer(ctx.vk_device, &create_info, NULL, &buffer);
+        if (result != VK_SUCCESS) fatal("Failed to create device-local buffer");
+    }
 
-            vkCmdPipelineBarrier(
-                command_buffer,
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, NULL,
-                0, NULL,
-                1, &barrier1
-            );
-        }
+    Vk_Allocation allocation = _vk_memory_alloc_for_buffer(buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-        {
-            VkBufferImageCopy buffer_image_copy = {};
-            buffer_image_copy.bufferOffset = 0;
-            buffer_image_copy.bufferRowLength = 0;
-            buffer_image_copy.bufferImageHeight = 0;
-            buffer_image_copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            buffer_image_copy.imageSubresource.mipLevel = 0;
-            buffer_image_copy.imageSubresource.baseArrayLayer = 0;
-            buffer_image_copy.imageSubresource.layerCount = 1;
-            buffer_image_copy.imageOffset = (VkOffset3D){0, 0, 0};
-            buffer_image_copy.imageExtent = (VkExtent3D){w, h, 1};
-
-            vkCmdCopyBufferToImage(
-                command_buffer,
-                texture_staging_buffer.buffer,
-                texture_image,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                1,
-                &buffer_image_copy
-            );
-        }
+    return (Vk_BufferBundle){
+        .buffer = buffer,
+        .allocation = allocation,
+        .data_ptr = NULL,
+        .size = size
+    };
+}
 
-        {
-            VkImageMemoryBarrier barrier2 = {};
-            barrier2.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            barrier2.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier2.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier2.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            barrier2.image = texture_image;
-            barrier2.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            barrier2.subresourceRange.baseMipLevel = 0;
-            barrier2.subresourceRange.levelCount = 1;
-            barrier2.subresourceRange.baseArrayLayer = 0;
-            barrier2.subresourceRange.layerCount = 1;
+u32 _vk_get_mip_level_count(u32 w, u32 h)
+{
+    u32 largest = w > h ? w : h;
+    u32 mip_levels = 1;
+    while (largest > 1)
+    {
+        largest >>= 1;
+        mip_levels++;
+    }
+    return mip_levels;
+}
 
-            vkCmdPipelineBarrier(
-                command_buffer,
-                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                0,
-                0, NULL,
-                0, NULL,
-                1, &barrier2
-            );
-        }
+// Mips are generated with linear blits, which the format has to support
+bool _vk_can_generate_mips(VkFormat format)
+{
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(ctx.vk_physical_device, format, &format_properties);
+    VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (format_properties.optimalTilingFeatures & required) == required;
+}
 
-        result = vkEndCommandBuffer(command_buffer);
-        if (result != VK_SUCCESS) fatal("Failed to end texture command buffer");
-    }
+Vk_TextureBundle _vk_create_texture_bundle(u32 w, u32 h, VkFormat format, u32 mip_levels)
+{
+    VkResult result;
 
+    // Create image for the texture
+    VkImage texture_image;
     {
-        VkSubmitInfo submit_info = {};
-        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submit_info.commandBufferCount = 1;
-        submit_info.pCommandBuffers = &command_buffer;
+        VkImageCreateInfo texture_image_create_info = {};
+        texture_image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        texture_image_create_info.imageType = VK_IMAGE_TYPE_2D;
+        texture_image_create_info.format = format;
+        texture_image_create_info.extent = (VkExtent3D){ w, h, 1 };
+        texture_image_create_info.mipLevels = mip_levels;
+        texture_image_create_info.arrayLayers = 1;
+        texture_image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        texture_image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        texture_image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        if (mip_levels > 1) texture_image_create_info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        texture_image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        texture_image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-        result = vkQueueSubmit(ctx.vk_queue, 1, &submit_info, VK_NULL_HANDLE);
-        if (result != VK_SUCCESS) fatal("Failed to submit texture command buffer to queue");
+        result = vkCreateImage(ctx.vk_device, &texture_image_create_info, NULL, &texture_image);
+        if (result != VK_SUCCESS) fatal("Failed to create texture image");
     }
 
-    result = vkQueueWaitIdle(ctx.vk_queue);
-    if (result != VK_SUCCESS) fatal("Failed to wait idle for queue");
-
-    _vk_destroy_buffer_bundle(&texture_staging_buffer);
+    Vk_Allocation texture_image_allocation = _vk_memory_alloc_for_image(texture_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     VkImageView texture_image_view;
     {
@@ -1003,9 +1698,17 @@ Vk_TextureBundle _vk_load_texture_from_pixels(void *pixels, u32 w, u32 h, VkDevi
         texture_image_view_create_info.image = texture_image;
         texture_image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
         texture_image_view_create_info.format = format;
+        if (format == VK_FORMAT_R8_UNORM)
+        {
+            // Single channel textures read as white with the channel in alpha, the same as RGBA ones in ui.frag
+            texture_image_view_create_info.components.r = VK_COMPONENT_SWIZZLE_ONE;
+            texture_image_view_create_info.components.g = VK_COMPONENT_SWIZZLE_ONE;
+            texture_image_view_create_info.components.b = VK_COMPONENT_SWIZZLE_ONE;
+            texture_image_view_create_info.components.a = VK_COMPONENT_SWIZZLE_R;
+        }
         texture_image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         texture_image_view_create_info.subresourceRange.baseMipLevel = 0;
-        texture_image_view_create_info.subresourceRange.levelCount = 1;
+        texture_image_view_create_info.subresourceRange.levelCount = mip_levels;
         texture_image_view_create_info.subresourceRange.baseArrayLayer = 0;
         texture_image_view_create_info.subresourceRange.layerCount = 1;
 
@@ -1013,58 +1716,316 @@ Vk_TextureBundle _vk_load_texture_from_pixels(void *pixels, u32 w, u32 h, VkDevi
         if (result != VK_SUCCESS) fatal("Failed to create texture image view");
     }
 
-    VkSampler texture_sampler;
+    return (Vk_TextureBundle){
+        .image = texture_image,
+        .allocation = texture_image_allocation,
+        .image_view = texture_image_view,
+        .format = format,
+        .mip_levels = mip_levels
+    };
+}
+
+// Samplers are shared by every texture with the same flags; maxLod covers any mip count
+VkSampler _vk_get_sampler(u32 flags)
+{
+    const Vk_SamplerCacheEntry *entry;
+    list_iterate(&ctx.vk_sampler_cache, entry_i, entry)
+    {
+        if (entry->flags == flags) return entry->sampler;
+    }
+
+    VkFilter filter = (flags & E2R_TEXTURE_NEAREST) ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+    VkSamplerAddressMode address_mode = (flags & E2R_TEXTURE_CLAMP) ? VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE : VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+    VkSamplerCreateInfo sampler_create_info = {};
+    sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_create_info.magFilter = filter;
+    sampler_create_info.minFilter = filter;
+    sampler_create_info.addressModeU = address_mode;
+    sampler_create_info.addressModeV = address_mode;
+    sampler_create_info.addressModeW = address_mode;
+    sampler_create_info.anisotropyEnable = VK_FALSE;
+    sampler_create_info.maxAnisotropy = 1.0f;
+    sampler_create_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    sampler_create_info.unnormalizedCoordinates = VK_FALSE;
+    sampler_create_info.compareEnable = VK_FALSE;
+    sampler_create_info.mipmapMode = (flags & E2R_TEXTURE_NEAREST) ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_create_info.minLod = 0.0f;
+    sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
+    if ((flags & E2R_TEXTURE_MIPMAPS) && ctx.vk_max_sampler_anisotropy > 1.0f)
+    {
+        sampler_create_info.anisotropyEnable = VK_TRUE;
+        sampler_create_info.maxAnisotropy = ctx.vk_max_sampler_anisotropy;
+    }
+
+    VkSampler sampler;
+    VkResult result = vkCreateSampler(ctx.vk_device, &sampler_create_info, NULL, &sampler);
+    if (result != VK_SUCCESS) fatal("Failed to create texture sampler");
+
+    list_append(&ctx.vk_sampler_cache, ((Vk_SamplerCacheEntry){ .flags = flags, .sampler = sampler }));
+    return sampler;
+}
+
+Vk_TextureTable _vk_create_texture_table()
+{
+    VkResult result;
+
+    VkDescriptorSetLayout descriptor_set_layout;
+    {
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        binding.descriptorCount = MAX_BINDLESS_TEXTURES;
+        binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorBindingFlags binding_flags =
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_create_info = {};
+        binding_flags_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        binding_flags_create_info.bindingCount = 1;
+        binding_flags_create_info.pBindingFlags = &binding_flags;
+
+        VkDescriptorSetLayoutCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        create_info.pNext = &binding_flags_create_info;
+        create_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        create_info.bindingCount = 1;
+        create_info.pBindings = &binding;
+
+        result = vkCreateDescriptorSetLayout(ctx.vk_device, &create_info, NULL, &descriptor_set_layout);
+        if (result != VK_SUCCESS) fatal("Failed to create texture table descriptor set layout");
+    }
+
+    VkDescriptorPool descriptor_pool;
     {
-        VkSamplerCreateInfo texture_sampler_create_info = {};
-        texture_sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-        texture_sampler_create_info.magFilter = VK_FILTER_LINEAR;
-        texture_sampler_create_info.minFilter = VK_FILTER_LINEAR;
-        texture_sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        texture_sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        texture_sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        texture_sampler_create_info.anisotropyEnable = VK_FALSE;
-        texture_sampler_create_info.maxAnisotropy = 1.0f;
-        texture_sampler_create_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-        texture_sampler_create_info.unnormalizedCoordinates = VK_FALSE;
-        texture_sampler_create_info.compareEnable = VK_FALSE;
-        texture_sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        VkDescriptorPoolSize descriptor_pool_size = {};
+        descriptor_pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptor_pool_size.descriptorCount = MAX_BINDLESS_TEXTURES;
 
-        result = vkCreateSampler(ctx.vk_device, &texture_sampler_create_info, NULL, &texture_sampler);
-        if (result != VK_SUCCESS) fatal("Failed to create texture sampler");
+        VkDescriptorPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        create_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        create_info.poolSizeCount = 1;
+        create_info.pPoolSizes = &descriptor_pool_size;
+        create_info.maxSets = 1;
+
+        result = vkCreateDescriptorPool(ctx.vk_device, &create_info, NULL, &descriptor_pool);
+        if (result != VK_SUCCESS) fatal("Failed to create texture table descriptor pool");
     }
 
-    return (Vk_TextureBundle){
-        .image = texture_image,
-        .memory = texture_image_memory,
-        .image_view = texture_image_view,
-        .sampler = texture_sampler,
-        .format = format
+    VkDescriptorSet descriptor_set;
+    {
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorPool = descriptor_pool;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &descriptor_set_layout;
+
+        result = vkAllocateDescriptorSets(ctx.vk_device, &allocate_info, &descriptor_set);
+        if (result != VK_SUCCESS) fatal("Failed to allocate texture table descriptor set");
+    }
+
+    return (Vk_TextureTable){
+        .descriptor_set_layout = descriptor_set_layout,
+        .descriptor_pool = descriptor_pool,
+        .descriptor_set = descriptor_set
     };
 }
 
-Vk_TextureBundle _vk_load_texture(const char *path)
+void _vk_texture_table_write(E2R_TextureHandle texture)
+{
+    const Vk_TextureBundle *texture_bundle = &ctx.texture_list.data[texture];
+
+    VkDescriptorImageInfo descriptor_image_info = {};
+    descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    descriptor_image_info.imageView = texture_bundle->image_view;
+    descriptor_image_info.sampler = texture_bundle->sampler;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = ctx.vk_texture_table.descriptor_set;
+    write_descriptor_set.dstBinding = 0;
+    write_descriptor_set.dstArrayElement = texture;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.pImageInfo = &descriptor_image_info;
+
+    vkUpdateDescriptorSets(ctx.vk_device, 1, &write_descriptor_set, 0, NULL);
+}
+
+void _vk_cmd_mip_barrier(VkCommandBuffer command_buffer, VkImage image, u32 mip_level,
+    VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
 {
-    int tex_w, tex_h, tex_ch;
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc *pixels = stbi_load(path, &tex_w, &tex_h, &tex_ch, STBI_rgb_alpha);
-    VkDeviceSize image_size = tex_w * tex_h * 4; // 4 bytes per pixel
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = mip_level;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+        0,
+        0, NULL,
+        0, NULL,
+        1, &barrier
+    );
+}
 
-    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+// Expects level 0 written and every level in TRANSFER_DST_OPTIMAL. Each level is a linear blit of the one above it,
+// so it needs a graphics queue. Leaves all levels readable by fragment shaders.
+void _vk_cmd_generate_mips(VkCommandBuffer command_buffer, VkImage image, u32 w, u32 h, u32 mip_levels)
+{
+    i32 src_w = (i32)w;
+    i32 src_h = (i32)h;
+    for (u32 level = 1; level < mip_levels; level++)
+    {
+        i32 dst_w = src_w > 1 ? src_w / 2 : 1;
+        i32 dst_h = src_h > 1 ? src_h / 2 : 1;
+
+        _vk_cmd_mip_barrier(command_buffer, image, level - 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        VkImageBlit blit = {};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.srcOffsets[0] = (VkOffset3D){0, 0, 0};
+        blit.srcOffsets[1] = (VkOffset3D){src_w, src_h, 1};
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+        blit.dstOffsets[0] = (VkOffset3D){0, 0, 0};
+        blit.dstOffsets[1] = (VkOffset3D){dst_w, dst_h, 1};
+
+        vkCmdBlitImage(
+            command_buffer,
+            image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit,
+            VK_FILTER_LINEAR
+        );
 
-    Vk_TextureBundle texture_bundle = _vk_load_texture_from_pixels(pixels, tex_w, tex_h, image_size, format);
+        _vk_cmd_mip_barrier(command_buffer, image, level - 1,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
-    free(pixels);
+        src_w = dst_w;
+        src_h = dst_h;
+    }
 
-    return texture_bundle;
+    _vk_cmd_mip_barrier(command_buffer, image, mip_levels - 1,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 }
 
-Vk_TextureBundle _vk_load_texture_from_font_atlas(const FontAtlas *atlas)
+// Transitions the image, copies the staged pixels into level 0 and makes it readable by fragment shaders.
+// With a separate transfer queue the last barrier is the release half of an ownership transfer to the graphics family.
+// Mipmapped images are released still in TRANSFER_DST_OPTIMAL, since blits need the graphics family.
+void _vk_cmd_upload_texture(VkCommandBuffer command_buffer, VkImage image, const Vk_BufferBundle *staging_buffer, VkDeviceSize staging_offset, u32 w, u32 h, u32 mip_levels)
 {
-    VkDeviceSize image_size = atlas->width * atlas->height * atlas->channels;
-    bassert(atlas->channels == 4);
-    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-    Vk_TextureBundle texture_bundle = _vk_load_texture_from_pixels(atlas->pixels, atlas->width, atlas->height, image_size, format);
-    return texture_bundle;
+    {
+        VkImageMemoryBarrier barrier1 = {};
+        barrier1.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier1.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier1.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier1.srcAccessMask = 0;
+        barrier1.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier1.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier1.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier1.image = image;
+        barrier1.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier1.subresourceRange.baseMipLevel = 0;
+        barrier1.subresourceRange.levelCount = mip_levels;
+        barrier1.subresourceRange.baseArrayLayer = 0;
+        barrier1.subresourceRange.layerCount = 1;
+
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, NULL,
+            0, NULL,
+            1, &barrier1
+        );
+    }
+
+    {
+        VkBufferImageCopy buffer_image_copy = {};
+        buffer_image_copy.bufferOffset = staging_offset;
+        buffer_image_copy.bufferRowLength = 0;
+        buffer_image_copy.bufferImageHeight = 0;
+        buffer_image_copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        buffer_image_copy.imageSubresource.mipLevel = 0;
+        buffer_image_copy.imageSubresource.baseArrayLayer = 0;
+        buffer_image_copy.imageSubresource.layerCount = 1;
+        buffer_image_copy.imageOffset = (VkOffset3D){0, 0, 0};
+        buffer_image_copy.imageExtent = (VkExtent3D){w, h, 1};
+
+        vkCmdCopyBufferToImage(
+            command_buffer,
+            staging_buffer->buffer,
+            image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &buffer_image_copy
+        );
+    }
+
+    if (mip_levels > 1 && !_vk_has_transfer_queue())
+    {
+        _vk_cmd_generate_mips(command_buffer, image, w, h, mip_levels);
+        return;
+    }
+
+    {
+        VkImageMemoryBarrier barrier2 = {};
+        barrier2.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier2.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier2.newLayout = mip_levels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier2.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier2.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier2.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier2.image = image;
+        barrier2.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier2.subresourceRange.baseMipLevel = 0;
+        barrier2.subresourceRange.levelCount = mip_levels;
+        barrier2.subresourceRange.baseArrayLayer = 0;
+        barrier2.subresourceRange.layerCount = 1;
+
+        VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        if (_vk_has_transfer_queue())
+        {
+            barrier2.dstAccessMask = 0;
+            barrier2.srcQueueFamilyIndex = ctx.vk_transfer_queue_family_index;
+            barrier2.dstQueueFamilyIndex = ctx.vk_queue_family_index;
+            dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        }
+
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+            0,
+            0, NULL,
+            0, NULL,
+            1, &barrier2
+        );
+    }
 }
 
 Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
@@ -1072,11 +2033,7 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
     const char *vert_shader_path = "bin/shaders/ui.vert.spv";
     const char *frag_shader_path = "bin/shaders/ui.frag.spv";
 
-    Vk_PipelineBundle pipeline_bundle =
-    {
-        .max_vertex_count = MAX_VERTEX_COUNT,
-        .max_index_count = MAX_INDEX_COUNT
-    };
+    Vk_PipelineBundle pipeline_bundle = {};
 
     u32 frame_count = FRAMES_IN_FLIGHT;
 
@@ -1092,17 +2049,9 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
         descriptor_set_layout_binding_0.descriptorCount = 1;
         descriptor_set_layout_binding_0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
-        // Texture Sampler
-        VkDescriptorSetLayoutBinding descriptor_set_layout_binding_1 = {};
-        descriptor_set_layout_binding_1.binding = 1;
-        descriptor_set_layout_binding_1.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_set_layout_binding_1.descriptorCount = 2;
-        descriptor_set_layout_binding_1.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
         VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[] =
         {
-            descriptor_set_layout_binding_0,
-            descriptor_set_layout_binding_1
+            descriptor_set_layout_binding_0
         };
         VkDescriptorSetLayoutCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1115,35 +2064,24 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
 
     VkPipelineLayout pipeline_layout;
     {
+        VkDescriptorSetLayout set_layouts[] = { descriptor_set_layout, ctx.vk_texture_table.descriptor_set_layout };
         VkPipelineLayoutCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        create_info.setLayoutCount = 1;
-        create_info.pSetLayouts = &descriptor_set_layout;
+        create_info.setLayoutCount = array_count(set_layouts);
+        create_info.pSetLayouts = set_layouts;
 
         result = vkCreatePipelineLayout(ctx.vk_device, &create_info, NULL, &pipeline_layout);
         if (result != VK_SUCCESS) fatal("Failed to create pipeline layout");
     }
 
-    pipeline_bundle.vertex_buffer_bundle = _vk_create_buffer_bundle(
-        pipeline_bundle.max_vertex_count * sizeof(VertexUI),
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
-    );
-
-    pipeline_bundle.index_buffer_bundle = _vk_create_buffer_bundle(
-        pipeline_bundle.max_index_count * sizeof(VertIndex),
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-    );
-
     pipeline_bundle.descriptor_set_layout = descriptor_set_layout;
     pipeline_bundle.pipeline_layout = pipeline_layout;
 
     VkDescriptorPool descriptor_pool;
     {
-        VkDescriptorPoolSize descriptor_pool_sizes[2] = {};
+        VkDescriptorPoolSize descriptor_pool_sizes[1] = {};
         descriptor_pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         descriptor_pool_sizes[0].descriptorCount = frame_count * ubo_count;
-        descriptor_pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_pool_sizes[1].descriptorCount = 2;
 
         VkDescriptorPoolCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1189,28 +2127,6 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
 
             vkUpdateDescriptorSets(ctx.vk_device, 1, &write_descriptor_set, 0, NULL);
         }
-
-        // Update descriptor set: texture sampler
-        {
-            VkDescriptorImageInfo descriptor_image_infos[2] = {};
-            descriptor_image_infos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptor_image_infos[0].imageView = ctx.ui_atlas_texture.image_view;
-            descriptor_image_infos[0].sampler = ctx.ui_atlas_texture.sampler;
-            descriptor_image_infos[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptor_image_infos[1].imageView = ctx.font_atlas_texture.image_view;
-            descriptor_image_infos[1].sampler = ctx.font_atlas_texture.sampler;
-
-            VkWriteDescriptorSet write_descriptor_set = {};
-            write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_set.dstSet = descriptor_sets[i];
-            write_descriptor_set.dstBinding = 1;
-            write_descriptor_set.dstArrayElement = 0;
-            write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            write_descriptor_set.descriptorCount = array_count(descriptor_image_infos);
-            write_descriptor_set.pImageInfo = descriptor_image_infos;
-
-            vkUpdateDescriptorSets(ctx.vk_device, 1, &write_descriptor_set, 0, NULL);
-        }
     }
 
     pipeline_bundle.descriptor_pool = descriptor_pool;
@@ -1232,36 +2148,49 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
         shader_stages[1].module = frag_shader_module;
         shader_stages[1].pName = "main";
 
+        // Per-quad instances, expanded to corners in the vertex shader
         VkVertexInputBindingDescription vertex_input_binding_description = {};
         vertex_input_binding_description.binding = 0;
-        vertex_input_binding_description.stride = sizeof(VertexUI);
-        vertex_input_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        vertex_input_binding_description.stride = sizeof(InstanceUI);
+        vertex_input_binding_description.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-        int vert_attrib_count = 4;
+        int vert_attrib_count = 6;
         VkVertexInputAttributeDescription *vertex_input_attribute_descriptions = xmalloc(vert_attrib_count * sizeof(vertex_input_attribute_descriptions[0]));
         vertex_input_attribute_descriptions[0] = (VkVertexInputAttributeDescription){
             .location = 0,
             .binding = 0,
-            .format = VK_FORMAT_R32G32B32_SFLOAT,
-            .offset = offsetof(VertexUI, pos)
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(InstanceUI, pos_min)
         };
         vertex_input_attribute_descriptions[1] = (VkVertexInputAttributeDescription){
             .location = 1,
             .binding = 0,
             .format = VK_FORMAT_R32G32_SFLOAT,
-            .offset = offsetof(VertexUI, uv)
+            .offset = offsetof(InstanceUI, pos_max)
         };
         vertex_input_attribute_descriptions[2] = (VkVertexInputAttributeDescription){
             .location = 2,
             .binding = 0,
-            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-            .offset = offsetof(VertexUI, color)
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(InstanceUI, uv_min)
         };
         vertex_input_attribute_descriptions[3] = (VkVertexInputAttributeDescription){
             .location = 3,
             .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(InstanceUI, uv_max)
+        };
+        vertex_input_attribute_descriptions[4] = (VkVertexInputAttributeDescription){
+            .location = 4,
+            .binding = 0,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .offset = offsetof(InstanceUI, color)
+        };
+        vertex_input_attribute_descriptions[5] = (VkVertexInputAttributeDescription){
+            .location = 5,
+            .binding = 0,
             .format = VK_FORMAT_R32_UINT,
-            .offset = offsetof(VertexUI, tex_index)
+            .offset = offsetof(InstanceUI, tex_index)
         };
 
         VkPipelineVertexInputStateCreateInfo vertex_input_state = {};
@@ -1275,14 +2204,17 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
         input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
         input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-        VkViewport viewport = {0, 0, (float)ctx.vk_swapchain_bundle.extent.width, (float)ctx.vk_swapchain_bundle.extent.height, 0.0f, 1.0f};
-        VkRect2D scissor = {{0, 0}, {ctx.vk_swapchain_bundle.extent.width, ctx.vk_swapchain_bundle.extent.height}};
+        // Viewport and scissor are dynamic so the pipeline survives swapchain rebuilds
         VkPipelineViewportStateCreateInfo viewport_state = {};
         viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_state.viewportCount = 1;
-        viewport_state.pViewports = &viewport;
         viewport_state.scissorCount = 1;
-        viewport_state.pScissors = &scissor;
+
+        VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamic_state = {};
+        dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic_state.dynamicStateCount = array_count(dynamic_states);
+        dynamic_state.pDynamicStates = dynamic_states;
 
         VkPipelineRasterizationStateCreateInfo rasterization_state = {};
         rasterization_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -1317,14 +2249,15 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_ui()
         create_info.pVertexInputState = &vertex_input_state;
         create_info.pInputAssemblyState = &input_assembly_state;
         create_info.pViewportState = &viewport_state;
+        create_info.pDynamicState = &dynamic_state;
         create_info.pRasterizationState = &rasterization_state;
         create_info.pMultisampleState = &multisample_state;
         create_info.pColorBlendState = &color_blend_state;
         create_info.layout = pipeline_layout;
-        create_info.renderPass = ctx.vk_2d_render_pass_bundle.render_pass;
-        create_info.subpass = 0;
+        create_info.renderPass = ctx.vk_render_pass_bundle.render_pass;
+        create_info.subpass = 1;
         
-        result = vkCreateGraphicsPipelines(ctx.vk_device, VK_NULL_HANDLE, 1, &create_info, NULL, &pipeline);
+        result = vkCreateGraphicsPipelines(ctx.vk_device, ctx.vk_pipeline_cache, 1, &create_info, NULL, &pipeline);
         if (result != VK_SUCCESS) fatal("Failed to create graphics pipeline");
 
         free(vertex_input_attribute_descriptions);
@@ -1343,11 +2276,7 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
     const char *vert_shader_path = "bin/shaders/cubes.vert.spv";
     const char *frag_shader_path = "bin/shaders/cubes.frag.spv";
 
-    Vk_PipelineBundle pipeline_bundle =
-    {
-        .max_vertex_count = MAX_VERTEX_COUNT,
-        .max_index_count = MAX_INDEX_COUNT
-    };
+    Vk_PipelineBundle pipeline_bundle = {};
 
     u32 frame_count = FRAMES_IN_FLIGHT;
 
@@ -1363,13 +2292,6 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
         descriptor_set_layout_binding_0.descriptorCount = 1;
         descriptor_set_layout_binding_0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
-        // Texture Sampler
-        VkDescriptorSetLayoutBinding descriptor_set_layout_binding_1 = {};
-        descriptor_set_layout_binding_1.binding = 1;
-        descriptor_set_layout_binding_1.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_set_layout_binding_1.descriptorCount = 1;
-        descriptor_set_layout_binding_1.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
         // Lighting
         VkDescriptorSetLayoutBinding descriptor_set_layout_binding_2 = {};
         descriptor_set_layout_binding_2.binding = 2;
@@ -1380,7 +2302,6 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
         VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[] =
         {
             descriptor_set_layout_binding_0,
-            descriptor_set_layout_binding_1,
             descriptor_set_layout_binding_2
         };
         VkDescriptorSetLayoutCreateInfo create_info = {};
@@ -1394,42 +2315,24 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
 
     VkPipelineLayout pipeline_layout;
     {
-        VkPushConstantRange model_push_constant = {};
-        model_push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-        model_push_constant.offset = 0;
-        model_push_constant.size = sizeof(m4);
-
+        VkDescriptorSetLayout set_layouts[] = { descriptor_set_layout, ctx.vk_texture_table.descriptor_set_layout };
         VkPipelineLayoutCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        create_info.setLayoutCount = 1;
-        create_info.pSetLayouts = &descriptor_set_layout;
-        create_info.pushConstantRangeCount = 1;
-        create_info.pPushConstantRanges = &model_push_constant;
+        create_info.setLayoutCount = array_count(set_layouts);
+        create_info.pSetLayouts = set_layouts;
 
         result = vkCreatePipelineLayout(ctx.vk_device, &create_info, NULL, &pipeline_layout);
         if (result != VK_SUCCESS) fatal("Failed to create pipeline layout");
     }
 
-    pipeline_bundle.vertex_buffer_bundle = _vk_create_buffer_bundle(
-        pipeline_bundle.max_vertex_count * sizeof(Vertex3D),
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
-    );
-
-    pipeline_bundle.index_buffer_bundle = _vk_create_buffer_bundle(
-        pipeline_bundle.max_index_count * sizeof(VertIndex),
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-    );
-
     pipeline_bundle.descriptor_set_layout = descriptor_set_layout;
     pipeline_bundle.pipeline_layout = pipeline_layout;
 
     VkDescriptorPool descriptor_pool;
     {
-        VkDescriptorPoolSize descriptor_pool_sizes[2] = {};
+        VkDescriptorPoolSize descriptor_pool_sizes[1] = {};
         descriptor_pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         descriptor_pool_sizes[0].descriptorCount = frame_count * ubo_count;
-        descriptor_pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_pool_sizes[1].descriptorCount = 1;
 
         VkDescriptorPoolCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1476,25 +2379,6 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
             vkUpdateDescriptorSets(ctx.vk_device, 1, &write_descriptor_set, 0, NULL);
         }
 
-        // Update descriptor set: texture sampler
-        {
-            VkDescriptorImageInfo descriptor_image_info = {};
-            descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptor_image_info.imageView = ctx.ducks_texture.image_view;
-            descriptor_image_info.sampler = ctx.ducks_texture.sampler;
-
-            VkWriteDescriptorSet write_descriptor_set = {};
-            write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_set.dstSet = descriptor_sets[i];
-            write_descriptor_set.dstBinding = 1;
-            write_descriptor_set.dstArrayElement = 0;
-            write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            write_descriptor_set.descriptorCount = 1;
-            write_descriptor_set.pImageInfo = &descriptor_image_info;
-
-            vkUpdateDescriptorSets(ctx.vk_device, 1, &write_descriptor_set, 0, NULL);
-        }
-
         // Update descriptor set: Lighting UBO
         {
             const Vk_BufferBundle *buffer_bundle = &ctx.ubo_lighting.buffer_bundles[i];
@@ -1535,12 +2419,15 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
         shader_stages[1].module = frag_shader_module;
         shader_stages[1].pName = "main";
 
-        VkVertexInputBindingDescription vertex_input_binding_description = {};
-        vertex_input_binding_description.binding = 0;
-        vertex_input_binding_description.stride = sizeof(Vertex3D);
-        vertex_input_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        VkVertexInputBindingDescription vertex_input_binding_descriptions[2] = {};
+        vertex_input_binding_descriptions[0].binding = 0;
+        vertex_input_binding_descriptions[0].stride = sizeof(Vertex3D);
+        vertex_input_binding_descriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        vertex_input_binding_descriptions[1].binding = 1;
+        vertex_input_binding_descriptions[1].stride = sizeof(Instance3D);
+        vertex_input_binding_descriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-        int vert_attrib_count = 4;
+        int vert_attrib_count = 13;
         VkVertexInputAttributeDescription *vertex_input_attribute_descriptions = xmalloc(vert_attrib_count * sizeof(vertex_input_attribute_descriptions[0]));
         vertex_input_attribute_descriptions[0] = (VkVertexInputAttributeDescription){
             .location = 0,
@@ -1566,11 +2453,43 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
             .format = VK_FORMAT_R32G32B32A32_SFLOAT,
             .offset = offsetof(Vertex3D, color)
         };
+        // Instance model matrix, one location per column
+        for (u32 i = 0; i < 4; i++)
+        {
+            vertex_input_attribute_descriptions[4 + i] = (VkVertexInputAttributeDescription){
+                .location = 4 + i,
+                .binding = 1,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(Instance3D, model) + i * sizeof(v4)
+            };
+        }
+        vertex_input_attribute_descriptions[8] = (VkVertexInputAttributeDescription){
+            .location = 8,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(Instance3D, color)
+        };
+        // Instance normal matrix, one location per column
+        for (u32 i = 0; i < 3; i++)
+        {
+            vertex_input_attribute_descriptions[9 + i] = (VkVertexInputAttributeDescription){
+                .location = 9 + i,
+                .binding = 1,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(Instance3D, normal_matrix) + i * 3 * sizeof(f32)
+            };
+        }
+        vertex_input_attribute_descriptions[12] = (VkVertexInputAttributeDescription){
+            .location = 12,
+            .binding = 1,
+            .format = VK_FORMAT_R32_UINT,
+            .offset = offsetof(Instance3D, texture_index)
+        };
 
         VkPipelineVertexInputStateCreateInfo vertex_input_state = {};
         vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertex_input_state.vertexBindingDescriptionCount = 1;
-        vertex_input_state.pVertexBindingDescriptions = &vertex_input_binding_description;
+        vertex_input_state.vertexBindingDescriptionCount = array_count(vertex_input_binding_descriptions);
+        vertex_input_state.pVertexBindingDescriptions = vertex_input_binding_descriptions;
         vertex_input_state.vertexAttributeDescriptionCount = vert_attrib_count;
         vertex_input_state.pVertexAttributeDescriptions = vertex_input_attribute_descriptions;
 
@@ -1578,14 +2497,17 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
         input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
         input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-        VkViewport viewport = {0, 0, (float)ctx.vk_swapchain_bundle.extent.width, (float)ctx.vk_swapchain_bundle.extent.height, 0.0f, 1.0f};
-        VkRect2D scissor = {{0, 0}, {ctx.vk_swapchain_bundle.extent.width, ctx.vk_swapchain_bundle.extent.height}};
+        // Viewport and scissor are dynamic so the pipeline survives swapchain rebuilds
         VkPipelineViewportStateCreateInfo viewport_state = {};
         viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_state.viewportCount = 1;
-        viewport_state.pViewports = &viewport;
         viewport_state.scissorCount = 1;
-        viewport_state.pScissors = &scissor;
+
+        VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamic_state = {};
+        dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic_state.dynamicStateCount = array_count(dynamic_states);
+        dynamic_state.pDynamicStates = dynamic_states;
 
         VkPipelineRasterizationStateCreateInfo rasterization_state = {};
         rasterization_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -1625,15 +2547,16 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
         create_info.pVertexInputState = &vertex_input_state;
         create_info.pInputAssemblyState = &input_assembly_state;
         create_info.pViewportState = &viewport_state;
+        create_info.pDynamicState = &dynamic_state;
         create_info.pRasterizationState = &rasterization_state;
         create_info.pMultisampleState = &multisample_state;
         create_info.pColorBlendState = &color_blend_state;
         create_info.pDepthStencilState = &depth_stencil_state;
         create_info.layout = pipeline_layout;
-        create_info.renderPass = ctx.vk_3d_render_pass_bundle.render_pass;
+        create_info.renderPass = ctx.vk_render_pass_bundle.render_pass;
         create_info.subpass = 0;
         
-        result = vkCreateGraphicsPipelines(ctx.vk_device, VK_NULL_HANDLE, 1, &create_info, NULL, &pipeline);
+        result = vkCreateGraphicsPipelines(ctx.vk_device, ctx.vk_pipeline_cache, 1, &create_info, NULL, &pipeline);
         if (result != VK_SUCCESS) fatal("Failed to create graphics pipeline");
 
         free(vertex_input_attribute_descriptions);
@@ -1647,45 +2570,163 @@ Vk_PipelineBundle _vk_create_pipeline_bundle_cubes()
     return pipeline_bundle;
 }
 
-// --------------------------------
-
-void _vk_destroy_swapchain_bundle(Vk_SwapchainBundle *bundle)
+Vk_PipelineBundle _vk_create_pipeline_bundle_cull()
 {
-    free(bundle->images);
-    for (u32 i = 0; i < bundle->image_count; i++)
+    const char *comp_shader_path = "bin/shaders/cull.comp.spv";
+
+    Vk_PipelineBundle pipeline_bundle = {};
+
+    u32 frame_count = FRAMES_IN_FLIGHT;
+
+    VkResult result;
+
+    // Input instances, draw commands, output instances
+    const u32 storage_buffer_count = 3;
+    VkDescriptorSetLayout descriptor_set_layout;
     {
-        vkDestroySemaphore(ctx.vk_device, bundle->submit_semaphores[i], NULL);
-        vkDestroyImageView(ctx.vk_device, bundle->image_views[i], NULL);
+        VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[3] = {};
+        for (u32 i = 0; i < storage_buffer_count; i++)
+        {
+            descriptor_set_layout_bindings[i].binding = i;
+            descriptor_set_layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptor_set_layout_bindings[i].descriptorCount = 1;
+            descriptor_set_layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        create_info.bindingCount = array_count(descriptor_set_layout_bindings);
+        create_info.pBindings = descriptor_set_layout_bindings;
+
+        result = vkCreateDescriptorSetLayout(ctx.vk_device, &create_info, NULL, &descriptor_set_layout);
+        if (result != VK_SUCCESS) fatal("Failed to create descriptor set layout");
     }
-    free(bundle->submit_semaphores);
-    free(bundle->image_views);
-    vkDestroySwapchainKHR(ctx.vk_device, bundle->swapchain, NULL);
-    *bundle = (Vk_SwapchainBundle){};
-}
 
-void _vk_destroy_depth_image_bundle(Vk_DepthImageBundle *bundle)
-{
+    VkPipelineLayout pipeline_layout;
+    {
+        VkPushConstantRange push_constant_range = {};
+        push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_constant_range.offset = 0;
+        push_constant_range.size = sizeof(CullPushConstants);
+
+        VkPipelineLayoutCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        create_info.setLayoutCount = 1;
+        create_info.pSetLayouts = &descriptor_set_layout;
+        create_info.pushConstantRangeCount = 1;
+        create_info.pPushConstantRanges = &push_constant_range;
+
+        result = vkCreatePipelineLayout(ctx.vk_device, &create_info, NULL, &pipeline_layout);
+        if (result != VK_SUCCESS) fatal("Failed to create pipeline layout");
+    }
+
+    pipeline_bundle.descriptor_set_layout = descriptor_set_layout;
+    pipeline_bundle.pipeline_layout = pipeline_layout;
+
+    VkDescriptorPool descriptor_pool;
+    {
+        VkDescriptorPoolSize descriptor_pool_size = {};
+        descriptor_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptor_pool_size.descriptorCount = frame_count * storage_buffer_count;
+
+        VkDescriptorPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        create_info.poolSizeCount = 1;
+        create_info.pPoolSizes = &descriptor_pool_size;
+        create_info.maxSets = frame_count;
+
+        result = vkCreateDescriptorPool(ctx.vk_device, &create_info, NULL, &descriptor_pool);
+        if (result != VK_SUCCESS) fatal("Failed to create descriptor pool");
+    }
+
+    // Written every frame in _e2r_update_cull_descriptor_set, as the buffers move with the stream buffer
+    VkDescriptorSet *descriptor_sets = xmalloc(frame_count * sizeof(descriptor_sets[0]));
+    for (u32 i = 0; i < frame_count; i++)
+    {
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorPool = descriptor_pool;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &descriptor_set_layout;
+
+        result = vkAllocateDescriptorSets(ctx.vk_device, &allocate_info, &descriptor_sets[i]);
+        if (result != VK_SUCCESS) fatal("Failed to allocate descriptor set");
+    }
+
+    pipeline_bundle.descriptor_pool = descriptor_pool;
+    pipeline_bundle.descriptor_sets = descriptor_sets;
+    pipeline_bundle.descriptor_set_count = frame_count;
+
+    VkPipeline pipeline;
+    {
+        VkShaderModule comp_shader_module = _vk_create_shader_module(comp_shader_path);
+
+        VkPipelineShaderStageCreateInfo shader_stage = {};
+        shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        shader_stage.module = comp_shader_module;
+        shader_stage.pName = "main";
+
+        VkComputePipelineCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        create_info.stage = shader_stage;
+        create_info.layout = pipeline_layout;
+
+        result = vkCreateComputePipelines(ctx.vk_device, ctx.vk_pipeline_cache, 1, &create_info, NULL, &pipeline);
+        if (result != VK_SUCCESS) fatal("Failed to create compute pipeline");
+
+        vkDestroyShaderModule(ctx.vk_device, comp_shader_module, NULL);
+    }
+
+    pipeline_bundle.pipeline = pipeline;
+
+    return pipeline_bundle;
+}
+
+// --------------------------------
+
+void _vk_destroy_swapchain_bundle(Vk_SwapchainBundle *bundle)
+{
+    free(bundle->images);
+    for (u32 i = 0; i < bundle->image_count; i++)
+    {
+        vkDestroySemaphore(ctx.vk_device, bundle->submit_semaphores[i], NULL);
+        vkDestroyImageView(ctx.vk_device, bundle->image_views[i], NULL);
+    }
+    free(bundle->submit_semaphores);
+    free(bundle->image_views);
+    vkDestroySwapchainKHR(ctx.vk_device, bundle->swapchain, NULL);
+    *bundle = (Vk_SwapchainBundle){};
+}
+
+void _vk_destroy_depth_image_bundle(Vk_DepthImageBundle *bundle)
+{
     for (u32 i = 0; i < bundle->image_count; i++)
     {
         vkDestroyImage(ctx.vk_device, bundle->images[i], NULL);
-        vkFreeMemory(ctx.vk_device, bundle->memory_list[i], NULL);
+        _vk_memory_free(&bundle->allocations[i]);
         vkDestroyImageView(ctx.vk_device, bundle->image_views[i], NULL);
     }
     free(bundle->images);
-    free(bundle->memory_list);
+    free(bundle->allocations);
     free(bundle->image_views);
     *bundle = (Vk_DepthImageBundle){};
 }
 
 void _vk_destroy_render_pass_bundle(Vk_RenderPassBundle *bundle)
+{
+    vkDestroyRenderPass(ctx.vk_device, bundle->render_pass, NULL);
+    *bundle = (Vk_RenderPassBundle){};
+}
+
+void _vk_destroy_framebuffer_bundle(Vk_FramebufferBundle *bundle)
 {
     for (u32 i = 0; i < bundle->framebuffer_count; i++)
     {
         vkDestroyFramebuffer(ctx.vk_device, bundle->framebuffers[i], NULL);
     }
     free(bundle->framebuffers);
-    vkDestroyRenderPass(ctx.vk_device, bundle->render_pass, NULL);
-    *bundle = (Vk_RenderPassBundle){};
+    *bundle = (Vk_FramebufferBundle){};
 }
 
 void _vk_destroy_command_pool(VkCommandPool *command_pool)
@@ -1694,6 +2735,21 @@ void _vk_destroy_command_pool(VkCommandPool *command_pool)
     *command_pool = VK_NULL_HANDLE;
 }
 
+void _vk_destroy_recording_bundle(Vk_RecordingBundle *recording_bundle)
+{
+    for (u32 frame_i = 0; frame_i < FRAMES_IN_FLIGHT; frame_i++)
+    {
+        for (u32 slot_i = 0; slot_i < recording_bundle->slot_count; slot_i++)
+        {
+            vkDestroyCommandPool(ctx.vk_device, recording_bundle->command_pools[frame_i][slot_i], NULL);
+        }
+        free(recording_bundle->command_pools[frame_i]);
+        free(recording_bundle->command_buffers[frame_i]);
+    }
+
+    *recording_bundle = (Vk_RecordingBundle){};
+}
+
 void _vk_destroy_frame_list(Vk_FrameList *list)
 {
     for (u32 i = 0; i < list->count; i++)
@@ -1709,9 +2765,8 @@ void _vk_destroy_frame_list(Vk_FrameList *list)
 
 void _vk_destroy_buffer_bundle(Vk_BufferBundle *bundle)
 {
-    vkUnmapMemory(ctx.vk_device, bundle->memory);
-    vkFreeMemory(ctx.vk_device, bundle->memory, NULL);
     vkDestroyBuffer(ctx.vk_device, bundle->buffer, NULL);
+    _vk_memory_free(&bundle->allocation);
     *bundle = (Vk_BufferBundle){};
 }
 
@@ -1728,20 +2783,12 @@ void _vk_destroy_buffer_bundle_list(Vk_BufferBundleList *list)
 void _vk_destroy_texture_bundle(Vk_TextureBundle *bundle)
 {
     vkDestroyImage(ctx.vk_device, bundle->image, NULL);
-    vkFreeMemory(ctx.vk_device, bundle->memory, NULL);
+    _vk_memory_free(&bundle->allocation);
     vkDestroyImageView(ctx.vk_device, bundle->image_view, NULL);
-    vkDestroySampler(ctx.vk_device, bundle->sampler, NULL);
 }
 
 void _vk_destroy_pipeline_bundle(Vk_PipelineBundle *bundle)
 {
-    _vk_destroy_buffer_bundle(&bundle->vertex_buffer_bundle);
-
-    if (bundle->index_buffer_bundle.buffer != VK_NULL_HANDLE)
-    {
-        _vk_destroy_buffer_bundle(&bundle->index_buffer_bundle);
-    }
-
     free(bundle->descriptor_sets);
 
     vkDestroyDescriptorPool(ctx.vk_device, bundle->descriptor_pool, NULL);
@@ -1754,37 +2801,90 @@ void _vk_destroy_pipeline_bundle(Vk_PipelineBundle *bundle)
     *bundle = (Vk_PipelineBundle){};
 }
 
+void _vk_destroy_stream_buffer(Vk_StreamBuffer *stream_buffer)
+{
+    _vk_stream_buffer_reset(stream_buffer);
+    list_free(&stream_buffer->retired_buffer_bundles);
+    _vk_destroy_buffer_bundle(&stream_buffer->buffer_bundle);
+    *stream_buffer = (Vk_StreamBuffer){};
+}
+
+void _vk_destroy_mesh_bundle(Vk_MeshBundle *bundle)
+{
+    _vk_destroy_buffer_bundle(&bundle->vertex_buffer_bundle);
+    _vk_destroy_buffer_bundle(&bundle->index_buffer_bundle);
+    *bundle = (Vk_MeshBundle){};
+}
+
 // -------------------------------
 
-void _vk_create_swapchain_dependent()
+void _vk_create_swapchain_dependent(VkSwapchainKHR old_swapchain)
 {
-    ctx.vk_swapchain_bundle = _vk_create_swapchain_bundle();
+    ctx.vk_swapchain_bundle = _vk_create_swapchain_bundle(old_swapchain);
     ctx.vk_depth_image_bundle = _vk_create_depth_image_bundle();
-    ctx.vk_clear_render_pass_bundle = _vk_create_render_pass_bundle(NULL, true, false);
-    ctx.vk_2d_render_pass_bundle = _vk_create_render_pass_bundle(NULL, false, false);
-    ctx.vk_3d_render_pass_bundle = _vk_create_render_pass_bundle(&ctx.vk_depth_image_bundle, false, false);
-    ctx.vk_final_render_pass_bundle = _vk_create_render_pass_bundle(NULL, false, true);
-
-    ctx.vk_ui_pipeline_bundle = _vk_create_pipeline_bundle_ui();
-    ctx.vk_cubes_pipeline_bundle = _vk_create_pipeline_bundle_cubes();
+    ctx.vk_framebuffer_bundle = _vk_create_framebuffer_bundle(&ctx.vk_render_pass_bundle, &ctx.vk_depth_image_bundle);
 
     ctx.first_swapchain_use = true;
 }
 
 void _vk_destroy_swapchain_dependent()
 {
-    vkDeviceWaitIdle(ctx.vk_device);
+    _vk_destroy_framebuffer_bundle(&ctx.vk_framebuffer_bundle);
+    _vk_destroy_depth_image_bundle(&ctx.vk_depth_image_bundle);
+    _vk_destroy_swapchain_bundle(&ctx.vk_swapchain_bundle);
+}
 
-    _vk_destroy_pipeline_bundle(&ctx.vk_ui_pipeline_bundle);
-    _vk_destroy_pipeline_bundle(&ctx.vk_cubes_pipeline_bundle);
+void _vk_destroy_retired_swapchain(Vk_RetiredSwapchain *retired)
+{
+    _vk_destroy_framebuffer_bundle(&retired->framebuffer_bundle);
+    _vk_destroy_depth_image_bundle(&retired->depth_image_bundle);
+    _vk_destroy_swapchain_bundle(&retired->swapchain_bundle);
+}
+
+// Frames in flight may still render to the old images, so they are retired instead of waiting for the device to idle
+void _vk_rebuild_swapchain_dependent()
+{
+    Vk_RetiredSwapchain retired =
+    {
+        .swapchain_bundle = ctx.vk_swapchain_bundle,
+        .depth_image_bundle = ctx.vk_depth_image_bundle,
+        .framebuffer_bundle = ctx.vk_framebuffer_bundle,
+        .retire_serial = ctx.submit_serial
+    };
+    list_append(&ctx.retired_swapchains, retired);
 
-    _vk_destroy_render_pass_bundle(&ctx.vk_clear_render_pass_bundle);
-    _vk_destroy_render_pass_bundle(&ctx.vk_2d_render_pass_bundle);
-    _vk_destroy_render_pass_bundle(&ctx.vk_3d_render_pass_bundle);
-    _vk_destroy_render_pass_bundle(&ctx.vk_final_render_pass_bundle);
+    _vk_create_swapchain_dependent(retired.swapchain_bundle.swapchain);
+}
 
-    _vk_destroy_depth_image_bundle(&ctx.vk_depth_image_bundle);
-    _vk_destroy_swapchain_bundle(&ctx.vk_swapchain_bundle);
+// True once every submit up to the serial has had its own fence waited on; counting waits is not enough, a skipped frame waits on the same fence twice
+bool _vk_is_serial_complete(u64 serial)
+{
+    for (u32 i = 0; i < ctx.vk_frame_list.count; i++)
+    {
+        const Vk_Frame *frame = &ctx.vk_frame_list.frames[i];
+        // A frame that submitted after the serial was waited on before that, so its earlier submits are done
+        if (frame->submitted_serial <= serial && frame->completed_serial != frame->submitted_serial) return false;
+    }
+    return true;
+}
+
+// Called after each fence wait
+void _vk_free_retired_swapchains()
+{
+    size_t kept_count = 0;
+    for (size_t i = 0; i < ctx.retired_swapchains.size; i++)
+    {
+        Vk_RetiredSwapchain *retired = &ctx.retired_swapchains.data[i];
+        if (_vk_is_serial_complete(retired->retire_serial))
+        {
+            _vk_destroy_retired_swapchain(retired);
+        }
+        else
+        {
+            ctx.retired_swapchains.data[kept_count++] = *retired;
+        }
+    }
+    ctx.retired_swapchains.size = kept_count;
 }
 
 // --------------------------------
@@ -1826,175 +2926,982 @@ static void _ui_get_atlas_q_verts(v2i cell_p, v2 out_verts[4])
     //     trace("atlas_vert[%d]: %f, %f", i, out_verts[i].x, out_verts[i].y);
 }
 
-static void _text_get_font_atlas_verts(char ch, f32 *pen_x, f32 *pen_y, const FontAtlas *font_atlas, v2 out_screen_verts[4], v2 out_tex_verts[4])
+// --------------------------------
+
+typedef struct _E2R_ImageLoad
 {
-    f32 x = *pen_x;
-    f32 y = *pen_y + font_loader_get_ascender(font_atlas);
+    const char *path;
+    stbi_uc *pixels;
+    int w, h;
+    f64 load_time;
+
+} _E2R_ImageLoad;
+
+typedef struct _E2R_StartupLoads
+{
+    _E2R_ImageLoad images[2];
 
-    GlyphQuad q = font_loader_get_glyph_quad(font_atlas, ch, x, y);
+} _E2R_StartupLoads;
 
-    out_screen_verts[0] = V2(q.screen_min_x, q.screen_max_y);
-    out_screen_verts[1] = V2(q.screen_max_x, q.screen_max_y);
-    out_screen_verts[2] = V2(q.screen_max_x, q.screen_min_y);
-    out_screen_verts[3] = V2(q.screen_min_x, q.screen_min_y);
+// Runs on the job workers while the main thread sets up Vulkan; one index per image
+void _e2r_startup_load_job(void *user_data, u32 start, u32 end)
+{
+    _E2R_StartupLoads *loads = user_data;
 
-    // TexCoords in reverse order to flip the quad
-    out_tex_verts[0] = V2(q.tex_min_x, q.tex_max_y);
-    out_tex_verts[1] = V2(q.tex_max_x, q.tex_max_y);
-    out_tex_verts[2] = V2(q.tex_max_x, q.tex_min_y);
-    out_tex_verts[3] = V2(q.tex_min_x, q.tex_min_y);
+    for (u32 i = start; i < end; i++)
+    {
+        f64 start_time = glfwGetTime();
+        _E2R_ImageLoad *image = &loads->images[i];
+        int channels;
+        image->pixels = stbi_load(image->path, &image->w, &image->h, &channels, STBI_rgb_alpha);
+        if (!image->pixels) fatal("Failed to load %s", image->path);
+        image->load_time = glfwGetTime() - start_time;
+    }
+}
 
-    *pen_x += font_loader_get_advance_x(font_atlas, ch);
+void _e2r_trace_startup_stage(const char *stage, f64 *stage_start_time)
+{
+    f64 now = glfwGetTime();
+    trace("Startup: %s %.2f ms", stage, (now - *stage_start_time) * 1000.0);
+    *stage_start_time = now;
 }
 
-// --------------------------------
+void e2r_init(int width, int height, const char *name)
+{
+    e2r_jobs_init(0);
+
+    ctx.glfw_window = _glfw_create_window(width, height, name);
+    f64 startup_start_time = glfwGetTime();
+    f64 stage_start_time = startup_start_time;
+
+    // Decoding overlaps with device creation
+    _E2R_StartupLoads loads =
+    {
+        .images =
+        {
+            { .path = "res/DUCKS.png" },
+            { .path = "res/ui_atlas.png" },
+        }
+    };
+    stbi_set_flip_vertically_on_load(true); // global in stb_image, so set before the workers start
+    e2r_jobs_begin_parallel_for(array_count(loads.images), 1, _e2r_startup_load_job, &loads);
+
+    ctx.vk_instance = _vk_create_instance();
+    ctx.vk_surface = _vk_create_surface();
+    ctx.vk_physical_device = _vk_find_physical_device();
+    ctx.vk_queue_family_index = _vk_get_queue_family_index();
+    ctx.vk_transfer_queue_family_index = _vk_get_transfer_queue_family_index();
+    ctx.vk_device = _vk_create_device();
+    ctx.vk_queue = _vk_get_queue(ctx.vk_queue_family_index);
+    ctx.vk_transfer_queue = _vk_get_queue(ctx.vk_transfer_queue_family_index);
+    trace("Uploads use queue family %u%s", ctx.vk_transfer_queue_family_index, _vk_has_transfer_queue() ? "" : " (shared with graphics)");
+
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(ctx.vk_physical_device, &properties);
+        ctx.vk_storage_buffer_alignment = properties.limits.minStorageBufferOffsetAlignment;
+        if (ctx.vk_storage_buffer_alignment < STREAM_ALLOCATION_ALIGNMENT) ctx.vk_storage_buffer_alignment = STREAM_ALLOCATION_ALIGNMENT;
+        ctx.vk_timestamp_period_ns = properties.limits.timestampPeriod;
+
+        VkPhysicalDeviceFeatures features;
+        vkGetPhysicalDeviceFeatures(ctx.vk_physical_device, &features);
+        ctx.vk_max_sampler_anisotropy = 0.0f;
+        if (features.samplerAnisotropy)
+        {
+            ctx.vk_max_sampler_anisotropy = properties.limits.maxSamplerAnisotropy;
+            if (ctx.vk_max_sampler_anisotropy > MAX_SAMPLER_ANISOTROPY) ctx.vk_max_sampler_anisotropy = MAX_SAMPLER_ANISOTROPY;
+        }
+    }
+    _e2r_trace_startup_stage("instance and device", &stage_start_time);
+
+    ctx.vk_timestamp_query_pool = _vk_create_timestamp_query_pool();
+
+    ctx.vk_pipeline_cache = _vk_create_pipeline_cache();
+
+    ctx.vk_memory_allocator = _vk_create_memory_allocator();
+
+    ctx.vk_command_pool = _vk_create_command_pool(ctx.vk_queue_family_index);
+    ctx.vk_transfer_command_pool = _vk_create_command_pool(ctx.vk_transfer_queue_family_index);
+
+    ctx.vk_frame_list = _vk_create_frame_list();
+
+    ctx.vk_texture_table = _vk_create_texture_table();
+
+    // One 3D slice per thread plus the UI
+    ctx.vk_recording_bundle = _vk_create_recording_bundle(e2r_jobs_get_worker_count() + 2);
+
+    ctx.global_ubo_2d = _vk_create_buffer_bundle_list(sizeof(UBOLayoutGlobal2D), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    ctx.global_ubo_3d = _vk_create_buffer_bundle_list(sizeof(UBOLayoutGlobal3D), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+    ctx.ubo_lighting = _vk_create_buffer_bundle_list(sizeof(UBOLayoutLighting), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        ctx.stream_buffers[i] = _vk_create_stream_buffer(INITIAL_STREAM_BUFFER_SIZE);
+        ctx.culled_instance_buffers[i] = _vk_create_device_buffer_bundle(
+            INITIAL_CULLED_INSTANCE_CAPACITY * sizeof(Instance3D),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    }
+
+    glfwSetCharCallback(ctx.glfw_window, _glfw_callback_char);
+
+    ctx.vk_render_pass_bundle = _vk_create_render_pass_bundle(_vk_get_surface_format().format, DEPTH_FORMAT);
+    _vk_create_swapchain_dependent(VK_NULL_HANDLE);
+    _e2r_trace_startup_stage("device objects and swapchain", &stage_start_time);
+
+    ctx.vk_cull_pipeline_bundle = _vk_create_pipeline_bundle_cull();
+    ctx.vk_cubes_pipeline_bundle = _vk_create_pipeline_bundle_cubes();
+    ctx.vk_ui_pipeline_bundle = _vk_create_pipeline_bundle_ui();
+    _e2r_trace_startup_stage("pipelines", &stage_start_time);
+
+    e2r_jobs_wait();
+    _e2r_trace_startup_stage("waiting for asset loads", &stage_start_time);
+    for (u32 i = 0; i < array_count(loads.images); i++)
+    {
+        trace("Startup: decoding %s %.2f ms (worker)", loads.images[i].path, loads.images[i].load_time * 1000.0);
+    }
+
+    // Glyphs are rasterized as they're first drawn, so the atlas starts out blank
+    e2r_font_init(GLYPH_ATLAS_SIZE);
+    ctx.default_font = e2r_font_create(DEFAULT_FONT_PATH, DEFAULT_FONT_SIZE, 0);
+    u8 *blank_glyph_atlas = xcalloc((size_t)GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE);
+
+    const u32 white_pixel = 0xFFFFFFFF;
+    e2r_upload_begin();
+    ctx.white_texture = e2r_texture_create(&white_pixel, 1, 1, 0);
+    ctx.ducks_texture = e2r_texture_create(loads.images[0].pixels, loads.images[0].w, loads.images[0].h, E2R_TEXTURE_MIPMAPS);
+    ctx.ui_atlas_texture = e2r_texture_create(loads.images[1].pixels, loads.images[1].w, loads.images[1].h, 0);
+    ctx.font_atlas_texture = _e2r_texture_create_with_format(blank_glyph_atlas, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, VK_FORMAT_R8_UNORM, 1, 0);
+    e2r_upload_flush();
+    e2r_upload_wait(); // the fallback has to be resident, and the atlases shouldn't show it on the first frame
+    for (u32 i = 0; i < array_count(loads.images); i++)
+    {
+        free(loads.images[i].pixels);
+    }
+    free(blank_glyph_atlas);
+    _e2r_trace_startup_stage("texture uploads", &stage_start_time);
+
+    trace("Startup took %.2f ms", (glfwGetTime() - startup_start_time) * 1000.0);
+}
+
+E2R_FontHandle e2r_get_default_font()
+{
+    return ctx.default_font;
+}
+
+E2R_TextureHandle e2r_get_default_texture()
+{
+    return ctx.ducks_texture;
+}
+
+E2R_TextureHandle e2r_get_ui_atlas_texture()
+{
+    return ctx.ui_atlas_texture;
+}
+
+E2R_TextureHandle e2r_get_font_atlas_texture()
+{
+    return ctx.font_atlas_texture;
+}
+
+GLFWwindow *e2r_get_glfw_window_TEMP()
+{
+    return ctx.glfw_window;
+}
+
+void e2r_destroy()
+{
+    vkDeviceWaitIdle(ctx.vk_device);
+
+    e2r_upload_wait();
+    list_free(&ctx.upload_batch.staging_buffers);
+    list_free(&ctx.upload_batch.releases);
+    list_free(&ctx.upload_batch.meshes);
+    list_free(&ctx.upload_batch.textures);
+    list_free(&ctx.pending_acquires);
+    vkDestroyFence(ctx.vk_device, ctx.upload_batch.fence, NULL);
+
+    Vk_TextureBundle *texture_bundle;
+    list_iterate(&ctx.texture_list, texture_i, texture_bundle)
+    {
+        _vk_destroy_texture_bundle(texture_bundle);
+    }
+    list_free(&ctx.texture_list);
+
+    const Vk_SamplerCacheEntry *sampler_entry;
+    list_iterate(&ctx.vk_sampler_cache, sampler_entry_i, sampler_entry)
+    {
+        vkDestroySampler(ctx.vk_device, sampler_entry->sampler, NULL);
+    }
+    list_free(&ctx.vk_sampler_cache);
+
+    vkDestroyDescriptorPool(ctx.vk_device, ctx.vk_texture_table.descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(ctx.vk_device, ctx.vk_texture_table.descriptor_set_layout, NULL);
+
+    _vk_destroy_buffer_bundle_list(&ctx.global_ubo_2d);
+    _vk_destroy_buffer_bundle_list(&ctx.global_ubo_3d);
+    _vk_destroy_buffer_bundle_list(&ctx.ubo_lighting);
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        _vk_destroy_stream_buffer(&ctx.stream_buffers[i]);
+        _vk_destroy_buffer_bundle(&ctx.culled_instance_buffers[i]);
+    }
+
+    _vk_destroy_pipeline_bundle(&ctx.vk_cull_pipeline_bundle);
+    _vk_destroy_pipeline_bundle(&ctx.vk_ui_pipeline_bundle);
+    _vk_destroy_pipeline_bundle(&ctx.vk_cubes_pipeline_bundle);
+
+    _vk_save_pipeline_cache();
+    vkDestroyPipelineCache(ctx.vk_device, ctx.vk_pipeline_cache, NULL);
+
+    Vk_MeshBundle *mesh_bundle;
+    list_iterate(&ctx.mesh_list, mesh_i, mesh_bundle)
+    {
+        _vk_destroy_mesh_bundle(mesh_bundle);
+    }
+    list_free(&ctx.mesh_list);
+    list_free(&ctx.mesh_draw_list);
+
+    Vk_RetiredSwapchain *retired;
+    list_iterate(&ctx.retired_swapchains, retired_i, retired)
+    {
+        _vk_destroy_retired_swapchain(retired);
+    }
+    list_free(&ctx.retired_swapchains);
+
+    _vk_destroy_swapchain_dependent();
+
+    _vk_destroy_render_pass_bundle(&ctx.vk_render_pass_bundle);
+ 
+    _vk_destroy_frame_list(&ctx.vk_frame_list);
+
+    _vk_destroy_recording_bundle(&ctx.vk_recording_bundle);
+
+    _vk_destroy_command_pool(&ctx.vk_command_pool);
+    _vk_destroy_command_pool(&ctx.vk_transfer_command_pool);
+
+    if (ctx.vk_timestamp_query_pool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(ctx.vk_device, ctx.vk_timestamp_query_pool, NULL);
+    }
+
+    _vk_destroy_memory_allocator(&ctx.vk_memory_allocator);
+
+    vkDestroyDevice(ctx.vk_device, NULL);
+    vkDestroySurfaceKHR(ctx.vk_instance, ctx.vk_surface, NULL);
+    vkDestroyInstance(ctx.vk_instance, NULL);
+    glfwDestroyWindow(ctx.glfw_window);
+    glfwTerminate();
+
+    e2r_cull_free_scratch();
+    e2r_font_destroy();
+    list_free(&ctx.glyph_atlas_regions);
+    e2r_jobs_destroy();
+
+    ctx = (E2R_Ctx){};
+}
+
+bool e2r_is_running()
+{
+    return !glfwWindowShouldClose(ctx.glfw_window);
+}
+
+// Called after the current frame's fence was waited on, so its timestamps are final
+void _e2r_update_frame_timings()
+{
+    E2R_FrameTimings *timings = &ctx.frame_timings;
+
+    f64 now = glfwGetTime();
+    if (ctx.last_frame_start_time > 0.0)
+    {
+        timings->cpu_frame_ms = (f32)((now - ctx.last_frame_start_time) * 1000.0);
+        timings->avg_cpu_frame_ms += (timings->cpu_frame_ms - timings->avg_cpu_frame_ms) * FRAME_TIMING_SMOOTHING;
+    }
+    ctx.last_frame_start_time = now;
+
+    if (ctx.vk_timestamp_query_pool != VK_NULL_HANDLE && ctx.timestamps_pending[ctx.current_vk_frame])
+    {
+        u64 timestamps[TIMESTAMPS_PER_FRAME];
+        VkResult result = vkGetQueryPoolResults(
+            ctx.vk_device, ctx.vk_timestamp_query_pool,
+            ctx.current_vk_frame * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME,
+            sizeof(timestamps), timestamps, sizeof(timestamps[0]),
+            VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS)
+        {
+            timings->gpu_frame_ms = (f32)((timestamps[1] - timestamps[0]) * ctx.vk_timestamp_period_ns / 1e6);
+            timings->avg_gpu_frame_ms += (timings->gpu_frame_ms - timings->avg_gpu_frame_ms) * FRAME_TIMING_SMOOTHING;
+        }
+        ctx.timestamps_pending[ctx.current_vk_frame] = false;
+    }
+}
+
+void e2r_start_frame()
+{
+    if (ctx.rebuild_swapchain)
+    {
+        f64 rebuild_start_time = glfwGetTime();
+        _vk_rebuild_swapchain_dependent();
+        ctx.rebuild_swapchain = false;
+        trace("Swapchain rebuild took %.2f ms", (glfwGetTime() - rebuild_start_time) * 1000.0);
+    }
+
+    Vk_Frame *frame = &ctx.vk_frame_list.frames[ctx.current_vk_frame];
+
+    // Reset right before submitting, so a frame skipped on an out of date swapchain leaves it signaled
+    vkWaitForFences(ctx.vk_device, 1, &frame->in_flight_fence, true, UINT64_MAX);
+    frame->completed_serial = frame->submitted_serial;
+
+    _vk_free_retired_swapchains();
+
+    e2r_upload_is_complete(); // frees the staging memory of a finished batch
+
+    _vk_stream_buffer_reset(&ctx.stream_buffers[ctx.current_vk_frame]);
+
+    _e2r_update_frame_timings();
+
+    glfwPollEvents();
+
+    e2r_update_state(ctx.glfw_window);
+}
+
+f32 e2r_get_dt()
+{
+    const f32 dt = 1 / 120.0f;
+    return dt;
+}
+
+void e2r_set_view_data(m4 view, v3 view_pos)
+{
+    ctx.view_transform = view;
+    ctx.view_pos = view_pos;
+}
+
+void e2r_set_light_data(
+    f32 ambient_strength,
+    v3 color,
+    f32 specular_strength,
+    v3 pos,
+    f32 shininess)
+{
+    ctx.light_ambient_strength = ambient_strength;
+    ctx.light_color = color;
+    ctx.light_specular_strength = specular_strength;
+    ctx.light_pos = pos;
+    ctx.light_shininess = shininess;
+}
+
+u64 e2r_get_current_frame()
+{
+    return ctx.current_app_frame;
+}
+
+E2R_MemoryStats e2r_get_memory_stats()
+{
+    const Vk_MemoryAllocator *allocator = &ctx.vk_memory_allocator;
+    return (E2R_MemoryStats){
+        .block_count = allocator->blocks.size,
+        .dedicated_allocation_count = allocator->dedicated_allocation_count,
+        .allocation_count = allocator->allocation_count,
+        .bytes_reserved = allocator->bytes_reserved,
+        .bytes_used = allocator->bytes_used
+    };
+}
+
+void e2r_set_culling_mode(E2R_CullingMode mode)
+{
+    ctx.culling_mode = mode;
+}
+
+E2R_CullingMode e2r_get_culling_mode()
+{
+    return ctx.culling_mode;
+}
+
+void e2r_set_recording_mode(E2R_RecordingMode mode)
+{
+    ctx.recording_mode = mode;
+}
+
+E2R_RecordingMode e2r_get_recording_mode()
+{
+    return ctx.recording_mode;
+}
+
+E2R_CullStats e2r_get_cull_stats()
+{
+    return ctx.cull_stats;
+}
+
+E2R_FrameTimings e2r_get_frame_timings()
+{
+    return ctx.frame_timings;
+}
+
+void _vk_upload_batch_reclaim(Vk_UploadBatch *batch)
+{
+    VkResult result = vkResetFences(ctx.vk_device, 1, &batch->fence);
+    if (result != VK_SUCCESS) fatal("Failed to reset upload fence");
+
+    Vk_BufferBundle *staging_buffer;
+    list_iterate(&batch->staging_buffers, staging_buffer_i, staging_buffer)
+    {
+        _vk_destroy_buffer_bundle(staging_buffer);
+    }
+    list_clear(&batch->staging_buffers);
+    batch->staging_offset = 0;
+
+    // The fence wait orders the releases before the acquires recorded in the next frame
+    Vk_OwnershipTransfer *release;
+    list_iterate(&batch->releases, release_i, release)
+    {
+        list_append(&ctx.pending_acquires, *release);
+    }
+    list_clear(&batch->releases);
+
+    E2R_MeshHandle *mesh;
+    list_iterate(&batch->meshes, mesh_i, mesh)
+    {
+        ctx.mesh_list.data[*mesh].is_resident = true;
+    }
+    list_clear(&batch->meshes);
+
+    // Nothing references these slots yet, since e2r_texture_get_shader_index hands out the fallback until now
+    E2R_TextureHandle *texture;
+    list_iterate(&batch->textures, texture_i, texture)
+    {
+        _vk_texture_table_write(*texture);
+        ctx.texture_list.data[*texture].is_resident = true;
+    }
+    list_clear(&batch->textures);
+
+    batch->is_in_flight = false;
+}
+
+// Acquire half of the ownership transfers released by completed upload batches
+void _vk_cmd_acquire_uploads(VkCommandBuffer command_buffer)
+{
+    if (ctx.pending_acquires.size == 0) return;
+
+    VkImageMemoryBarrier *image_barriers = xcalloc(ctx.pending_acquires.size * sizeof(image_barriers[0]));
+    VkBufferMemoryBarrier *buffer_barriers = xcalloc(ctx.pending_acquires.size * sizeof(buffer_barriers[0]));
+    u32 image_barrier_count = 0;
+    u32 buffer_barrier_count = 0;
+
+    const Vk_OwnershipTransfer *acquire;
+    list_iterate(&ctx.pending_acquires, acquire_i, acquire)
+    {
+        if (acquire->image != VK_NULL_HANDLE)
+        {
+            bool has_mips = acquire->mip_levels > 1;
+            VkImageMemoryBarrier *barrier = &image_barriers[image_barrier_count++];
+            barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier->oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier->newLayout = has_mips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier->srcAccessMask = 0;
+            barrier->dstAccessMask = has_mips ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+            barrier->srcQueueFamilyIndex = ctx.vk_transfer_queue_family_index;
+            barrier->dstQueueFamilyIndex = ctx.vk_queue_family_index;
+            barrier->image = acquire->image;
+            barrier->subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier->subresourceRange.baseMipLevel = 0;
+            barrier->subresourceRange.levelCount = acquire->mip_levels;
+            barrier->subresourceRange.baseArrayLayer = 0;
+            barrier->subresourceRange.layerCount = 1;
+        }
+        else
+        {
+            VkBufferMemoryBarrier *barrier = &buffer_barriers[buffer_barrier_count++];
+            barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier->srcAccessMask = 0;
+            barrier->dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+            barrier->srcQueueFamilyIndex = ctx.vk_transfer_queue_family_index;
+            barrier->dstQueueFamilyIndex = ctx.vk_queue_family_index;
+            barrier->buffer = acquire->buffer;
+            barrier->offset = 0;
+            barrier->size = VK_WHOLE_SIZE;
+        }
+    }
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, NULL,
+        buffer_barrier_count, buffer_barriers,
+        image_barrier_count, image_barriers
+    );
+
+    list_iterate(&ctx.pending_acquires, acquire_i, acquire)
+    {
+        if (acquire->image != VK_NULL_HANDLE && acquire->mip_levels > 1)
+        {
+            _vk_cmd_generate_mips(command_buffer, acquire->image, acquire->w, acquire->h, acquire->mip_levels);
+        }
+    }
+
+    free(image_barriers);
+    free(buffer_barriers);
+    list_clear(&ctx.pending_acquires);
+}
+
+// Copies the glyphs rasterized since the last rendered frame into the atlas, before this frame's draws sample it.
+// Runs on the graphics queue; the first barrier also waits for earlier frames still reading evicted glyphs.
+void _vk_cmd_update_glyph_atlas(VkCommandBuffer command_buffer)
+{
+    E2R_GlyphAtlasUpdates atlas_updates = e2r_font_get_atlas_updates();
+    if (atlas_updates.update_count == 0) return;
+
+    Vk_StreamAllocation staging = _vk_stream_buffer_alloc(&ctx.stream_buffers[ctx.current_vk_frame], atlas_updates.pixel_size, STREAM_ALLOCATION_ALIGNMENT);
+    memcpy(staging.data_ptr, atlas_updates.pixels, atlas_updates.pixel_size);
+
+    Vk_BufferImageCopyList *regions = &ctx.glyph_atlas_regions;
+    list_clear(regions);
+    for (u32 i = 0; i < atlas_updates.update_count; i++)
+    {
+        const E2R_GlyphAtlasUpdate *update = &atlas_updates.updates[i];
+        VkBufferImageCopy region = {};
+        region.bufferOffset = staging.offset + update->pixel_offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = (VkOffset3D){ (i32)update->x, (i32)update->y, 0 };
+        region.imageExtent = (VkExtent3D){ update->w, update->h, 1 };
+        list_append(regions, region);
+    }
+
+    VkImage image = ctx.texture_list.data[ctx.font_atlas_texture].image;
+
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, NULL,
+            0, NULL,
+            1, &barrier
+        );
+    }
+
+    vkCmdCopyBufferToImage(
+        command_buffer,
+        staging.buffer,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        (u32)regions->size,
+        regions->data
+    );
+
+    _vk_cmd_mip_barrier(command_buffer, image, 0,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    e2r_font_clear_atlas_updates();
+}
+
+// Returns a staging buffer and offset with room for size bytes, starting a new chunk if the last one is full
+Vk_StreamAllocation _vk_upload_batch_alloc(Vk_UploadBatch *batch, VkDeviceSize size)
+{
+    VkDeviceSize offset = (batch->staging_offset + UPLOAD_STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(UPLOAD_STAGING_ALIGNMENT - 1);
+
+    if (batch->staging_buffers.size == 0 || offset + size > batch->staging_buffers.data[batch->staging_buffers.size - 1].size)
+    {
+        VkDeviceSize chunk_size = size > UPLOAD_STAGING_CHUNK_SIZE ? size : UPLOAD_STAGING_CHUNK_SIZE;
+        list_append(&batch->staging_buffers, _vk_create_buffer_bundle(chunk_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+        offset = 0;
+    }
+
+    const Vk_BufferBundle *staging_buffer = &batch->staging_buffers.data[batch->staging_buffers.size - 1];
+    batch->staging_offset = offset + size;
+
+    return (Vk_StreamAllocation){
+        .buffer = staging_buffer->buffer,
+        .offset = offset,
+        .data_ptr = (u8 *)staging_buffer->data_ptr + offset
+    };
+}
+
+// Device-local buffer filled through the current upload batch
+Vk_BufferBundle _e2r_upload_buffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+    assert(batch->is_recording);
+
+    Vk_BufferBundle buffer_bundle = _vk_create_device_buffer_bundle(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+    Vk_StreamAllocation staging = _vk_upload_batch_alloc(batch, size);
+    memcpy(staging.data_ptr, data, (size_t)size);
+
+    VkBufferCopy buffer_copy = {};
+    buffer_copy.srcOffset = staging.offset;
+    buffer_copy.dstOffset = 0;
+    buffer_copy.size = size;
+    vkCmdCopyBuffer(batch->command_buffer, staging.buffer, buffer_bundle.buffer, 1, &buffer_copy);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer_bundle.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    if (_vk_has_transfer_queue())
+    {
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = ctx.vk_transfer_queue_family_index;
+        barrier.dstQueueFamilyIndex = ctx.vk_queue_family_index;
+        dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        list_append(&batch->releases, ((Vk_OwnershipTransfer){ .buffer = buffer_bundle.buffer }));
+    }
+
+    vkCmdPipelineBarrier(
+        batch->command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+        0,
+        0, NULL,
+        1, &barrier,
+        0, NULL
+    );
+
+    return buffer_bundle;
+}
+
+E2R_TextureHandle _e2r_texture_create_with_format(const void *pixels, u32 w, u32 h, VkFormat format, u32 bytes_per_pixel, u32 flags)
+{
+    if (ctx.texture_list.size >= MAX_BINDLESS_TEXTURES) fatal("Texture table is full (%d textures)", MAX_BINDLESS_TEXTURES);
+
+    // Outside of a batch the texture gets one of its own and is ready on return
+    bool own_batch = !ctx.upload_batch.is_recording;
+    if (own_batch) e2r_upload_begin();
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+
+    u32 mip_levels = 1;
+    if (flags & E2R_TEXTURE_MIPMAPS)
+    {
+        if (_vk_can_generate_mips(format)) mip_levels = _vk_get_mip_level_count(w, h);
+        else warning("Texture format %d doesn't support linear blits, uploading without mips", format);
+    }
+
+    VkDeviceSize size = (VkDeviceSize)w * h * bytes_per_pixel;
+    Vk_StreamAllocation staging = _vk_upload_batch_alloc(batch, size);
+    memcpy(staging.data_ptr, pixels, (size_t)size);
+
+    Vk_TextureBundle texture_bundle = _vk_create_texture_bundle(w, h, format, mip_levels);
+    texture_bundle.sampler = _vk_get_sampler(flags);
+    const Vk_BufferBundle *staging_buffer = &batch->staging_buffers.data[batch->staging_buffers.size - 1];
+    _vk_cmd_upload_texture(batch->command_buffer, texture_bundle.image, staging_buffer, staging.offset, w, h, mip_levels);
+    if (_vk_has_transfer_queue())
+    {
+        list_append(&batch->releases, ((Vk_OwnershipTransfer){ .image = texture_bundle.image, .w = w, .h = h, .mip_levels = mip_levels }));
+    }
+
+    list_append(&ctx.texture_list, texture_bundle);
+    E2R_TextureHandle texture = (E2R_TextureHandle)(ctx.texture_list.size - 1);
+    list_append(&batch->textures, texture);
+
+    if (own_batch)
+    {
+        e2r_upload_flush();
+        e2r_upload_wait();
+    }
+
+    return texture;
+}
 
-void e2r_init(int width, int height, const char *name)
+void e2r_upload_begin()
 {
-    ctx.glfw_window = _glfw_create_window(width, height, name);
-    ctx.vk_instance = _vk_create_instance();
-    ctx.vk_surface = _vk_create_surface();
-    ctx.vk_physical_device = _vk_find_physical_device();
-    ctx.vk_queue_family_index = _vk_get_queue_family_index();
-    ctx.vk_device = _vk_create_device();
-    ctx.vk_queue = _vk_get_queue();
-
-    ctx.vk_command_pool = _vk_create_command_pool();
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+    assert(!batch->is_recording);
 
-    ctx.vk_frame_list = _vk_create_frame_list();
+    // The command buffer and staging memory are reused, so the previous batch has to finish first
+    e2r_upload_wait();
 
-    ctx.global_ubo_2d = _vk_create_buffer_bundle_list(sizeof(UBOLayoutGlobal2D), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-    ctx.global_ubo_3d = _vk_create_buffer_bundle_list(sizeof(UBOLayoutGlobal3D), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    VkResult result;
+    if (batch->command_buffer == VK_NULL_HANDLE)
+    {
+        VkCommandBufferAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandPool = ctx.vk_transfer_command_pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocate_info.commandBufferCount = 1;
 
-    ctx.ubo_lighting = _vk_create_buffer_bundle_list(sizeof(UBOLayoutLighting), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        result = vkAllocateCommandBuffers(ctx.vk_device, &allocate_info, &batch->command_buffer);
+        if (result != VK_SUCCESS) fatal("Failed to allocate upload command buffer");
 
-    ctx.ducks_texture = _vk_load_texture("res/DUCKS.png");
-    ctx.ui_atlas_texture = _vk_load_texture("res/ui_atlas.png");
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-    ctx.font_atlas = font_loader_create_atlas("res/DMMono-Regular.ttf", 512, 512, 18.0f, 2.0f, 4);
-    ctx.font_atlas_texture = _vk_load_texture_from_font_atlas(&ctx.font_atlas);
+        result = vkCreateFence(ctx.vk_device, &fence_create_info, NULL, &batch->fence);
+        if (result != VK_SUCCESS) fatal("Failed to create upload fence");
+    }
 
-    glfwSetCharCallback(ctx.glfw_window, _glfw_callback_char);
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+    if (result != VK_SUCCESS) fatal("Failed to begin upload command buffer");
 
-    _vk_create_swapchain_dependent();
+    batch->is_recording = true;
 }
 
-const FontAtlas *e2r_get_font_atlas_TEMP()
+E2R_TextureHandle e2r_texture_create(const void *pixels, u32 w, u32 h, u32 flags)
 {
-    return &ctx.font_atlas;
+    return _e2r_texture_create_with_format(pixels, w, h, VK_FORMAT_R8G8B8A8_UNORM, 4, flags);
 }
 
-GLFWwindow *e2r_get_glfw_window_TEMP()
+bool e2r_texture_is_ready(E2R_TextureHandle texture)
 {
-    return ctx.glfw_window;
+    return ctx.texture_list.data[texture].is_resident;
 }
 
-void e2r_destroy()
+u32 e2r_texture_get_shader_index(E2R_TextureHandle texture)
 {
-    vkDeviceWaitIdle(ctx.vk_device);
+    return ctx.texture_list.data[texture].is_resident ? texture : ctx.white_texture;
+}
 
-    _vk_destroy_texture_bundle(&ctx.ducks_texture);
-    _vk_destroy_texture_bundle(&ctx.ui_atlas_texture);
-    _vk_destroy_texture_bundle(&ctx.font_atlas_texture);
+void e2r_upload_flush()
+{
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+    assert(batch->is_recording);
 
-    _vk_destroy_buffer_bundle_list(&ctx.global_ubo_2d);
-    _vk_destroy_buffer_bundle_list(&ctx.global_ubo_3d);
-    _vk_destroy_buffer_bundle_list(&ctx.ubo_lighting);
+    VkResult result = vkEndCommandBuffer(batch->command_buffer);
+    if (result != VK_SUCCESS) fatal("Failed to end upload command buffer");
 
-    _vk_destroy_swapchain_dependent();
- 
-    _vk_destroy_frame_list(&ctx.vk_frame_list);
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch->command_buffer;
 
-    _vk_destroy_command_pool(&ctx.vk_command_pool);
+    result = vkQueueSubmit(ctx.vk_transfer_queue, 1, &submit_info, batch->fence);
+    if (result != VK_SUCCESS) fatal("Failed to submit upload command buffer");
 
-    vkDestroyDevice(ctx.vk_device, NULL);
-    vkDestroySurfaceKHR(ctx.vk_instance, ctx.vk_surface, NULL);
-    vkDestroyInstance(ctx.vk_instance, NULL);
-    glfwDestroyWindow(ctx.glfw_window);
-    glfwTerminate();
-    ctx = (E2R_Ctx){};
+    batch->is_recording = false;
+    batch->is_in_flight = true;
 }
 
-bool e2r_is_running()
+bool e2r_upload_is_complete()
 {
-    return !glfwWindowShouldClose(ctx.glfw_window);
-}
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+    if (!batch->is_in_flight) return true;
 
-void e2r_start_frame()
-{
-    if (ctx.rebuild_swapchain)
-    {
-        _vk_destroy_swapchain_dependent();
-        _vk_create_swapchain_dependent();
-        _vk_frame_list_reset_sync_objects(&ctx.vk_frame_list);
-        ctx.rebuild_swapchain = false;
-        ctx.current_vk_frame = 0;
-    }
+    VkResult result = vkGetFenceStatus(ctx.vk_device, batch->fence);
+    if (result == VK_NOT_READY) return false;
+    if (result != VK_SUCCESS) fatal("Failed to get upload fence status");
 
-    const Vk_Frame *frame = &ctx.vk_frame_list.frames[ctx.current_vk_frame];
+    _vk_upload_batch_reclaim(batch);
+    return true;
+}
 
-    vkWaitForFences(ctx.vk_device, 1, &frame->in_flight_fence, true, UINT64_MAX);
-    vkResetFences(ctx.vk_device, 1, &frame->in_flight_fence);
+void e2r_upload_wait()
+{
+    Vk_UploadBatch *batch = &ctx.upload_batch;
+    if (!batch->is_in_flight) return;
 
-    glfwPollEvents();
+    VkResult result = vkWaitForFences(ctx.vk_device, 1, &batch->fence, true, UINT64_MAX);
+    if (result != VK_SUCCESS) fatal("Failed to wait for upload fence");
 
-    e2r_update_state(ctx.glfw_window);
+    _vk_upload_batch_reclaim(batch);
 }
 
-f32 e2r_get_dt()
+E2R_MeshHandle e2r_mesh_create(const Vertex3D *verts, u32 vert_count, const VertIndex *indices, u32 index_count)
 {
-    const f32 dt = 1 / 120.0f;
-    return dt;
-}
+    // Bounding sphere around the AABB center, for culling
+    v3 min = verts[0].pos;
+    v3 max = verts[0].pos;
+    for (u32 i = 1; i < vert_count; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (verts[i].pos.d[axis] < min.d[axis]) min.d[axis] = verts[i].pos.d[axis];
+            if (verts[i].pos.d[axis] > max.d[axis]) max.d[axis] = verts[i].pos.d[axis];
+        }
+    }
+    v3 center = v3_scale(v3_add(min, max), 0.5f);
+    f32 radius_sq = 0.0f;
+    for (u32 i = 0; i < vert_count; i++)
+    {
+        v3 to_vert = v3_sub(verts[i].pos, center);
+        f32 dist_sq = v3_dot(to_vert, to_vert);
+        if (dist_sq > radius_sq) radius_sq = dist_sq;
+    }
 
-void e2r_set_view_data(m4 view, v3 view_pos)
-{
-    ctx.view_transform = view;
-    ctx.view_pos = view_pos;
-}
+    // Outside of a batch the mesh gets one of its own and is resident on return
+    bool own_batch = !ctx.upload_batch.is_recording;
+    if (own_batch) e2r_upload_begin();
 
-void e2r_set_light_data(
-    f32 ambient_strength,
-    v3 color,
-    f32 specular_strength,
-    v3 pos,
-    f32 shininess)
-{
-    ctx.light_ambient_strength = ambient_strength;
-    ctx.light_color = color;
-    ctx.light_specular_strength = specular_strength;
-    ctx.light_pos = pos;
-    ctx.light_shininess = shininess;
-}
+    Vk_MeshBundle mesh_bundle =
+    {
+        .vertex_buffer_bundle = _e2r_upload_buffer(verts, vert_count * sizeof(verts[0]), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT),
+        .index_buffer_bundle = _e2r_upload_buffer(indices, index_count * sizeof(indices[0]), VK_BUFFER_USAGE_INDEX_BUFFER_BIT),
+        .index_count = index_count,
+        .bounding_sphere = V4(center.x, center.y, center.z, sqrtf(radius_sq))
+    };
 
-u64 e2r_get_current_frame()
-{
-    return ctx.current_app_frame;
+    list_append(&ctx.mesh_list, mesh_bundle);
+    E2R_MeshHandle mesh = (E2R_MeshHandle)(ctx.mesh_list.size - 1);
+    list_append(&ctx.upload_batch.meshes, mesh);
+
+    if (own_batch)
+    {
+        e2r_upload_flush();
+        e2r_upload_wait();
+    }
+
+    return mesh;
 }
 
 // --------------------------------------------
 
 void _e2r_submit_vert_data()
 {
+    Vk_StreamBuffer *stream_buffer = &ctx.stream_buffers[ctx.current_vk_frame];
+
     // UI pipeline data
     {
         E2R_UIRenderData render_data = e2r_get_ui_render_data();
-        ctx.ui_index_count = render_data.index_list->size;
+        ctx.ui_quad_count = render_data.instance_list->size;
 
-        memcpy(ctx.vk_ui_pipeline_bundle.vertex_buffer_bundle.data_ptr, render_data.vert_list->data, render_data.vert_list->size * sizeof(*render_data.vert_list->data));
-        memcpy(ctx.vk_ui_pipeline_bundle.index_buffer_bundle.data_ptr, render_data.index_list->data, render_data.index_list->size * sizeof(*render_data.index_list->data));
+        size_t instance_data_size = render_data.instance_list->size * sizeof(*render_data.instance_list->data);
+
+        ctx.ui_instance_allocation = _vk_stream_buffer_alloc(stream_buffer, instance_data_size, STREAM_ALLOCATION_ALIGNMENT);
+        memcpy(ctx.ui_instance_allocation.data_ptr, render_data.instance_list->data, instance_data_size);
 
         e2r_reset_ui_data();
     }
 
-    // Cubes pipeline data
+    // Mesh instance data, packed per mesh into this frame's instance buffer.
+    // Under CPU culling only the visible instances are packed.
     {
-        E2R_3DRenderData render_data = e2r_get_cubes_render_data();
-        ctx.cubes_index_count = render_data.index_list->size;
+        E2R_3DRenderData render_data = e2r_get_3d_render_data();
+        list_clear(&ctx.mesh_draw_list);
+
+        u32 total_instance_count = 0;
+        for (u32 mesh_i = 0; mesh_i < render_data.mesh_count; mesh_i++)
+        {
+            total_instance_count += render_data.mesh_instance_lists[mesh_i].size;
+        }
+
+        ctx.instance_count = total_instance_count;
+        ctx.instance_allocation = _vk_stream_buffer_alloc(stream_buffer, total_instance_count * sizeof(Instance3D), ctx.vk_storage_buffer_alignment);
+        Instance3D *instances = ctx.instance_allocation.data_ptr;
+
+        u32 first_instance = 0;
+        for (u32 mesh_i = 0; mesh_i < render_data.mesh_count; mesh_i++)
+        {
+            const E2R_3DInstanceList *instance_list = &render_data.mesh_instance_lists[mesh_i];
+            if (instance_list->size == 0 || !ctx.mesh_list.data[mesh_i].is_resident) continue;
+
+            u32 instance_count = instance_list->size;
+            if (ctx.culling_mode == E2R_CULLING_CPU)
+            {
+                v4 bounding_sphere = ctx.mesh_list.data[mesh_i].bounding_sphere;
+                instance_count = e2r_cull_instances(&ctx.frustum, bounding_sphere, instance_list->data, instance_list->size, instances + first_instance);
+                if (instance_count == 0) continue;
+            }
+            else
+            {
+                memcpy(instances + first_instance, instance_list->data, instance_list->size * sizeof(*instance_list->data));
+            }
+
+            E2R_MeshDraw mesh_draw =
+            {
+                .mesh = mesh_i,
+                .first_instance = first_instance,
+                .instance_count = instance_count
+            };
+            list_append(&ctx.mesh_draw_list, mesh_draw);
+
+            first_instance += instance_count;
+        }
+
+        switch (ctx.culling_mode)
+        {
+            case E2R_CULLING_GPU: ctx.cull_stats = (E2R_CullStats){}; break;
+            case E2R_CULLING_CPU: ctx.cull_stats = (E2R_CullStats){ .visible_count = first_instance, .culled_count = total_instance_count - first_instance }; break;
+            case E2R_CULLING_NONE: ctx.cull_stats = (E2R_CullStats){ .visible_count = total_instance_count, .culled_count = 0 }; break;
+        }
+
+        // Under GPU culling, indirect commands start with no instances and the cull pass counts visible ones in
+        ctx.draw_command_allocation = _vk_stream_buffer_alloc(stream_buffer, ctx.mesh_draw_list.size * sizeof(VkDrawIndexedIndirectCommand), ctx.vk_storage_buffer_alignment);
+        VkDrawIndexedIndirectCommand *draw_commands = ctx.draw_command_allocation.data_ptr;
+        const E2R_MeshDraw *mesh_draw;
+        list_iterate(&ctx.mesh_draw_list, mesh_draw_i, mesh_draw)
+        {
+            draw_commands[mesh_draw_i] = (VkDrawIndexedIndirectCommand){
+                .indexCount = ctx.mesh_list.data[mesh_draw->mesh].index_count,
+                .instanceCount = ctx.culling_mode == E2R_CULLING_GPU ? 0 : mesh_draw->instance_count,
+                .firstIndex = 0,
+                .vertexOffset = 0,
+                .firstInstance = mesh_draw->first_instance
+            };
+        }
+
+        // Safe to replace, this frame's previous use of it has finished
+        Vk_BufferBundle *culled_instance_buffer = &ctx.culled_instance_buffers[ctx.current_vk_frame];
+        VkDeviceSize culled_size = total_instance_count * sizeof(Instance3D);
+        if (culled_size > culled_instance_buffer->size)
+        {
+            VkDeviceSize new_size = culled_instance_buffer->size * 2;
+            while (new_size < culled_size) new_size *= 2;
+            _vk_destroy_buffer_bundle(culled_instance_buffer);
+            *culled_instance_buffer = _vk_create_device_buffer_bundle(new_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        }
+
+        e2r_reset_3d_data();
+    }
+}
 
-        memcpy(ctx.vk_cubes_pipeline_bundle.vertex_buffer_bundle.data_ptr, render_data.vert_list->data, render_data.vert_list->size * sizeof(*render_data.vert_list->data));
-        memcpy(ctx.vk_cubes_pipeline_bundle.index_buffer_bundle.data_ptr, render_data.index_list->data, render_data.index_list->size * sizeof(*render_data.index_list->data));
+void _e2r_update_cull_descriptor_set()
+{
+    VkDescriptorSet descriptor_set = ctx.vk_cull_pipeline_bundle.descriptor_sets[ctx.current_vk_frame];
+    const Vk_BufferBundle *culled_instance_buffer = &ctx.culled_instance_buffers[ctx.current_vk_frame];
+
+    VkDescriptorBufferInfo descriptor_buffer_infos[3] = {};
+    descriptor_buffer_infos[0].buffer = ctx.instance_allocation.buffer;
+    descriptor_buffer_infos[0].offset = ctx.instance_allocation.offset;
+    descriptor_buffer_infos[0].range = ctx.instance_count * sizeof(Instance3D);
+    descriptor_buffer_infos[1].buffer = ctx.draw_command_allocation.buffer;
+    descriptor_buffer_infos[1].offset = ctx.draw_command_allocation.offset;
+    descriptor_buffer_infos[1].range = ctx.mesh_draw_list.size * sizeof(VkDrawIndexedIndirectCommand);
+    descriptor_buffer_infos[2].buffer = culled_instance_buffer->buffer;
+    descriptor_buffer_infos[2].offset = 0;
+    descriptor_buffer_infos[2].range = culled_instance_buffer->size;
+
+    VkWriteDescriptorSet write_descriptor_sets[3] = {};
+    for (u32 i = 0; i < array_count(write_descriptor_sets); i++)
+    {
+        write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_sets[i].dstSet = descriptor_set;
+        write_descriptor_sets[i].dstBinding = i;
+        write_descriptor_sets[i].dstArrayElement = 0;
+        write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_descriptor_sets[i].descriptorCount = 1;
+        write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
     }
+
+    vkUpdateDescriptorSets(ctx.vk_device, array_count(write_descriptor_sets), write_descriptor_sets, 0, NULL);
 }
 
 void _e2r_submit_ubos()
@@ -2015,6 +3922,7 @@ void _e2r_submit_ubos()
 
         m4 perspective_proj = m4_proj_perspective(deg_to_rad(60), window_dim.x / window_dim.y, 0.1f, 100.0f);
         m4 view_proj = m4_mul(perspective_proj, ctx.view_transform);
+        m4_frustum_planes(view_proj, ctx.frustum.planes);
 
         {
             UBOLayoutGlobal3D ubo_data =
@@ -2039,17 +3947,218 @@ void _e2r_submit_ubos()
     }
 }
 
-void _e2r_acquire_next_image()
+// Returns false if no image was acquired and the frame has to be skipped
+bool _e2r_acquire_next_image()
 {
     const Vk_Frame *frame = &ctx.vk_frame_list.frames[ctx.current_vk_frame];
     VkResult result = vkAcquireNextImageKHR(ctx.vk_device, ctx.vk_swapchain_bundle.swapchain, UINT64_MAX, frame->acquire_semaphore, VK_NULL_HANDLE, &ctx.current_swapchain_image);
-    if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR)
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
         trace("Out of date swapchain from vkAcquireNextImageKHR");
         ctx.rebuild_swapchain = true;
-        return;
+        return false;
+    }
+    else if (result == VK_SUBOPTIMAL_KHR)
+    {
+        // The image is acquired and the semaphore will be signaled, so still render and present it
+        trace("Suboptimal swapchain from vkAcquireNextImageKHR");
+        ctx.rebuild_swapchain = true;
     }
     else if (result != VK_SUCCESS) fatal("Failed to acquire next image");
+
+    return true;
+}
+
+// Secondary command buffers don't inherit dynamic state, so every recording sets it
+void _e2r_set_viewport_and_scissor(VkCommandBuffer command_buffer)
+{
+    VkExtent2D extent = ctx.vk_swapchain_bundle.extent;
+    VkViewport viewport = {0, 0, (float)extent.width, (float)extent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, extent};
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+}
+
+void _e2r_bind_mesh_pipeline(VkCommandBuffer command_buffer)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx.vk_cubes_pipeline_bundle.pipeline);
+    _e2r_set_viewport_and_scissor(command_buffer);
+
+    VkDescriptorSet descriptor_sets[] = { ctx.vk_cubes_pipeline_bundle.descriptor_sets[ctx.current_vk_frame], ctx.vk_texture_table.descriptor_set };
+    vkCmdBindDescriptorSets(
+        command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+        ctx.vk_cubes_pipeline_bundle.pipeline_layout,
+        0,
+        array_count(descriptor_sets), descriptor_sets,
+        0, NULL
+    );
+}
+
+void _e2r_record_mesh_draws(VkCommandBuffer command_buffer, u32 first_draw, u32 end_draw)
+{
+    _e2r_bind_mesh_pipeline(command_buffer);
+
+    bool gpu_culled = ctx.culling_mode == E2R_CULLING_GPU;
+    for (u32 mesh_draw_i = first_draw; mesh_draw_i < end_draw; mesh_draw_i++)
+    {
+        const E2R_MeshDraw *mesh_draw = &ctx.mesh_draw_list.data[mesh_draw_i];
+        const Vk_MeshBundle *mesh_bundle = &ctx.mesh_list.data[mesh_draw->mesh];
+
+        VkBuffer vertex_buffers[] =
+        {
+            mesh_bundle->vertex_buffer_bundle.buffer,
+            gpu_culled ? ctx.culled_instance_buffers[ctx.current_vk_frame].buffer : ctx.instance_allocation.buffer
+        };
+        VkDeviceSize offsets[] = {0, gpu_culled ? 0 : ctx.instance_allocation.offset};
+        vkCmdBindVertexBuffers(command_buffer, 0, array_count(vertex_buffers), vertex_buffers, offsets);
+
+        vkCmdBindIndexBuffer(command_buffer, mesh_bundle->index_buffer_bundle.buffer, 0, VERT_INDEX_TYPE);
+
+        VkDeviceSize draw_command_offset = ctx.draw_command_allocation.offset + mesh_draw_i * sizeof(VkDrawIndexedIndirectCommand);
+        vkCmdDrawIndexedIndirect(command_buffer, ctx.draw_command_allocation.buffer, draw_command_offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+// Draws the instances in [first_instance, end_instance) of the frame's packed instance buffer, which can cut
+// one mesh draw into several. Only valid when the CPU knows the instance counts, so not under GPU culling.
+void _e2r_record_instance_range(VkCommandBuffer command_buffer, u32 first_instance, u32 end_instance)
+{
+    bassert(ctx.culling_mode != E2R_CULLING_GPU);
+    _e2r_bind_mesh_pipeline(command_buffer);
+
+    const E2R_MeshDraw *mesh_draw;
+    list_iterate(&ctx.mesh_draw_list, mesh_draw_i, mesh_draw)
+    {
+        u32 draw_first = mesh_draw->first_instance > first_instance ? mesh_draw->first_instance : first_instance;
+        u32 draw_end = mesh_draw->first_instance + mesh_draw->instance_count;
+        if (draw_end > end_instance) draw_end = end_instance;
+        if (draw_first >= draw_end) continue;
+
+        const Vk_MeshBundle *mesh_bundle = &ctx.mesh_list.data[mesh_draw->mesh];
+
+        VkBuffer vertex_buffers[] = { mesh_bundle->vertex_buffer_bundle.buffer, ctx.instance_allocation.buffer };
+        VkDeviceSize offsets[] = {0, ctx.instance_allocation.offset};
+        vkCmdBindVertexBuffers(command_buffer, 0, array_count(vertex_buffers), vertex_buffers, offsets);
+
+        vkCmdBindIndexBuffer(command_buffer, mesh_bundle->index_buffer_bundle.buffer, 0, VERT_INDEX_TYPE);
+
+        vkCmdDrawIndexed(command_buffer, mesh_bundle->index_count, draw_end - draw_first, 0, 0, draw_first);
+    }
+}
+
+void _e2r_record_ui_draws(VkCommandBuffer command_buffer)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx.vk_ui_pipeline_bundle.pipeline);
+    _e2r_set_viewport_and_scissor(command_buffer);
+    if (ctx.ui_quad_count > 0)
+    {
+        VkDeviceSize offsets[] = {ctx.ui_instance_allocation.offset};
+        vkCmdBindVertexBuffers(command_buffer, 0, 1, &ctx.ui_instance_allocation.buffer, offsets);
+
+        VkDescriptorSet descriptor_sets[] = { ctx.vk_ui_pipeline_bundle.descriptor_sets[ctx.current_vk_frame], ctx.vk_texture_table.descriptor_set };
+        vkCmdBindDescriptorSets(
+            command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+            ctx.vk_ui_pipeline_bundle.pipeline_layout,
+            0,
+            array_count(descriptor_sets), descriptor_sets,
+            0, NULL
+        );
+
+        // Two triangles per quad instance
+        vkCmdDraw(command_buffer, 6, ctx.ui_quad_count, 0, 0);
+    }
+}
+
+typedef struct _E2R_RecordingJob
+{
+    u32 slice_count;
+    bool slices_are_instances; // else mesh draws
+    u32 items_per_slice;
+    u32 item_count;
+
+} _E2R_RecordingJob;
+
+// Slots [0, slice_count) record 3D slices, slot slice_count records the UI
+void _e2r_recording_job(void *user_data, u32 start, u32 end)
+{
+    const _E2R_RecordingJob *job = user_data;
+
+    for (u32 slot_i = start; slot_i < end; slot_i++)
+    {
+        VkCommandPool command_pool = ctx.vk_recording_bundle.command_pools[ctx.current_vk_frame][slot_i];
+        VkCommandBuffer command_buffer = ctx.vk_recording_bundle.command_buffers[ctx.current_vk_frame][slot_i];
+        bool is_ui = slot_i == job->slice_count;
+
+        VkResult result = vkResetCommandPool(ctx.vk_device, command_pool, 0);
+        if (result != VK_SUCCESS) fatal("Failed to reset recording command pool");
+
+        VkCommandBufferInheritanceInfo inheritance_info = {};
+        inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance_info.renderPass = ctx.vk_render_pass_bundle.render_pass;
+        inheritance_info.subpass = is_ui ? 1 : 0;
+        inheritance_info.framebuffer = ctx.vk_framebuffer_bundle.framebuffers[ctx.current_swapchain_image];
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = &inheritance_info;
+        result = vkBeginCommandBuffer(command_buffer, &begin_info);
+        if (result != VK_SUCCESS) fatal("Failed to begin secondary command buffer");
+
+        if (is_ui)
+        {
+            _e2r_record_ui_draws(command_buffer);
+        }
+        else
+        {
+            u32 first_item = slot_i * job->items_per_slice;
+            u32 end_item = first_item + job->items_per_slice;
+            if (end_item > job->item_count) end_item = job->item_count;
+            if (job->slices_are_instances) _e2r_record_instance_range(command_buffer, first_item, end_item);
+            else _e2r_record_mesh_draws(command_buffer, first_item, end_item);
+        }
+
+        result = vkEndCommandBuffer(command_buffer);
+        if (result != VK_SUCCESS) fatal("Failed to end secondary command buffer");
+    }
+}
+
+// Returns the number of 3D slices; the UI buffer follows them.
+// Under GPU culling the cull pass writes each indirect draw's instance count, so slices are whole mesh draws;
+// otherwise the counts are known here and slices are instance ranges, which also splits one big instanced draw.
+u32 _e2r_record_secondary_command_buffers()
+{
+    bool slices_are_instances = ctx.culling_mode != E2R_CULLING_GPU;
+    u32 item_count = 0;
+    if (slices_are_instances)
+    {
+        const E2R_MeshDraw *mesh_draw;
+        list_iterate(&ctx.mesh_draw_list, mesh_draw_i, mesh_draw)
+        {
+            item_count += mesh_draw->instance_count;
+        }
+    }
+    else
+    {
+        item_count = (u32)ctx.mesh_draw_list.size;
+    }
+    u32 min_items_per_slice = slices_are_instances ? MIN_INSTANCES_PER_RECORDING_SLICE : MIN_MESH_DRAWS_PER_RECORDING_SLICE;
+
+    u32 max_slice_count = ctx.vk_recording_bundle.slot_count - 1;
+    u32 slice_count = (item_count + min_items_per_slice - 1) / min_items_per_slice;
+    if (slice_count > max_slice_count) slice_count = max_slice_count;
+    if (slice_count == 0) slice_count = 1;
+
+    _E2R_RecordingJob job =
+    {
+        .slice_count = slice_count,
+        .slices_are_instances = slices_are_instances,
+        .items_per_slice = (item_count + slice_count - 1) / slice_count,
+        .item_count = item_count,
+    };
+    e2r_jobs_parallel_for(slice_count + 1, 1, _e2r_recording_job, &job);
+
+    return slice_count;
 }
 
 void _e2r_render()
@@ -2067,121 +4176,120 @@ void _e2r_render()
         result = vkBeginCommandBuffer(frame->command_buffer, &command_buffer_begin_info);
         if (result != VK_SUCCESS) fatal("Failed to begin command buffer");
 
-        // Clear Render pass
+        u32 first_timestamp = ctx.current_vk_frame * TIMESTAMPS_PER_FRAME;
+        if (ctx.vk_timestamp_query_pool != VK_NULL_HANDLE)
         {
-            VkClearValue clear_values[] = {
-                [0].color = (VkClearColorValue){{0.6f, 0.6f, 0.6f, 1.0f}},
-                [1].depthStencil = (VkClearDepthStencilValue){1.0f, 0}
-            };
-            VkRect2D render_area = {};
-            render_area.offset = (VkOffset2D){0, 0};
-            render_area.extent = ctx.vk_swapchain_bundle.extent;
-            VkRenderPassBeginInfo render_pass_begin_info = {};
-            render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            render_pass_begin_info.renderPass = ctx.vk_clear_render_pass_bundle.render_pass;
-            render_pass_begin_info.framebuffer = ctx.vk_clear_render_pass_bundle.framebuffers[ctx.current_swapchain_image];
-            render_pass_begin_info.renderArea = render_area;
-            render_pass_begin_info.clearValueCount = array_count(clear_values);
-            render_pass_begin_info.pClearValues = clear_values;
-            vkCmdBeginRenderPass(frame->command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdEndRenderPass(frame->command_buffer);
+            vkCmdResetQueryPool(frame->command_buffer, ctx.vk_timestamp_query_pool, first_timestamp, TIMESTAMPS_PER_FRAME);
+            vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, ctx.vk_timestamp_query_pool, first_timestamp);
         }
 
-        // 3D Render pass
-        {
-            VkClearValue clear_values[] = {
-                [0].color = {},
-                [1].depthStencil = (VkClearDepthStencilValue){1.0f, 0}
-            };
-            VkRect2D render_area = {};
-            render_area.offset = (VkOffset2D){0, 0};
-            render_area.extent = ctx.vk_swapchain_bundle.extent;
-            VkRenderPassBeginInfo render_pass_begin_info = {};
-            render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            render_pass_begin_info.renderPass = ctx.vk_3d_render_pass_bundle.render_pass;
-            render_pass_begin_info.framebuffer = ctx.vk_3d_render_pass_bundle.framebuffers[ctx.current_swapchain_image];
-            render_pass_begin_info.renderArea = render_area;
-            render_pass_begin_info.clearValueCount = array_count(clear_values);
-            render_pass_begin_info.pClearValues = clear_values;
-            vkCmdBeginRenderPass(frame->command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        _vk_cmd_acquire_uploads(frame->command_buffer);
 
-            vkCmdBindPipeline(frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx.vk_cubes_pipeline_bundle.pipeline);
+        _vk_cmd_update_glyph_atlas(frame->command_buffer);
 
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(frame->command_buffer, 0, 1, &ctx.vk_cubes_pipeline_bundle.vertex_buffer_bundle.buffer, offsets);
+        // Cull pass: compacts visible instances per mesh draw and fills in the indirect instance counts
+        if (ctx.culling_mode == E2R_CULLING_GPU && ctx.instance_count > 0)
+        {
+            _e2r_update_cull_descriptor_set();
 
-            vkCmdBindIndexBuffer(frame->command_buffer, ctx.vk_cubes_pipeline_bundle.index_buffer_bundle.buffer, 0, VERT_INDEX_TYPE);
+            vkCmdBindPipeline(frame->command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, ctx.vk_cull_pipeline_bundle.pipeline);
 
             vkCmdBindDescriptorSets(
-                frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                ctx.vk_cubes_pipeline_bundle.pipeline_layout,
+                frame->command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                ctx.vk_cull_pipeline_bundle.pipeline_layout,
                 0,
-                1, &ctx.vk_cubes_pipeline_bundle.descriptor_sets[ctx.current_vk_frame],
+                1, &ctx.vk_cull_pipeline_bundle.descriptor_sets[ctx.current_vk_frame],
                 0, NULL
             );
 
-            const E2R_3DDrawCallList *draw_calls = e2r_get_cubes_draw_calls();
-            E2R_3DDrawCall *draw_call;
-            list_iterate(draw_calls, draw_call_i, draw_call)
+            CullPushConstants push_constants = {};
+            memcpy(push_constants.frustum_planes, ctx.frustum.planes, sizeof(ctx.frustum.planes));
+
+            const E2R_MeshDraw *mesh_draw;
+            list_iterate(&ctx.mesh_draw_list, mesh_draw_i, mesh_draw)
             {
-                vkCmdPushConstants(frame->command_buffer, ctx.vk_cubes_pipeline_bundle.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(m4), &draw_call->model);
-                vkCmdDrawIndexed(frame->command_buffer, ctx.cubes_index_count, 1, 0, 0, 0);
+                push_constants.bounding_sphere = ctx.mesh_list.data[mesh_draw->mesh].bounding_sphere;
+                push_constants.first_instance = mesh_draw->first_instance;
+                push_constants.instance_count = mesh_draw->instance_count;
+                push_constants.draw_index = mesh_draw_i;
+
+                vkCmdPushConstants(frame->command_buffer, ctx.vk_cull_pipeline_bundle.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                vkCmdDispatch(frame->command_buffer, (mesh_draw->instance_count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
             }
-            e2r_reset_cubes_data();
 
-            ctx.cubes_index_count = 0;
+            VkMemoryBarrier memory_barrier = {};
+            memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            memory_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+            vkCmdPipelineBarrier(
+                frame->command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                0,
+                1, &memory_barrier,
+                0, NULL,
+                0, NULL
+            );
+        }
 
-            vkCmdEndRenderPass(frame->command_buffer);
+        u32 slice_count = 0;
+        if (ctx.recording_mode == E2R_RECORDING_PARALLEL)
+        {
+            slice_count = _e2r_record_secondary_command_buffers();
         }
+        VkSubpassContents subpass_contents = ctx.recording_mode == E2R_RECORDING_PARALLEL ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        VkCommandBuffer *secondary_command_buffers = ctx.vk_recording_bundle.command_buffers[ctx.current_vk_frame];
 
-        // 2D Render pass
+        // Render pass
         {
+            VkClearValue clear_values[] = {
+                [0].color = (VkClearColorValue){{0.6f, 0.6f, 0.6f, 1.0f}},
+                [1].depthStencil = (VkClearDepthStencilValue){1.0f, 0}
+            };
             VkRect2D render_area = {};
             render_area.offset = (VkOffset2D){0, 0};
             render_area.extent = ctx.vk_swapchain_bundle.extent;
             VkRenderPassBeginInfo render_pass_begin_info = {};
             render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            render_pass_begin_info.renderPass = ctx.vk_2d_render_pass_bundle.render_pass;
-            render_pass_begin_info.framebuffer = ctx.vk_2d_render_pass_bundle.framebuffers[ctx.current_swapchain_image];
+            render_pass_begin_info.renderPass = ctx.vk_render_pass_bundle.render_pass;
+            render_pass_begin_info.framebuffer = ctx.vk_framebuffer_bundle.framebuffers[ctx.current_swapchain_image];
             render_pass_begin_info.renderArea = render_area;
-            render_pass_begin_info.clearValueCount = 0;
-            vkCmdBeginRenderPass(frame->command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+            render_pass_begin_info.clearValueCount = array_count(clear_values);
+            render_pass_begin_info.pClearValues = clear_values;
+            vkCmdBeginRenderPass(frame->command_buffer, &render_pass_begin_info, subpass_contents);
 
-            vkCmdBindPipeline(frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx.vk_ui_pipeline_bundle.pipeline);
+            // 3D subpass
+            if (subpass_contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
             {
-                VkDeviceSize offsets[] = {0};
-                vkCmdBindVertexBuffers(frame->command_buffer, 0, 1, &ctx.vk_ui_pipeline_bundle.vertex_buffer_bundle.buffer, offsets);
-
-                vkCmdBindIndexBuffer(frame->command_buffer, ctx.vk_ui_pipeline_bundle.index_buffer_bundle.buffer, 0, VERT_INDEX_TYPE);
+                vkCmdExecuteCommands(frame->command_buffer, slice_count, secondary_command_buffers);
+            }
+            else
+            {
+                _e2r_record_mesh_draws(frame->command_buffer, 0, (u32)ctx.mesh_draw_list.size);
+            }
 
-                vkCmdBindDescriptorSets(
-                    frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    ctx.vk_ui_pipeline_bundle.pipeline_layout,
-                    0,
-                    1, &ctx.vk_ui_pipeline_bundle.descriptor_sets[ctx.current_vk_frame],
-                    0, NULL
-                );
+            vkCmdNextSubpass(frame->command_buffer, subpass_contents);
 
-                vkCmdDrawIndexed(frame->command_buffer, ctx.ui_index_count, 1, 0, 0, 0);
-                ctx.ui_index_count = 0;
+            // UI subpass
+            if (subpass_contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+            {
+                vkCmdExecuteCommands(frame->command_buffer, 1, &secondary_command_buffers[slice_count]);
+            }
+            else
+            {
+                _e2r_record_ui_draws(frame->command_buffer);
             }
 
             vkCmdEndRenderPass(frame->command_buffer);
         }
 
-        // Final Render pass
+        list_clear(&ctx.mesh_draw_list);
+        ctx.ui_quad_count = 0;
+
+        if (ctx.vk_timestamp_query_pool != VK_NULL_HANDLE)
         {
-            VkRect2D render_area = {};
-            render_area.offset = (VkOffset2D){0, 0};
-            render_area.extent = ctx.vk_swapchain_bundle.extent;
-            VkRenderPassBeginInfo render_pass_begin_info = {};
-            render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            render_pass_begin_info.renderPass = ctx.vk_final_render_pass_bundle.render_pass;
-            render_pass_begin_info.framebuffer = ctx.vk_final_render_pass_bundle.framebuffers[ctx.current_swapchain_image];
-            render_pass_begin_info.renderArea = render_area;
-            render_pass_begin_info.clearValueCount = 0;
-            vkCmdBeginRenderPass(frame->command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdEndRenderPass(frame->command_buffer);
+            vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, ctx.vk_timestamp_query_pool, first_timestamp + 1);
+            ctx.timestamps_pending[ctx.current_vk_frame] = true;
         }
 
         result = vkEndCommandBuffer(frame->command_buffer);
@@ -2199,8 +4307,11 @@ void _e2r_render()
         submit_info.signalSemaphoreCount = 1;
         submit_info.pSignalSemaphores = &ctx.vk_swapchain_bundle.submit_semaphores[ctx.current_swapchain_image];
 
+        vkResetFences(ctx.vk_device, 1, &frame->in_flight_fence);
+
         result = vkQueueSubmit(ctx.vk_queue, 1, &submit_info, frame->in_flight_fence);
         if (result != VK_SUCCESS) fatal("Failed to submit command buffer to queue");
+        ctx.vk_frame_list.frames[ctx.current_vk_frame].submitted_serial = ++ctx.submit_serial;
     }
 }
 
@@ -2232,13 +4343,23 @@ void _e2r_present()
 
 void e2r_end_frame()
 {
+    _e2r_submit_ubos(); // also extracts the frustum used by CPU culling
     _e2r_submit_vert_data();
-    _e2r_submit_ubos();
-    _e2r_acquire_next_image();
-    _e2r_render();
-    _e2r_present();
+    if (_e2r_acquire_next_image())
+    {
+        _e2r_render();
+        _e2r_present();
 
-    ctx.current_vk_frame = (ctx.current_vk_frame + 1) % FRAMES_IN_FLIGHT;
+        ctx.current_vk_frame = (ctx.current_vk_frame + 1) % FRAMES_IN_FLIGHT;
+    }
+    else
+    {
+        // Nothing was submitted, the same frame in flight is reused after the rebuild
+        list_clear(&ctx.mesh_draw_list);
+        ctx.ui_quad_count = 0;
+    }
 
     e2r_clear_input_char_queue();
+
+    ctx.current_app_frame++;
 }
@@ -4,7 +4,63 @@
 #include <GLFW/glfw3.h>
 
 #include "common/types.h"
-#include "font_loader.h"
+#include "e2r_font.h"
+#include "vertex.h"
+
+typedef u32 E2R_MeshHandle;
+typedef u32 E2R_TextureHandle;
+
+typedef enum E2R_TextureFlags
+{
+    E2R_TEXTURE_MIPMAPS = 1 << 0, // full mip chain filled with GPU blits, sampled anisotropically when supported
+    E2R_TEXTURE_NEAREST = 1 << 1,
+    E2R_TEXTURE_CLAMP = 1 << 2,
+
+} E2R_TextureFlags;
+
+typedef struct E2R_MemoryStats
+{
+    u32 block_count; // includes dedicated allocations
+    u32 dedicated_allocation_count;
+    u32 allocation_count;
+    u64 bytes_reserved;
+    u64 bytes_used;
+
+} E2R_MemoryStats;
+
+typedef enum E2R_CullingMode
+{
+    E2R_CULLING_GPU,
+    E2R_CULLING_CPU,
+    E2R_CULLING_NONE,
+
+} E2R_CullingMode;
+
+// PARALLEL records the 3D draw list in slices and the UI on worker threads, into secondary command buffers
+typedef enum E2R_RecordingMode
+{
+    E2R_RECORDING_INLINE,
+    E2R_RECORDING_PARALLEL,
+
+} E2R_RecordingMode;
+
+// Counted for the last submitted frame; zero under E2R_CULLING_GPU, as those counts stay on the GPU
+typedef struct E2R_CullStats
+{
+    u32 visible_count;
+    u32 culled_count;
+
+} E2R_CullStats;
+
+// avg_* are exponential moving averages; GPU times stay zero if the queue has no timestamp support
+typedef struct E2R_FrameTimings
+{
+    f32 cpu_frame_ms;
+    f32 gpu_frame_ms;
+    f32 avg_cpu_frame_ms;
+    f32 avg_gpu_frame_ms;
+
+} E2R_FrameTimings;
 
 
 void e2r_init(int width, int height, const char *name);
@@ -23,4 +79,34 @@ void e2r_set_light_data(
     v3 pos,
     f32 shininess);
 u64 e2r_get_current_frame();
-const FontAtlas *e2r_get_font_atlas_TEMP();
+E2R_MemoryStats e2r_get_memory_stats();
+void e2r_set_culling_mode(E2R_CullingMode mode);
+E2R_CullingMode e2r_get_culling_mode();
+void e2r_set_recording_mode(E2R_RecordingMode mode);
+E2R_RecordingMode e2r_get_recording_mode();
+E2R_CullStats e2r_get_cull_stats();
+E2R_FrameTimings e2r_get_frame_timings();
+E2R_FontHandle e2r_get_default_font();
+E2R_TextureHandle e2r_get_default_texture();
+E2R_TextureHandle e2r_get_ui_atlas_texture();
+E2R_TextureHandle e2r_get_font_atlas_texture(); // the glyph atlas shared by every font
+
+// Uploads once to device-local memory; the handle stays valid until e2r_destroy.
+// Outside of an upload batch this waits for the upload, so the mesh can be drawn right away.
+E2R_MeshHandle e2r_mesh_create(const Vertex3D *verts, u32 vert_count, const VertIndex *indices, u32 index_count);
+
+// Pixels are RGBA8 and copied out immediately. Works like e2r_mesh_create with respect to upload batches.
+// Every texture lives in one bindless table, so draws can mix any of them; the handle stays valid until e2r_destroy.
+E2R_TextureHandle e2r_texture_create(const void *pixels, u32 w, u32 h, u32 flags); // E2R_TextureFlags
+bool e2r_texture_is_ready(E2R_TextureHandle texture);
+// What vertices and instances carry; a texture that is still uploading maps to a white fallback
+u32 e2r_texture_get_shader_index(E2R_TextureHandle texture);
+
+// Batched uploads: every e2r_texture_create and e2r_mesh_create between begin and flush is staged and copied
+// with one submit, on a dedicated transfer queue when the device has one. Flush doesn't block.
+// Textures and meshes become ready once the batch is complete (e2r_upload_is_complete or e2r_upload_wait);
+// until then draws skip the meshes and sample the fallback for the textures.
+void e2r_upload_begin();
+void e2r_upload_flush();
+bool e2r_upload_is_complete();
+void e2r_upload_wait();
@@ -0,0 +1,225 @@
+#include "e2r_cull.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "common/types.h"
+#include "common/util.h"
+#include "e2r_camera.h"
+#include "e2r_jobs.h"
+#include "vertex.h"
+
+#define CULL_BATCH_SIZE 4096 // multiple of 4
+
+typedef struct _CullJob
+{
+    const E2R_Frustum *frustum;
+    v4 bounding_sphere;
+    const Instance3D *instances;
+    Instance3D *out_instances;
+
+} _CullJob;
+
+// World space bounding spheres, SoA so four can be tested at once
+typedef struct _CullScratch
+{
+    f32 *xs;
+    f32 *ys;
+    f32 *zs;
+    f32 *rs;
+    u8 *visible;
+    u32 capacity;
+
+    u32 *batch_offsets;
+    u32 batch_capacity;
+
+} _CullScratch;
+
+globvar _CullScratch cull_scratch;
+
+// ===============================================
+
+static void _ensure_scratch(u32 instance_count, u32 batch_count)
+{
+    if (instance_count > cull_scratch.capacity)
+    {
+        u32 capacity = cull_scratch.capacity ? cull_scratch.capacity : 1024;
+        while (capacity < instance_count) capacity *= 2;
+        cull_scratch.xs = xrealloc(cull_scratch.xs, capacity * sizeof(f32));
+        cull_scratch.ys = xrealloc(cull_scratch.ys, capacity * sizeof(f32));
+        cull_scratch.zs = xrealloc(cull_scratch.zs, capacity * sizeof(f32));
+        cull_scratch.rs = xrealloc(cull_scratch.rs, capacity * sizeof(f32));
+        cull_scratch.visible = xrealloc(cull_scratch.visible, capacity * sizeof(u8));
+        cull_scratch.capacity = capacity;
+    }
+    if (batch_count + 1 > cull_scratch.batch_capacity)
+    {
+        cull_scratch.batch_capacity = batch_count + 1;
+        cull_scratch.batch_offsets = xrealloc(cull_scratch.batch_offsets, cull_scratch.batch_capacity * sizeof(u32));
+    }
+}
+
+static void _transform_spheres(const _CullJob *job, u32 start, u32 end)
+{
+    v4 s = job->bounding_sphere;
+    for (u32 i = start; i < end; i++)
+    {
+        const f32 *m = job->instances[i].model.d;
+        cull_scratch.xs[i] = m[0] * s.x + m[4] * s.y + m[8]  * s.z + m[12];
+        cull_scratch.ys[i] = m[1] * s.x + m[5] * s.y + m[9]  * s.z + m[13];
+        cull_scratch.zs[i] = m[2] * s.x + m[6] * s.y + m[10] * s.z + m[14];
+
+        // Largest axis scale keeps the sphere conservative under non-uniform scale
+        f32 sx = m[0]*m[0] + m[1]*m[1] + m[2]*m[2];
+        f32 sy = m[4]*m[4] + m[5]*m[5] + m[6]*m[6];
+        f32 sz = m[8]*m[8] + m[9]*m[9] + m[10]*m[10];
+        f32 max_sq = sx > sy ? sx : sy;
+        if (sz > max_sq) max_sq = sz;
+        cull_scratch.rs[i] = s.w * sqrtf(max_sq);
+    }
+}
+
+static u32 _test_spheres_scalar(const E2R_Frustum *frustum, u32 start, u32 end)
+{
+    u32 visible_count = 0;
+    for (u32 i = start; i < end; i++)
+    {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            v4 plane = frustum->planes[p];
+            f32 dist = plane.x * cull_scratch.xs[i] + plane.y * cull_scratch.ys[i] + plane.z * cull_scratch.zs[i] + plane.w;
+            inside = dist >= -cull_scratch.rs[i];
+        }
+        cull_scratch.visible[i] = inside;
+        visible_count += inside;
+    }
+    return visible_count;
+}
+
+// Tests four spheres per iteration, scalar for the tail
+static u32 _test_spheres(const E2R_Frustum *frustum, u32 start, u32 end)
+{
+    u32 visible_count = 0;
+    u32 i = start;
+
+#if defined(__SSE2__)
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(cull_scratch.xs + i);
+        __m128 y = _mm_loadu_ps(cull_scratch.ys + i);
+        __m128 z = _mm_loadu_ps(cull_scratch.zs + i);
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(cull_scratch.rs + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            v4 plane = frustum->planes[p];
+            __m128 dist = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, neg_r));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            u8 lane_visible = (mask >> lane) & 1;
+            cull_scratch.visible[i + lane] = lane_visible;
+            visible_count += lane_visible;
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= end; i += 4)
+    {
+        float32x4_t x = vld1q_f32(cull_scratch.xs + i);
+        float32x4_t y = vld1q_f32(cull_scratch.ys + i);
+        float32x4_t z = vld1q_f32(cull_scratch.zs + i);
+        float32x4_t neg_r = vnegq_f32(vld1q_f32(cull_scratch.rs + i));
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+        for (int p = 0; p < 6; p++)
+        {
+            v4 plane = frustum->planes[p];
+            float32x4_t dist = vdupq_n_f32(plane.w);
+            dist = vmlaq_n_f32(dist, x, plane.x);
+            dist = vmlaq_n_f32(dist, y, plane.y);
+            dist = vmlaq_n_f32(dist, z, plane.z);
+            inside = vandq_u32(inside, vcgeq_f32(dist, neg_r));
+        }
+        u32 lanes[4];
+        vst1q_u32(lanes, inside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            u8 lane_visible = lanes[lane] != 0;
+            cull_scratch.visible[i + lane] = lane_visible;
+            visible_count += lane_visible;
+        }
+    }
+#endif
+
+    visible_count += _test_spheres_scalar(frustum, i, end);
+    return visible_count;
+}
+
+static void _cull_test_range(void *user_data, u32 start, u32 end)
+{
+    const _CullJob *job = user_data;
+    _transform_spheres(job, start, end);
+    cull_scratch.batch_offsets[start / CULL_BATCH_SIZE + 1] = _test_spheres(job->frustum, start, end);
+}
+
+static void _cull_compact_range(void *user_data, u32 start, u32 end)
+{
+    const _CullJob *job = user_data;
+    Instance3D *out = job->out_instances + cull_scratch.batch_offsets[start / CULL_BATCH_SIZE];
+    for (u32 i = start; i < end; i++)
+    {
+        if (cull_scratch.visible[i]) *out++ = job->instances[i];
+    }
+}
+
+// ===============================================
+
+u32 e2r_cull_instances(const E2R_Frustum *frustum, v4 bounding_sphere, const Instance3D *instances, u32 instance_count, Instance3D *out_instances)
+{
+    if (instance_count == 0) return 0;
+
+    u32 batch_count = (instance_count + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+    _ensure_scratch(instance_count, batch_count);
+
+    _CullJob job =
+    {
+        .frustum = frustum,
+        .bounding_sphere = bounding_sphere,
+        .instances = instances,
+        .out_instances = out_instances
+    };
+
+    // Test, then turn per batch visible counts into output offsets, then compact
+    e2r_jobs_parallel_for(instance_count, CULL_BATCH_SIZE, _cull_test_range, &job);
+
+    cull_scratch.batch_offsets[0] = 0;
+    for (u32 batch = 0; batch < batch_count; batch++)
+    {
+        cull_scratch.batch_offsets[batch + 1] += cull_scratch.batch_offsets[batch];
+    }
+
+    e2r_jobs_parallel_for(instance_count, CULL_BATCH_SIZE, _cull_compact_range, &job);
+
+    return cull_scratch.batch_offsets[batch_count];
+}
+
+void e2r_cull_free_scratch()
+{
+    free(cull_scratch.xs);
+    free(cull_scratch.ys);
+    free(cull_scratch.zs);
+    free(cull_scratch.rs);
+    free(cull_scratch.visible);
+    free(cull_scratch.batch_offsets);
+    cull_scratch = (_CullScratch){};
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "common/types.h"
+#include "e2r_camera.h"
+#include "vertex.h"
+
+// Copies the instances whose bounding sphere touches the frustum into out_instances, keeping their order.
+// bounding_sphere is in mesh space (center, radius). Returns the visible count.
+u32 e2r_cull_instances(const E2R_Frustum *frustum, v4 bounding_sphere, const Instance3D *instances, u32 instance_count, Instance3D *out_instances);
+void e2r_cull_free_scratch();
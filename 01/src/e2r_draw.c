@@ -3,49 +3,90 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <font_loader.h>
-
 #include "common/lin_math.h"
 #include "common/types.h"
 #include "common/util.h"
+#include "e2r_core.h"
+#include "e2r_font.h"
 #include "vertex.h"
 
-typedef struct _UIQuad
+typedef struct _DrawData
 {
-    v2 pos_min;
-    v2 pos_max;
-    v2 uv_min;
-    v2 uv_max;
-    v4 color;
-    u32 tex_index;
+    E2R_UIInstanceList ui_instance_list;
+    E2R_UIInstanceList *ui_target; // NULL draws into ui_instance_list
+
+    E2R_3DInstanceList *mesh_instance_lists;
+    u32 mesh_instance_list_count;
+
+    bool has_cube_mesh;
+    E2R_MeshHandle cube_mesh;
 
-} _UIQuad;
+} _DrawData;
+
+globvar _DrawData draw_data;
 
-typedef struct _Cube
+// ===============================================
+
+static u32 _pack_color(v4 color)
 {
-    m4 model;
+    u32 packed = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        f32 c = color.d[i];
+        if (c < 0.0f) c = 0.0f;
+        if (c > 1.0f) c = 1.0f;
+        packed |= (u32)(c * 255.0f + 0.5f) << (i * 8);
+    }
+    return packed;
+}
 
-} _Cube;
+static E2R_UIInstanceList *_ui_target()
+{
+    return draw_data.ui_target ? draw_data.ui_target : &draw_data.ui_instance_list;
+}
 
-list_define_type(_UIQuadList, _UIQuad);
-list_define_type(_CubeList, _Cube);
+static inline void _emit_glyph(E2R_UIInstanceList *list, const E2R_Glyph *g, f32 pen_x, f32 pen_y, u32 color, u32 tex_index)
+{
+    list_append(list, ((InstanceUI){
+        .pos_min = V2(pen_x + g->pos_min_x, pen_y + g->pos_min_y),
+        .pos_max = V2(pen_x + g->pos_max_x, pen_y + g->pos_max_y),
+        .uv_min = V2(g->uv_min_x, g->uv_min_y),
+        .uv_max = V2(g->uv_max_x, g->uv_max_y),
+        .color = color,
+        .tex_index = tex_index
+    }));
+}
 
-typedef struct _DrawData
+static u32 _glyph_tex_index(E2R_FontHandle font)
 {
-    _UIQuadList ui_quad_list;
-    E2R_UIVertList ui_vert_list;
-    E2R_IndexList ui_index_list;
+    u32 tex_index = e2r_texture_get_shader_index(e2r_get_font_atlas_texture());
+    return e2r_font_is_sdf(font) ? tex_index | INSTANCE_UI_SDF_BIT : tex_index;
+}
 
-    _CubeList cube_list;
-    E2R_3DVertList cube_vert_list;
-    E2R_IndexList cube_index_list;
-    E2R_3DDrawCallList cube_draw_call_list;
+// Stops at the end of str, or at a newline when stop_at_newline is set; returns where it stopped
+static const char *_emit_glyphs(E2R_FontHandle font, const char *str, f32 *pen_x, f32 pen_y, u32 color, u32 tex_index, bool stop_at_newline)
+{
+    E2R_UIInstanceList *list = _ui_target();
+    f32 x = *pen_x;
 
-} _DrawData;
+    const char *c = str;
+    while (*c)
+    {
+        if (*c == '\n')
+        {
+            if (stop_at_newline) break;
+            c++;
+            continue;
+        }
 
-globvar _DrawData draw_data;
+        E2R_Glyph g = e2r_font_get_glyph(font, e2r_font_next_codepoint(&c));
+        if (g.has_quad) _emit_glyph(list, &g, x, pen_y, color, tex_index);
+        x += g.advance;
+    }
 
-// ===============================================
+    *pen_x = x;
+    return c;
+}
 
 static void _ui_get_atlas_q_verts(v2i cell_p, v2 out_verts[4])
 {
@@ -85,19 +126,19 @@ static void _ui_get_atlas_q_verts(v2i cell_p, v2 out_verts[4])
 
 void e2r_draw_quad(v2 pos, v2 size, v4 color)
 {
-    _UIQuadList *list = &draw_data.ui_quad_list;
+    E2R_UIInstanceList *list = _ui_target();
 
     v2 atlas_q_verts[4] = {};
     _ui_get_atlas_q_verts(V2I(0, 0), atlas_q_verts);
 
-    _UIQuad q =
+    InstanceUI q =
     {
         .pos_min = pos,
         .pos_max = v2_add(pos, size),
         .uv_min = atlas_q_verts[0],
         .uv_max = atlas_q_verts[2],
-        .color = color,
-        .tex_index = 0
+        .color = _pack_color(color),
+        .tex_index = e2r_texture_get_shader_index(e2r_get_ui_atlas_texture())
     };
 
     list_append(list, q);
@@ -105,161 +146,98 @@ void e2r_draw_quad(v2 pos, v2 size, v4 color)
 
 void e2r_draw_circle(v2 pos, v2 size, v4 color)
 {
-    _UIQuadList *list = &draw_data.ui_quad_list;
+    E2R_UIInstanceList *list = _ui_target();
 
     v2 atlas_q_verts[4] = {};
     _ui_get_atlas_q_verts(V2I(2, 0), atlas_q_verts);
 
-    _UIQuad q =
+    InstanceUI q =
     {
         .pos_min = pos,
         .pos_max = v2_add(pos, size),
         .uv_min = atlas_q_verts[0],
         .uv_max = atlas_q_verts[2],
-        .color = color,
-        .tex_index = 0
+        .color = _pack_color(color),
+        .tex_index = e2r_texture_get_shader_index(e2r_get_ui_atlas_texture())
     };
 
     list_append(list, q);
 }
 
-void e2r_draw_char(char ch, f32 *pen_x, f32 * pen_y, const FontAtlas *font_atlas, v4 color)
+void e2r_draw_char(u32 codepoint, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color)
 {
-    _UIQuadList *list = &draw_data.ui_quad_list;
-
-    f32 x = *pen_x;
-    f32 y = *pen_y + font_loader_get_ascender(font_atlas);
-
-    GlyphQuad q = font_loader_get_glyph_quad(font_atlas, ch, x, y);
-
-    _UIQuad text_quad =
+    E2R_Glyph g = e2r_font_get_glyph(font, codepoint);
+    if (g.has_quad)
     {
-        .pos_min = V2(q.screen_min_x, q.screen_max_y),
-        .pos_max = V2(q.screen_max_x, q.screen_min_y),
-        .uv_min = V2(q.tex_min_x, q.tex_max_y),
-        .uv_max = V2(q.tex_max_x, q.tex_min_y),
-        .color = color,
-        .tex_index = 1
-    };
-
-    *pen_x += font_loader_get_advance_x(font_atlas, ch);
-
-    list_append(list, text_quad);
+        _emit_glyph(_ui_target(), &g, *pen_x, *pen_y, _pack_color(color), _glyph_tex_index(font));
+    }
+    *pen_x += g.advance;
 }
 
-void e2r_draw_string(const char *str, f32 *pen_x, f32 *pen_y, const FontAtlas *font_atlas, v4 color)
+void e2r_draw_string(const char *str, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color)
 {
-    int len = strlen(str);
+    u32 packed_color = _pack_color(color);
+    u32 tex_index = _glyph_tex_index(font);
     f32 starting_x = *pen_x;
 
-    for (int i = 0; i < len; i++)
+    for (;;)
     {
-        if (str[i] != '\n')
-        {
-            e2r_draw_char(str[i], pen_x, pen_y, font_atlas, color);
-        }
-        else
-        {
-            *pen_y += font_loader_get_ascender(font_atlas);
-            *pen_x = starting_x;
-        }
+        str = _emit_glyphs(font, str, pen_x, *pen_y, packed_color, tex_index, true);
+        if (*str != '\n') break;
+        str++;
+        *pen_y += e2r_font_get_ascender(font);
+        *pen_x = starting_x;
     }
 }
 
-void e2r_draw_line(const char *str, f32 *pen_x, f32 *pen_y, const FontAtlas *font_atlas, v4 color)
+void e2r_draw_line(const char *str, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color)
 {
-    int len = strlen(str);
     f32 starting_x = *pen_x;
 
-    for (int i = 0; i < len; i++)
-    {
-        if (str[i] != '\n')
-        {
-            e2r_draw_char(str[i], pen_x, pen_y, font_atlas, color);
-        }
-    }
-    *pen_y += font_loader_get_ascender(font_atlas);
+    _emit_glyphs(font, str, pen_x, *pen_y, _pack_color(color), _glyph_tex_index(font), false);
+
+    *pen_y += e2r_font_get_ascender(font);
     *pen_x = starting_x;
 }
 
-E2R_UIRenderData e2r_get_ui_render_data()
+void e2r_draw_set_ui_target(E2R_UIInstanceList *target)
 {
-    _UIQuadList *ui_quad_list = &draw_data.ui_quad_list;
-    E2R_UIVertList *vert_list = &draw_data.ui_vert_list;
-    E2R_IndexList *index_list = &draw_data.ui_index_list;
+    draw_data.ui_target = target;
+}
 
-    const _UIQuad *quad;
-    list_iterate(ui_quad_list, quad_i ,quad)
+void e2r_draw_ui_instances(const InstanceUI *instances, u32 count, v2 offset)
+{
+    E2R_UIInstanceList *list = _ui_target();
+    u32 font_tex_index = e2r_texture_get_shader_index(e2r_get_font_atlas_texture());
+    for (u32 i = 0; i < count; i++)
     {
-        v2 min = quad->pos_min;
-        v2 max = quad->pos_max;
-
-        v3 pos[] =
-        {
-            V3(quad->pos_min.x, quad->pos_min.y, 0.0f),
-            V3(quad->pos_max.x, quad->pos_min.y, 0.0f),
-            V3(quad->pos_max.x, quad->pos_max.y, 0.0f),
-            V3(quad->pos_min.x, quad->pos_max.y, 0.0f)
-        };
+        InstanceUI q = instances[i];
+        q.pos_min = v2_add(q.pos_min, offset);
+        q.pos_max = v2_add(q.pos_max, offset);
+        list_append(list, q);
 
-        v2 uv[] =
-        {
-            V2(quad->uv_min.x, quad->uv_min.y),
-            V2(quad->uv_max.x, quad->uv_min.y),
-            V2(quad->uv_max.x, quad->uv_max.y),
-            V2(quad->uv_min.x, quad->uv_max.y)
-        };
-
-        u32 base_index = vert_list->size;
-
-        for (int i = 0; i < 4; i++)
-        {
-            VertexUI v =
-            {
-                .pos = pos[i],
-                .uv = uv[i],
-                .color = quad->color,
-                .tex_index = quad->tex_index
-            };
-            list_append(vert_list, v);
-        }
-
-        u32 indices[] = { 0, 1, 2, 0, 2, 3};
-        for (int i = 0; i < 6; i++)
-        {
-            list_append(index_list, indices[i] + base_index);
-        }
+        // Keeps the glyphs from being evicted while this frame still draws them
+        if ((q.tex_index & ~INSTANCE_UI_SDF_BIT) == font_tex_index) e2r_font_touch_atlas_uv(q.uv_min.y);
     }
+}
 
+E2R_UIRenderData e2r_get_ui_render_data()
+{
     return (E2R_UIRenderData){
-        .vert_list = vert_list,
-        .index_list = index_list
+        .instance_list = &draw_data.ui_instance_list
     };
 }
 
 void e2r_reset_ui_data()
 {
-    list_clear(&draw_data.ui_quad_list);
-    list_clear(&draw_data.ui_vert_list);
-    list_clear(&draw_data.ui_index_list);
+    list_clear(&draw_data.ui_instance_list);
 }
 
 // ===============================================
 
-void e2r_draw_cube(m4 model)
+static E2R_MeshHandle _get_cube_mesh()
 {
-    _Cube cube =
-    {
-        .model = model
-    };
-
-    list_append(&draw_data.cube_list, cube);
-}
-
-E2R_3DRenderData e2r_get_cubes_render_data()
-{
-    E2R_3DVertList *vert_list = &draw_data.cube_vert_list;
-    E2R_IndexList *index_list = &draw_data.cube_index_list;
+    if (draw_data.has_cube_mesh) return draw_data.cube_mesh;
 
     const Vertex3D verts[] =
     {
@@ -294,10 +272,6 @@ E2R_3DRenderData e2r_get_cubes_render_data()
         { V3(-0.5f,  0.5f,  0.5f), V3(-1.0f,  0.0f,  0.0f), V2(1.0f, 1.0f), V4(0.9f, 0.9f, 0.8f, 1.0f) }, // 22
         { V3(-0.5f,  0.5f, -0.5f), V3(-1.0f,  0.0f,  0.0f), V2(0.0f, 1.0f), V4(0.9f, 0.9f, 0.8f, 1.0f) }, // 23
     };
-    for (size_t i = 0; i < array_count(verts); i++)
-    {
-        list_append(vert_list, verts[i]);
-    }
 
     const VertIndex indices[] =
     {
@@ -308,35 +282,76 @@ E2R_3DRenderData e2r_get_cubes_render_data()
         16, 17, 18, 16, 18, 19, // e
         20, 21, 22, 20, 22, 23, // f
     };
-    for (size_t i = 0; i < array_count(indices); i++)
+
+    draw_data.cube_mesh = e2r_mesh_create(verts, array_count(verts), indices, array_count(indices));
+    draw_data.has_cube_mesh = true;
+
+    return draw_data.cube_mesh;
+}
+
+void e2r_draw_mesh(E2R_MeshHandle mesh, m4 model)
+{
+    e2r_draw_mesh_colored(mesh, model, V4(1.0f, 1.0f, 1.0f, 1.0f));
+}
+
+void e2r_draw_mesh_colored(E2R_MeshHandle mesh, m4 model, v4 color)
+{
+    e2r_draw_mesh_textured(mesh, model, color, e2r_get_default_texture());
+}
+
+void e2r_draw_mesh_textured(E2R_MeshHandle mesh, m4 model, v4 color, E2R_TextureHandle texture)
+{
+    if (mesh >= draw_data.mesh_instance_list_count)
     {
-        list_append(index_list, indices[i]);
+        u32 new_count = mesh + 1;
+        draw_data.mesh_instance_lists = xrealloc(draw_data.mesh_instance_lists, new_count * sizeof(draw_data.mesh_instance_lists[0]));
+        memset(draw_data.mesh_instance_lists + draw_data.mesh_instance_list_count, 0, (new_count - draw_data.mesh_instance_list_count) * sizeof(draw_data.mesh_instance_lists[0]));
+        draw_data.mesh_instance_list_count = new_count;
     }
 
-    return (E2R_3DRenderData){
-        .vert_list = vert_list,
-        .index_list = index_list
+    Instance3D instance =
+    {
+        .model = model,
+        .color = color,
+        .texture_index = e2r_texture_get_shader_index(texture)
     };
+
+    list_append(&draw_data.mesh_instance_lists[mesh], instance);
 }
 
-const E2R_3DDrawCallList *e2r_get_cubes_draw_calls()
+void e2r_draw_cube(m4 model)
 {
-    _Cube *cube;
-    list_iterate(&draw_data.cube_list, cube_i, cube)
+    e2r_draw_mesh(_get_cube_mesh(), model);
+}
+
+void e2r_draw_cube_colored(m4 model, v4 color)
+{
+    e2r_draw_mesh_colored(_get_cube_mesh(), model, color);
+}
+
+E2R_3DRenderData e2r_get_3d_render_data()
+{
+    // Normal matrices once per instance, so cubes.vert doesn't invert per vertex
+    for (u32 i = 0; i < draw_data.mesh_instance_list_count; i++)
     {
-        E2R_3DDrawCall draw_call =
-        {
-            .model = cube->model
-        };
-        list_append(&draw_data.cube_draw_call_list, draw_call);
+        E2R_3DInstanceList *instance_list = &draw_data.mesh_instance_lists[i];
+        if (instance_list->size == 0) continue;
+        m3_normal_from_m4_batch(
+            &instance_list->data[0].model, sizeof(Instance3D),
+            &instance_list->data[0].normal_matrix, sizeof(Instance3D),
+            instance_list->size);
     }
-    return &draw_data.cube_draw_call_list;
+
+    return (E2R_3DRenderData){
+        .mesh_instance_lists = draw_data.mesh_instance_lists,
+        .mesh_count = draw_data.mesh_instance_list_count
+    };
 }
 
-void e2r_reset_cubes_data()
+void e2r_reset_3d_data()
 {
-    list_clear(&draw_data.cube_list);
-    list_clear(&draw_data.cube_vert_list);
-    list_clear(&draw_data.cube_index_list);
-    list_clear(&draw_data.cube_draw_call_list);
+    for (u32 i = 0; i < draw_data.mesh_instance_list_count; i++)
+    {
+        list_clear(&draw_data.mesh_instance_lists[i]);
+    }
 }
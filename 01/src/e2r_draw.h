@@ -1,47 +1,49 @@
+#pragma once
+
 #include "common/types.h"
 #include "common/util.h"
 
-#include <font_loader.h>
-
+#include "e2r_core.h"
+#include "e2r_font.h"
 #include "vertex.h"
 
-list_define_type(E2R_UIVertList, VertexUI);
+list_define_type(E2R_UIInstanceList, InstanceUI);
 list_define_type(E2R_3DVertList, Vertex3D);
-list_define_type(E2R_IndexList, VertIndex);
 
 typedef struct E2R_UIRenderData
 {
-    const E2R_UIVertList *vert_list;
-    const E2R_IndexList *index_list;
+    const E2R_UIInstanceList *instance_list;
 
 } E2R_UIRenderData;
 
+list_define_type(E2R_3DInstanceList, Instance3D);
+
 typedef struct E2R_3DRenderData
 {
-    const E2R_3DVertList *vert_list;
-    const E2R_IndexList *index_list;
+    const E2R_3DInstanceList *mesh_instance_lists; // indexed by E2R_MeshHandle
+    u32 mesh_count;
 
 } E2R_3DRenderData;
 
-typedef struct E2R_3DDrawCall
-{
-    m4 model;
-
-} E2R_3DDrawCall;
-
-list_define_type(E2R_3DDrawCallList, E2R_3DDrawCall);
-
 void e2r_draw_quad(v2 pos, v2 size, v4 color);
 void e2r_draw_circle(v2 pos, v2 size, v4 color);
-void e2r_draw_char(char ch, f32 *pen_x, f32 * pen_y, const FontAtlas *font_atlas, v4 color);
-void e2r_draw_string(const char *str, f32 *pen_x, f32 *pen_y, const FontAtlas *font_atlas, v4 color);
-void e2r_draw_line(const char *str, f32 *pen_x, f32 *pen_y, const FontAtlas *font_atlas, v4 color);
+// Glyphs are rasterized into the font atlas on first use; str is UTF-8
+void e2r_draw_char(u32 codepoint, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color);
+void e2r_draw_string(const char *str, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color);
+void e2r_draw_line(const char *str, f32 *pen_x, f32 *pen_y, E2R_FontHandle font, v4 color);
+// Redirects the quads from the calls above into target, e.g. to cache them; NULL goes back to the frame's list
+void e2r_draw_set_ui_target(E2R_UIInstanceList *target);
+// Appends previously captured quads, moved by offset. Glyph quads go stale when the font atlas generation changes.
+void e2r_draw_ui_instances(const InstanceUI *instances, u32 count, v2 offset);
 E2R_UIRenderData e2r_get_ui_render_data();
 void e2r_reset_ui_data();
 
 // ============================================
 
+void e2r_draw_mesh(E2R_MeshHandle mesh, m4 model);
+void e2r_draw_mesh_colored(E2R_MeshHandle mesh, m4 model, v4 color);
+void e2r_draw_mesh_textured(E2R_MeshHandle mesh, m4 model, v4 color, E2R_TextureHandle texture);
 void e2r_draw_cube(m4 model);
-E2R_3DRenderData e2r_get_cubes_render_data();
-const E2R_3DDrawCallList *e2r_get_cubes_draw_calls();
-void e2r_reset_cubes_data();
+void e2r_draw_cube_colored(m4 model, v4 color);
+E2R_3DRenderData e2r_get_3d_render_data();
+void e2r_reset_3d_data();
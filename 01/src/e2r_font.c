@@ -0,0 +1,625 @@
+#include "e2r_font.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+#include "common/types.h"
+#include "common/util.h"
+#include "e2r_core.h"
+
+#define GLYPH_NONE 0xFFFFFFFFu
+#define ASCII_GLYPH_COUNT 128
+#define GLYPH_PADDING 1 // blank texels around every glyph, so linear filtering doesn't pick up its neighbours
+#define SHELF_HEIGHT_GRANULARITY 4
+#define INITIAL_GLYPH_MAP_CAPACITY 256
+#define INITIAL_ATLAS_PIXELS_CAPACITY (64 * 1024)
+#define SDF_PIXEL_HEIGHT 48.0f // size the distance fields are rasterized at, whatever size they're drawn at
+#define SDF_PADDING 6 // texels of falloff around the outline
+#define SDF_ON_EDGE_VALUE 128
+
+typedef struct _FontFace
+{
+    char *path;
+    u8 *data;
+    stbtt_fontinfo info;
+
+} _FontFace;
+
+list_define_type(_FontFaceList, _FontFace);
+
+typedef struct _Font
+{
+    u32 face;
+    f32 scale;
+    f32 ascender;
+    bool is_sdf;
+    // SDF fonts draw the glyphs of one SDF_PIXEL_HEIGHT font per face, scaled by glyph_scale.
+    // Other fonts own their glyphs: glyph_source is the font itself and glyph_scale is 1.
+    u32 glyph_source;
+    f32 glyph_scale;
+    // Indexed by codepoint, so ASCII text costs one load per character to find its cached glyph.
+    // GLYPH_NONE until first use; the rest go through the glyph map.
+    u32 ascii_glyphs[ASCII_GLYPH_COUNT];
+
+} _Font;
+
+list_define_type(_FontList, _Font);
+
+typedef struct _GlyphEntry
+{
+    E2R_Glyph glyph;
+    u64 key; // font << 32 | codepoint
+    u32 font;
+    int stb_glyph;
+    int w, h; // bitmap size, zero for blank glyphs
+    u32 shelf; // GLYPH_NONE while it isn't in the atlas
+
+} _GlyphEntry;
+
+list_define_type(_GlyphEntryList, _GlyphEntry);
+
+typedef struct _Shelf
+{
+    u32 y, h;
+    u32 x; // next free column
+    u64 last_used_frame;
+
+} _Shelf;
+
+list_define_type(_ShelfList, _Shelf);
+
+list_define_type(_AtlasUpdateList, E2R_GlyphAtlasUpdate);
+list_define_type(_ByteList, u8);
+
+typedef struct _FontCtx
+{
+    _FontFaceList faces;
+    _FontList fonts;
+    _GlyphEntryList glyphs;
+
+    // Open addressing, glyph indices for codepoints outside the ASCII tables
+    u32 *glyph_map;
+    u32 glyph_map_capacity; // power of two
+    u32 glyph_map_count;
+
+    // Shelf packing: rows of glyphs stacked from the top, evicted whole
+    u32 atlas_size;
+    _ShelfList shelves;
+    u32 next_shelf_y;
+    u32 *shelf_of_row; // GLYPH_NONE below the last shelf
+    u32 generation;
+    u64 missing_glyph_frame; // last frame a glyph didn't fit and bumped the generation, UINT64_MAX if never
+    bool has_warned_full;
+
+    _AtlasUpdateList updates;
+    _ByteList pixels;
+
+} _FontCtx;
+
+globvar _FontCtx font_ctx;
+
+// ===============================================
+
+static inline u32 _hash_key(u64 key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return (u32)key;
+}
+
+static void _glyph_map_insert(u32 glyph)
+{
+    u32 mask = font_ctx.glyph_map_capacity - 1;
+    u32 slot = _hash_key(font_ctx.glyphs.data[glyph].key) & mask;
+    while (font_ctx.glyph_map[slot] != GLYPH_NONE) slot = (slot + 1) & mask;
+    font_ctx.glyph_map[slot] = glyph;
+    font_ctx.glyph_map_count++;
+}
+
+static void _glyph_map_grow()
+{
+    u32 capacity = font_ctx.glyph_map_capacity ? font_ctx.glyph_map_capacity * 2 : INITIAL_GLYPH_MAP_CAPACITY;
+    free(font_ctx.glyph_map);
+    font_ctx.glyph_map = xmalloc(capacity * sizeof(font_ctx.glyph_map[0]));
+    memset(font_ctx.glyph_map, 0xFF, capacity * sizeof(font_ctx.glyph_map[0]));
+    font_ctx.glyph_map_capacity = capacity;
+    font_ctx.glyph_map_count = 0;
+
+    const _GlyphEntry *entry;
+    list_iterate(&font_ctx.glyphs, glyph_i, entry)
+    {
+        if ((entry->key & 0xFFFFFFFFu) >= ASCII_GLYPH_COUNT) _glyph_map_insert((u32)glyph_i);
+    }
+}
+
+// Metrics only; the atlas placement happens on the first e2r_font_get_glyph
+static u32 _add_glyph(E2R_FontHandle font_handle, u32 codepoint)
+{
+    const _Font *font = &font_ctx.fonts.data[font_handle];
+    const stbtt_fontinfo *info = &font_ctx.faces.data[font->face].info;
+
+    int stb_glyph = stbtt_FindGlyphIndex(info, (int)codepoint);
+    int advance, left_side_bearing;
+    stbtt_GetGlyphHMetrics(info, stb_glyph, &advance, &left_side_bearing);
+    int x0, y0, x1, y1;
+    stbtt_GetGlyphBitmapBox(info, stb_glyph, font->scale, font->scale, &x0, &y0, &x1, &y1);
+    if (font->is_sdf && x1 > x0 && y1 > y0)
+    {
+        // Matches the bitmap stbtt_GetGlyphSDF makes
+        x0 -= SDF_PADDING;
+        y0 -= SDF_PADDING;
+        x1 += SDF_PADDING;
+        y1 += SDF_PADDING;
+    }
+
+    _GlyphEntry entry =
+    {
+        .glyph =
+        {
+            .advance = advance * font->scale,
+            .pos_min_x = (f32)x0,
+            .pos_min_y = font->ascender + y0,
+            .pos_max_x = (f32)x1,
+            .pos_max_y = font->ascender + y1
+        },
+        .key = ((u64)font_handle << 32) | codepoint,
+        .font = font_handle,
+        .stb_glyph = stb_glyph,
+        .w = x1 > x0 ? x1 - x0 : 0,
+        .h = y1 > y0 ? y1 - y0 : 0,
+        .shelf = GLYPH_NONE
+    };
+    if (entry.w == 0 || entry.h == 0) entry.w = entry.h = 0;
+
+    list_append(&font_ctx.glyphs, entry);
+    return (u32)(font_ctx.glyphs.size - 1);
+}
+
+static u32 _find_glyph(E2R_FontHandle font_handle, u32 codepoint)
+{
+    _Font *font = &font_ctx.fonts.data[font_handle];
+    if (codepoint < ASCII_GLYPH_COUNT)
+    {
+        if (font->ascii_glyphs[codepoint] == GLYPH_NONE) font->ascii_glyphs[codepoint] = _add_glyph(font_handle, codepoint);
+        return font->ascii_glyphs[codepoint];
+    }
+
+    u64 key = ((u64)font_handle << 32) | codepoint;
+    if (font_ctx.glyph_map_capacity > 0)
+    {
+        u32 mask = font_ctx.glyph_map_capacity - 1;
+        for (u32 slot = _hash_key(key) & mask; font_ctx.glyph_map[slot] != GLYPH_NONE; slot = (slot + 1) & mask)
+        {
+            if (font_ctx.glyphs.data[font_ctx.glyph_map[slot]].key == key) return font_ctx.glyph_map[slot];
+        }
+    }
+
+    u32 glyph = _add_glyph(font_handle, codepoint);
+    if ((font_ctx.glyph_map_count + 1) * 2 > font_ctx.glyph_map_capacity) _glyph_map_grow();
+    else _glyph_map_insert(glyph);
+    return glyph;
+}
+
+// ===============================================
+
+static void _evict_shelf(u32 shelf_index)
+{
+    _Shelf *shelf = &font_ctx.shelves.data[shelf_index];
+    shelf->x = 0;
+
+    _GlyphEntry *entry;
+    list_iterate(&font_ctx.glyphs, glyph_i, entry)
+    {
+        if (entry->shelf == shelf_index)
+        {
+            entry->shelf = GLYPH_NONE;
+            entry->glyph.has_quad = false;
+        }
+    }
+
+    // Updates that haven't reached the GPU yet would land on top of the new glyphs
+    size_t kept_count = 0;
+    const E2R_GlyphAtlasUpdate *update;
+    list_iterate(&font_ctx.updates, update_i, update)
+    {
+        if (update->y < shelf->y || update->y >= shelf->y + shelf->h)
+        {
+            font_ctx.updates.data[kept_count++] = *update;
+        }
+    }
+    font_ctx.updates.size = kept_count;
+
+    font_ctx.generation++;
+}
+
+static u32 _find_shelf(u32 w, u32 h)
+{
+    u32 best = GLYPH_NONE;
+    const _Shelf *shelf;
+    list_iterate(&font_ctx.shelves, shelf_i, shelf)
+    {
+        if (shelf->h >= h && shelf->x + w <= font_ctx.atlas_size &&
+            (best == GLYPH_NONE || shelf->h < font_ctx.shelves.data[best].h))
+        {
+            best = (u32)shelf_i;
+        }
+    }
+
+    // Much taller shelves waste space, so a new one is opened while there's room for it
+    u32 shelf_h = (h + SHELF_HEIGHT_GRANULARITY - 1) / SHELF_HEIGHT_GRANULARITY * SHELF_HEIGHT_GRANULARITY;
+    bool is_wasteful = best != GLYPH_NONE && font_ctx.shelves.data[best].h > shelf_h * 3 / 2;
+    if ((best == GLYPH_NONE || is_wasteful) && font_ctx.next_shelf_y + shelf_h <= font_ctx.atlas_size)
+    {
+        _Shelf new_shelf = { .y = font_ctx.next_shelf_y, .h = shelf_h };
+        list_append(&font_ctx.shelves, new_shelf);
+        best = (u32)(font_ctx.shelves.size - 1);
+        for (u32 row = new_shelf.y; row < new_shelf.y + new_shelf.h; row++)
+        {
+            font_ctx.shelf_of_row[row] = best;
+        }
+        font_ctx.next_shelf_y += shelf_h;
+    }
+    if (best != GLYPH_NONE) return best;
+
+    // Full: evict the least recently used shelf that's tall enough. Ones used this frame may already be drawn from.
+    u64 current_frame = e2r_get_current_frame();
+    list_iterate(&font_ctx.shelves, shelf_i, shelf)
+    {
+        if (shelf->h >= h && shelf->last_used_frame < current_frame &&
+            (best == GLYPH_NONE || shelf->last_used_frame < font_ctx.shelves.data[best].last_used_frame))
+        {
+            best = (u32)shelf_i;
+        }
+    }
+    if (best != GLYPH_NONE) _evict_shelf(best);
+    return best;
+}
+
+static u8 *_alloc_update_pixels(size_t size, size_t *out_offset)
+{
+    _ByteList *pixels = &font_ctx.pixels;
+    if (pixels->size + size > pixels->cap)
+    {
+        size_t cap = pixels->cap ? pixels->cap : INITIAL_ATLAS_PIXELS_CAPACITY;
+        while (pixels->size + size > cap) cap *= 2;
+        pixels->data = xrealloc(pixels->data, cap);
+        pixels->cap = cap;
+    }
+    *out_offset = pixels->size;
+    pixels->size += size;
+    return pixels->data + *out_offset;
+}
+
+static bool _place_glyph(_GlyphEntry *entry)
+{
+    u32 w = entry->w + 2 * GLYPH_PADDING;
+    u32 h = entry->h + 2 * GLYPH_PADDING;
+    // Wider than the atlas would overrun a fresh or evicted shelf, so it's turned away like a full atlas
+    if (w > font_ctx.atlas_size || h > font_ctx.atlas_size) return false;
+
+    u32 shelf_index = _find_shelf(w, h);
+    if (shelf_index == GLYPH_NONE) return false;
+
+    _Shelf *shelf = &font_ctx.shelves.data[shelf_index];
+    u32 x = shelf->x;
+    u32 y = shelf->y;
+    shelf->x += w;
+
+    const _Font *font = &font_ctx.fonts.data[entry->font];
+    const stbtt_fontinfo *info = &font_ctx.faces.data[font->face].info;
+
+    // Includes the blank padding, so whatever was evicted from here is cleared
+    size_t pixel_offset;
+    u8 *pixels = _alloc_update_pixels((size_t)w * h, &pixel_offset);
+    memset(pixels, 0, (size_t)w * h);
+    u8 *glyph_pixels = pixels + (size_t)GLYPH_PADDING * w + GLYPH_PADDING;
+
+    if (font->is_sdf)
+    {
+        int sdf_w, sdf_h, x_offset, y_offset;
+        u8 *sdf = stbtt_GetGlyphSDF(info, font->scale, entry->stb_glyph, SDF_PADDING, SDF_ON_EDGE_VALUE,
+            (f32)SDF_ON_EDGE_VALUE / SDF_PADDING, &sdf_w, &sdf_h, &x_offset, &y_offset);
+        bassert(sdf && sdf_w == entry->w && sdf_h == entry->h);
+        for (int row = 0; row < entry->h; row++)
+        {
+            memcpy(glyph_pixels + (size_t)row * w, sdf + (size_t)row * sdf_w, sdf_w);
+        }
+        stbtt_FreeSDF(sdf, info->userdata);
+    }
+    else
+    {
+        stbtt_MakeGlyphBitmap(info, glyph_pixels, entry->w, entry->h, w, font->scale, font->scale, entry->stb_glyph);
+    }
+
+    E2R_GlyphAtlasUpdate update = { .x = x, .y = y, .w = w, .h = h, .pixel_offset = pixel_offset };
+    list_append(&font_ctx.updates, update);
+
+    f32 inv_size = 1.0f / font_ctx.atlas_size;
+    entry->glyph.uv_min_x = (x + GLYPH_PADDING) * inv_size;
+    entry->glyph.uv_min_y = (y + GLYPH_PADDING) * inv_size;
+    entry->glyph.uv_max_x = (x + GLYPH_PADDING + entry->w) * inv_size;
+    entry->glyph.uv_max_y = (y + GLYPH_PADDING + entry->h) * inv_size;
+    entry->glyph.has_quad = true;
+    entry->shelf = shelf_index;
+    return true;
+}
+
+// ===============================================
+
+void e2r_font_init(u32 atlas_size)
+{
+    font_ctx.atlas_size = atlas_size;
+    font_ctx.missing_glyph_frame = UINT64_MAX;
+    font_ctx.shelf_of_row = xmalloc(atlas_size * sizeof(font_ctx.shelf_of_row[0]));
+    memset(font_ctx.shelf_of_row, 0xFF, atlas_size * sizeof(font_ctx.shelf_of_row[0]));
+}
+
+void e2r_font_destroy()
+{
+    _FontFace *face;
+    list_iterate(&font_ctx.faces, face_i, face)
+    {
+        free(face->path);
+        free(face->data);
+    }
+    list_free(&font_ctx.faces);
+    list_free(&font_ctx.fonts);
+    list_free(&font_ctx.glyphs);
+    free(font_ctx.glyph_map);
+    list_free(&font_ctx.shelves);
+    free(font_ctx.shelf_of_row);
+    list_free(&font_ctx.updates);
+    list_free(&font_ctx.pixels);
+
+    font_ctx = (_FontCtx){};
+}
+
+u32 e2r_font_get_atlas_size()
+{
+    return font_ctx.atlas_size;
+}
+
+static u32 _load_face(const char *path)
+{
+    const _FontFace *face_it;
+    list_iterate(&font_ctx.faces, face_i, face_it)
+    {
+        if (strcmp(face_it->path, path) == 0) return (u32)face_i;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) fatal("Failed to open font %s", path);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    u8 *data = xmalloc(size);
+    if (fread(data, 1, size, file) != (size_t)size) fatal("Failed to read font %s", path);
+    fclose(file);
+
+    _FontFace face = { .path = xstrdup(path), .data = data };
+    if (!stbtt_InitFont(&face.info, data, stbtt_GetFontOffsetForIndex(data, 0))) fatal("Failed to parse font %s", path);
+    list_append(&font_ctx.faces, face);
+    return (u32)(font_ctx.faces.size - 1);
+}
+
+static E2R_FontHandle _add_font(u32 face, f32 pixel_height, bool is_sdf, u32 glyph_source, f32 glyph_scale)
+{
+    const stbtt_fontinfo *info = &font_ctx.faces.data[face].info;
+    int ascent, descent, line_gap;
+    stbtt_GetFontVMetrics(info, &ascent, &descent, &line_gap);
+
+    E2R_FontHandle handle = (E2R_FontHandle)font_ctx.fonts.size;
+    _Font font =
+    {
+        .face = face,
+        .scale = stbtt_ScaleForPixelHeight(info, pixel_height),
+        .is_sdf = is_sdf,
+        .glyph_source = glyph_source == GLYPH_NONE ? handle : glyph_source,
+        .glyph_scale = glyph_scale
+    };
+    font.ascender = ascent * font.scale;
+    memset(font.ascii_glyphs, 0xFF, sizeof(font.ascii_glyphs));
+
+    list_append(&font_ctx.fonts, font);
+    return handle;
+}
+
+E2R_FontHandle e2r_font_create(const char *path, f32 pixel_height, u32 flags)
+{
+    u32 face = _load_face(path);
+    if (!(flags & E2R_FONT_SDF)) return _add_font(face, pixel_height, false, GLYPH_NONE, 1.0f);
+
+    u32 sdf_source = GLYPH_NONE;
+    const _Font *font_it;
+    list_iterate(&font_ctx.fonts, font_i, font_it)
+    {
+        if (font_it->face == face && font_it->is_sdf && font_it->glyph_source == font_i) sdf_source = (u32)font_i;
+    }
+    if (sdf_source == GLYPH_NONE) sdf_source = _add_font(face, SDF_PIXEL_HEIGHT, true, GLYPH_NONE, 1.0f);
+
+    return _add_font(face, pixel_height, true, sdf_source, pixel_height / SDF_PIXEL_HEIGHT);
+}
+
+f32 e2r_font_get_ascender(E2R_FontHandle font)
+{
+    return font_ctx.fonts.data[font].ascender;
+}
+
+bool e2r_font_is_sdf(E2R_FontHandle font)
+{
+    return font_ctx.fonts.data[font].is_sdf;
+}
+
+// Bytes in the UTF-8 sequence the lead byte starts, 0 if it can't start one
+static int _utf8_sequence_length(u8 lead)
+{
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 0;
+}
+
+u32 e2r_font_next_codepoint(const char **str)
+{
+    const u8 *s = (const u8 *)*str;
+    int length = _utf8_sequence_length(s[0]);
+    if (length == 0)
+    {
+        *str += 1;
+        return 0xFFFD;
+    }
+    static const u8 lead_masks[] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+    u32 codepoint = s[0] & lead_masks[length];
+
+    for (int i = 1; i < length; i++)
+    {
+        // Also stops at the terminator
+        if ((s[i] & 0xC0) != 0x80)
+        {
+            *str += i;
+            return 0xFFFD;
+        }
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+
+    *str += length;
+    return codepoint;
+}
+
+static E2R_Glyph _scale_glyph(const E2R_Glyph *g, f32 scale)
+{
+    if (scale == 1.0f) return *g;
+
+    return (E2R_Glyph){
+        .advance = g->advance * scale,
+        .pos_min_x = g->pos_min_x * scale,
+        .pos_min_y = g->pos_min_y * scale,
+        .pos_max_x = g->pos_max_x * scale,
+        .pos_max_y = g->pos_max_y * scale,
+        .uv_min_x = g->uv_min_x,
+        .uv_min_y = g->uv_min_y,
+        .uv_max_x = g->uv_max_x,
+        .uv_max_y = g->uv_max_y,
+        .has_quad = g->has_quad
+    };
+}
+
+E2R_Glyph e2r_font_get_glyph(E2R_FontHandle font_handle, u32 codepoint)
+{
+    const _Font *font = &font_ctx.fonts.data[font_handle];
+    _GlyphEntry *entry = &font_ctx.glyphs.data[_find_glyph(font->glyph_source, codepoint)];
+    if (entry->w == 0) return _scale_glyph(&entry->glyph, font->glyph_scale);
+
+    if (entry->shelf == GLYPH_NONE)
+    {
+        if (!_place_glyph(entry))
+        {
+            if (!font_ctx.has_warned_full)
+            {
+                warning("Glyph atlas is full with glyphs used this frame, skipping U+%04X", codepoint);
+                font_ctx.has_warned_full = true;
+            }
+            // Anything cached this frame is missing the glyph, so it has to be rebuilt once there's room.
+            // Once a frame is enough, more bumps would only rebuild the same caches again.
+            u64 current_frame = e2r_get_current_frame();
+            if (font_ctx.missing_glyph_frame != current_frame)
+            {
+                font_ctx.missing_glyph_frame = current_frame;
+                font_ctx.generation++;
+            }
+            return _scale_glyph(&entry->glyph, font->glyph_scale);
+        }
+        font_ctx.has_warned_full = false; // warn again the next time it fills up
+    }
+
+    font_ctx.shelves.data[entry->shelf].last_used_frame = e2r_get_current_frame();
+    return _scale_glyph(&entry->glyph, font->glyph_scale);
+}
+
+E2R_TextRect e2r_font_get_text_rect(E2R_FontHandle font_handle, const char *str)
+{
+    const _Font *font = &font_ctx.fonts.data[font_handle];
+    E2R_TextRect rect = {};
+    bool is_empty = true;
+    f32 pen_x = 0.0f;
+    while (*str)
+    {
+        u32 codepoint = e2r_font_next_codepoint(&str);
+        if (codepoint == '\n') continue;
+
+        const _GlyphEntry *entry = &font_ctx.glyphs.data[_find_glyph(font->glyph_source, codepoint)];
+        E2R_Glyph g = _scale_glyph(&entry->glyph, font->glyph_scale);
+        if (entry->w > 0)
+        {
+            f32 min_x = pen_x + g.pos_min_x;
+            f32 max_x = pen_x + g.pos_max_x;
+            if (is_empty)
+            {
+                rect = (E2R_TextRect){ min_x, g.pos_min_y, max_x, g.pos_max_y };
+                is_empty = false;
+            }
+            else
+            {
+                if (min_x < rect.min_x) rect.min_x = min_x;
+                if (g.pos_min_y < rect.min_y) rect.min_y = g.pos_min_y;
+                if (max_x > rect.max_x) rect.max_x = max_x;
+                if (g.pos_max_y > rect.max_y) rect.max_y = g.pos_max_y;
+            }
+        }
+        pen_x += g.advance;
+    }
+    return rect;
+}
+
+f32 e2r_font_get_text_width(E2R_FontHandle font_handle, const char *str, int byte_count)
+{
+    const _Font *font = &font_ctx.fonts.data[font_handle];
+    const char *end = str + byte_count;
+    f32 width = 0.0f;
+    while (*str && str < end)
+    {
+        // A sequence that starts inside the range but runs past it belongs to the next character
+        int length = _utf8_sequence_length((u8)*str);
+        if (str + (length ? length : 1) > end) break;
+
+        u32 codepoint = e2r_font_next_codepoint(&str);
+        if (codepoint == '\n') continue;
+        width += font_ctx.glyphs.data[_find_glyph(font->glyph_source, codepoint)].glyph.advance;
+    }
+    return width * font->glyph_scale;
+}
+
+u32 e2r_font_get_atlas_generation()
+{
+    return font_ctx.generation;
+}
+
+void e2r_font_touch_atlas_uv(f32 uv_y)
+{
+    u32 row = (u32)(uv_y * font_ctx.atlas_size);
+    if (row >= font_ctx.atlas_size) return;
+
+    u32 shelf = font_ctx.shelf_of_row[row];
+    if (shelf != GLYPH_NONE) font_ctx.shelves.data[shelf].last_used_frame = e2r_get_current_frame();
+}
+
+E2R_GlyphAtlasUpdates e2r_font_get_atlas_updates()
+{
+    return (E2R_GlyphAtlasUpdates){
+        .updates = font_ctx.updates.data,
+        .update_count = (u32)font_ctx.updates.size,
+        .pixels = font_ctx.pixels.data,
+        .pixel_size = font_ctx.pixels.size
+    };
+}
+
+void e2r_font_clear_atlas_updates()
+{
+    list_clear(&font_ctx.updates);
+    list_clear(&font_ctx.pixels);
+}
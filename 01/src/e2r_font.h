@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "common/types.h"
+
+// A face at one pixel size. Handles created from the same file share its data.
+typedef u32 E2R_FontHandle;
+
+typedef enum E2R_FontFlags
+{
+    E2R_FONT_SDF = 1 << 0, // glyphs are distance fields rasterized once per face and scaled to every size
+
+} E2R_FontFlags;
+
+// Positions are relative to the pen, with the baseline at pen y + ascender
+typedef struct E2R_Glyph
+{
+    f32 advance;
+    f32 pos_min_x, pos_min_y, pos_max_x, pos_max_y;
+    f32 uv_min_x, uv_min_y, uv_max_x, uv_max_y;
+    bool has_quad; // false for blank glyphs, and for a glyph that didn't fit into the atlas this frame
+
+} E2R_Glyph;
+
+typedef struct E2R_TextRect
+{
+    f32 min_x, min_y, max_x, max_y;
+
+} E2R_TextRect;
+
+// A region of the glyph atlas rasterized since the last e2r_font_clear_atlas_updates; pixels are R8, tightly packed
+typedef struct E2R_GlyphAtlasUpdate
+{
+    u32 x, y, w, h;
+    size_t pixel_offset;
+
+} E2R_GlyphAtlasUpdate;
+
+typedef struct E2R_GlyphAtlasUpdates
+{
+    const E2R_GlyphAtlasUpdate *updates;
+    u32 update_count;
+    const u8 *pixels;
+    size_t pixel_size;
+
+} E2R_GlyphAtlasUpdates;
+
+// Glyphs are rasterized into one atlas_size x atlas_size atlas on first use. When it is full, the least recently
+// used shelf of glyphs is evicted, so the atlas never grows.
+void e2r_font_init(u32 atlas_size);
+void e2r_font_destroy();
+u32 e2r_font_get_atlas_size();
+
+E2R_FontHandle e2r_font_create(const char *path, f32 pixel_height, u32 flags); // E2R_FontFlags
+f32 e2r_font_get_ascender(E2R_FontHandle font);
+bool e2r_font_is_sdf(E2R_FontHandle font);
+
+// Decodes one UTF-8 sequence and advances *str past it; malformed bytes decode to U+FFFD
+u32 e2r_font_next_codepoint(const char **str);
+
+// Rasterizes the glyph if it isn't in the atlas and marks it used this frame
+E2R_Glyph e2r_font_get_glyph(E2R_FontHandle font, u32 codepoint);
+// Measuring only reads metrics, nothing is rasterized. Newlines are skipped.
+// Union of the glyph quads of str drawn with the pen at the origin
+E2R_TextRect e2r_font_get_text_rect(E2R_FontHandle font, const char *str);
+// Sum of advances over the first byte_count bytes of str (or up to its end)
+f32 e2r_font_get_text_width(E2R_FontHandle font, const char *str, int byte_count);
+
+// Changes whenever glyphs may have moved or gone missing in the atlas; quads built before then are stale
+u32 e2r_font_get_atlas_generation();
+// Marks the atlas shelf under uv as used this frame, for glyph quads replayed without e2r_font_get_glyph
+void e2r_font_touch_atlas_uv(f32 uv_y);
+
+E2R_GlyphAtlasUpdates e2r_font_get_atlas_updates();
+void e2r_font_clear_atlas_updates();
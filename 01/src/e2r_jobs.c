@@ -0,0 +1,192 @@
+#include "e2r_jobs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "common/types.h"
+#include "common/util.h"
+
+typedef struct _JobsCtx
+{
+    pthread_t *workers;
+    u32 worker_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    bool quit;
+
+    // Current parallel_for; workers only join while has_job is set
+    bool is_pending;
+    bool has_job;
+    u64 generation;
+    u32 active_workers;
+    E2R_JobRangeFn fn;
+    void *user_data;
+    u32 count;
+    u32 batch_size;
+    u32 batch_count;
+    atomic_uint next_batch;
+    atomic_uint done_batches;
+
+} _JobsCtx;
+
+globvar _JobsCtx jobs_ctx;
+
+// ===============================================
+
+static void _run_batches()
+{
+    for (;;)
+    {
+        u32 batch = atomic_fetch_add(&jobs_ctx.next_batch, 1);
+        if (batch >= jobs_ctx.batch_count) break;
+
+        u32 start = batch * jobs_ctx.batch_size;
+        u32 end = start + jobs_ctx.batch_size;
+        if (end > jobs_ctx.count) end = jobs_ctx.count;
+
+        jobs_ctx.fn(jobs_ctx.user_data, start, end);
+
+        atomic_fetch_add(&jobs_ctx.done_batches, 1);
+    }
+}
+
+static void *_worker_main(void *arg)
+{
+    (void)arg;
+    u64 seen_generation = 0;
+
+    pthread_mutex_lock(&jobs_ctx.mutex);
+    for (;;)
+    {
+        while (!jobs_ctx.quit && jobs_ctx.generation == seen_generation)
+        {
+            pthread_cond_wait(&jobs_ctx.work_cond, &jobs_ctx.mutex);
+        }
+        if (jobs_ctx.quit) break;
+
+        seen_generation = jobs_ctx.generation;
+        if (!jobs_ctx.has_job) continue;
+
+        jobs_ctx.active_workers++;
+        pthread_mutex_unlock(&jobs_ctx.mutex);
+
+        _run_batches();
+
+        pthread_mutex_lock(&jobs_ctx.mutex);
+        jobs_ctx.active_workers--;
+        pthread_cond_signal(&jobs_ctx.done_cond);
+    }
+    pthread_mutex_unlock(&jobs_ctx.mutex);
+
+    return NULL;
+}
+
+// ===============================================
+
+void e2r_jobs_init(u32 worker_count)
+{
+    if (worker_count == 0)
+    {
+        long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = core_count > 1 ? (u32)(core_count - 1) : 0;
+    }
+
+    pthread_mutex_init(&jobs_ctx.mutex, NULL);
+    pthread_cond_init(&jobs_ctx.work_cond, NULL);
+    pthread_cond_init(&jobs_ctx.done_cond, NULL);
+
+    jobs_ctx.worker_count = worker_count;
+    jobs_ctx.workers = xmalloc((worker_count > 0 ? worker_count : 1) * sizeof(jobs_ctx.workers[0]));
+    for (u32 i = 0; i < worker_count; i++)
+    {
+        if (pthread_create(&jobs_ctx.workers[i], NULL, _worker_main, NULL) != 0) fatal("Failed to create worker thread");
+    }
+}
+
+void e2r_jobs_destroy()
+{
+    pthread_mutex_lock(&jobs_ctx.mutex);
+    jobs_ctx.quit = true;
+    pthread_cond_broadcast(&jobs_ctx.work_cond);
+    pthread_mutex_unlock(&jobs_ctx.mutex);
+
+    for (u32 i = 0; i < jobs_ctx.worker_count; i++)
+    {
+        pthread_join(jobs_ctx.workers[i], NULL);
+    }
+    free(jobs_ctx.workers);
+
+    pthread_cond_destroy(&jobs_ctx.done_cond);
+    pthread_cond_destroy(&jobs_ctx.work_cond);
+    pthread_mutex_destroy(&jobs_ctx.mutex);
+
+    jobs_ctx = (_JobsCtx){};
+}
+
+u32 e2r_jobs_get_worker_count()
+{
+    return jobs_ctx.worker_count;
+}
+
+void e2r_jobs_parallel_for(u32 count, u32 batch_size, E2R_JobRangeFn fn, void *user_data)
+{
+    if (count == 0) return;
+    if (batch_size == 0) batch_size = 1;
+
+    u32 batch_count = (count + batch_size - 1) / batch_size;
+    if (jobs_ctx.worker_count == 0 || batch_count == 1)
+    {
+        for (u32 start = 0; start < count; start += batch_size)
+        {
+            u32 end = start + batch_size;
+            fn(user_data, start, end < count ? end : count);
+        }
+        return;
+    }
+
+    e2r_jobs_begin_parallel_for(count, batch_size, fn, user_data);
+    e2r_jobs_wait();
+}
+
+void e2r_jobs_begin_parallel_for(u32 count, u32 batch_size, E2R_JobRangeFn fn, void *user_data)
+{
+    assert(!jobs_ctx.is_pending);
+    if (batch_size == 0) batch_size = 1;
+
+    pthread_mutex_lock(&jobs_ctx.mutex);
+    jobs_ctx.fn = fn;
+    jobs_ctx.user_data = user_data;
+    jobs_ctx.count = count;
+    jobs_ctx.batch_size = batch_size;
+    jobs_ctx.batch_count = (count + batch_size - 1) / batch_size;
+    atomic_store(&jobs_ctx.next_batch, 0);
+    atomic_store(&jobs_ctx.done_batches, 0);
+    jobs_ctx.is_pending = true;
+    // Without workers everything runs in e2r_jobs_wait
+    if (jobs_ctx.worker_count > 0)
+    {
+        jobs_ctx.has_job = true;
+        jobs_ctx.generation++;
+        pthread_cond_broadcast(&jobs_ctx.work_cond);
+    }
+    pthread_mutex_unlock(&jobs_ctx.mutex);
+}
+
+void e2r_jobs_wait()
+{
+    if (!jobs_ctx.is_pending) return;
+
+    _run_batches();
+
+    pthread_mutex_lock(&jobs_ctx.mutex);
+    while (atomic_load(&jobs_ctx.done_batches) < jobs_ctx.batch_count || jobs_ctx.active_workers > 0)
+    {
+        pthread_cond_wait(&jobs_ctx.done_cond, &jobs_ctx.mutex);
+    }
+    jobs_ctx.has_job = false;
+    jobs_ctx.is_pending = false;
+    pthread_mutex_unlock(&jobs_ctx.mutex);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "common/types.h"
+
+typedef void (*E2R_JobRangeFn)(void *user_data, u32 start, u32 end);
+
+// worker_count 0 picks one worker per core, minus the calling thread
+void e2r_jobs_init(u32 worker_count);
+void e2r_jobs_destroy();
+u32 e2r_jobs_get_worker_count();
+
+// Splits [0, count) into batches, runs them on the workers and the calling thread, returns once all are done
+void e2r_jobs_parallel_for(u32 count, u32 batch_size, E2R_JobRangeFn fn, void *user_data);
+
+// Same split, but returns right away so the calling thread can do other work; e2r_jobs_wait joins in and blocks until done.
+// Only one job may be pending at a time.
+void e2r_jobs_begin_parallel_for(u32 count, u32 batch_size, E2R_JobRangeFn fn, void *user_data);
+void e2r_jobs_wait();
@@ -1,6 +1,7 @@
 #include "e2r_ui.h"
 
 #include <limits.h>
+#include <string.h>
 
 #include "common/lin_math.h"
 #include "common/types.h"
@@ -9,11 +10,91 @@
 #include "e2r_draw.h"
 #include "e2r_input.h"
 
+#define HIT_GRID_CELL_SIZE 64.0f
+#define HIT_GRID_MAX_CELLS_PER_AXIS 128 // cells grow past HIT_GRID_CELL_SIZE for UIs spread wider than this
+#define WIDGET_SLOT_BITS 20
+#define WIDGET_SLOT_MASK ((1u << WIDGET_SLOT_BITS) - 1)
+#define WIDGET_NONE 0xFFFFFFFFu
+
 list_define_type(E2R_UI_WindowList, E2R_UI_Window *);
 
+typedef enum _WidgetFlags
+{
+    WIDGET_HOVERED = 1 << 0,
+    WIDGET_NEEDS_MEASURE = 1 << 1,
+    WIDGET_ACTIVE = 1 << 2, // button held down, text input focused
+    WIDGET_PRESSED = 1 << 3, // button released over itself this frame
+
+} _WidgetFlags;
+
+// What layout, hit testing and interactions touch for every widget every frame
+typedef struct _WidgetHot
+{
+    v2 pos;
+    v2 size;
+    u8 kind; // E2R_UI_WidgetKind
+    u8 flags; // _WidgetFlags
+
+} _WidgetHot;
+
+// Only read when the widget is measured, rendered or edited
+typedef struct _WidgetCold
+{
+    E2R_UI_Window *window;
+    E2R_TextRect text_rect; // label and button text, measured when WIDGET_NEEDS_MEASURE is set
+    union
+    {
+        E2R_UI_Label label;
+        E2R_UI_BulletList bullet_list;
+        E2R_UI_Button button;
+        E2R_UI_TextInput text_input;
+    };
+
+} _WidgetCold;
+
+list_define_type(_WidgetHotList, _WidgetHot);
+list_define_type(_WidgetColdList, _WidgetCold);
+list_define_type(_U32List, u32);
+
+// Slots are indices into the parallel hot, cold and generation arrays; freed slots are reused
+typedef struct _WidgetPool
+{
+    _WidgetHotList hot;
+    _WidgetColdList cold;
+    _U32List generations; // of the slot's current widget, or of its next one while free
+    _U32List free_slots;
+
+} _WidgetPool;
+
+typedef struct _HitRect
+{
+    v2 min;
+    v2 max;
+    u32 z; // window index, back to front
+    E2R_UI_Window *window;
+    u32 widget; // slot, WIDGET_NONE for the window itself
+
+} _HitRect;
+
+list_define_type(_HitRectList, _HitRect);
+
+// Uniform grid over every visible window and widget, rebuilt each frame; each cell lists the rects touching it
+typedef struct _HitGrid
+{
+    _HitRectList rects;
+    v2 origin;
+    f32 cell_size;
+    u32 cols, rows;
+    _U32List cell_starts; // cols * rows + 1 offsets into cell_rects
+    _U32List cell_rects;
+
+} _HitGrid;
+
 typedef struct _UICtx
 {
     E2R_UI_WindowList window_list;
+    _WidgetPool widgets;
+    _HitGrid hit_grid;
     bool debug_enabled;
 
 } _UICtx;
@@ -51,10 +132,171 @@ static inline bool p_in_rect(v2 p, v2 rect_p, v2 rect_size)
     return (p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y);
 }
 
-static inline bool clicked_in_rect(v2 rect_p, v2 rect_size)
+// =====================================
+
+static void _u32_list_resize(_U32List *list, size_t size)
+{
+    if (size > list->cap) list_init(list, size);
+    list->size = size;
+}
+
+// =====================================
+
+static inline u32 _widget_slot(E2R_UI_WidgetHandle w)
+{
+    return w & WIDGET_SLOT_MASK;
+}
+
+// Slot of a handle from outside; asserts on handles of removed widgets
+static u32 _get_widget_slot(E2R_UI_WidgetHandle w)
+{
+    u32 slot = _widget_slot(w);
+    bassertf(slot < _ui_ctx->widgets.generations.size && _ui_ctx->widgets.generations.data[slot] == w >> WIDGET_SLOT_BITS,
+        "Stale widget handle %u", w);
+    return slot;
+}
+
+static inline _WidgetHot *_hot(u32 slot)
+{
+    return &_ui_ctx->widgets.hot.data[slot];
+}
+
+static inline _WidgetCold *_cold(u32 slot)
+{
+    return &_ui_ctx->widgets.cold.data[slot];
+}
+
+static E2R_UI_WidgetHandle _alloc_widget(E2R_UI_Window *window, E2R_UI_WidgetKind kind)
+{
+    _WidgetPool *pool = &_ui_ctx->widgets;
+    u32 slot;
+    if (pool->free_slots.size > 0)
+    {
+        slot = pool->free_slots.data[--pool->free_slots.size];
+    }
+    else
+    {
+        slot = (u32)pool->hot.size;
+        bassertf(slot <= WIDGET_SLOT_MASK, "Widget pool is full");
+        list_append(&pool->hot, ((_WidgetHot){}));
+        list_append(&pool->cold, ((_WidgetCold){}));
+        list_append(&pool->generations, 1);
+    }
+
+    *_hot(slot) = (_WidgetHot){ .kind = (u8)kind, .flags = WIDGET_NEEDS_MEASURE };
+    *_cold(slot) = (_WidgetCold){ .window = window };
+
+    E2R_UI_WidgetHandle handle = (pool->generations.data[slot] << WIDGET_SLOT_BITS) | slot;
+    list_append(&window->widgets, handle);
+    window->needs_layout = true;
+    window->is_dirty = true;
+    return handle;
+}
+
+static void _free_widget(u32 slot)
+{
+    _WidgetPool *pool = &_ui_ctx->widgets;
+    if (_hot(slot)->kind == E2R_UI_WIDGET_BULLET_LIST) list_free(&_cold(slot)->bullet_list.bullet_items);
+
+    // Generation 0 is skipped when it wraps, so zero stays an invalid handle
+    u32 generation = (pool->generations.data[slot] + 1) & (0xFFFFFFFFu >> WIDGET_SLOT_BITS);
+    pool->generations.data[slot] = generation ? generation : 1;
+    list_append(&pool->free_slots, slot);
+}
+
+static void _hit_grid_cell_range(const _HitGrid *grid, v2 min, v2 max, u32 *out_x0, u32 *out_y0, u32 *out_x1, u32 *out_y1)
+{
+    *out_x0 = (u32)((min.x - grid->origin.x) / grid->cell_size);
+    *out_y0 = (u32)((min.y - grid->origin.y) / grid->cell_size);
+    *out_x1 = (u32)((max.x - grid->origin.x) / grid->cell_size);
+    *out_y1 = (u32)((max.y - grid->origin.y) / grid->cell_size);
+}
+
+static void _build_hit_grid()
+{
+    _HitGrid *grid = &_ui_ctx->hit_grid;
+    list_clear(&grid->rects);
+    grid->cols = grid->rows = 0;
+
+    E2R_UI_Window **window_it;
+    list_iterate(&_ui_ctx->window_list, window_i, window_it)
+    {
+        E2R_UI_Window *window = *window_it;
+        if (!window->is_visible) continue;
+
+        list_append(&grid->rects, ((_HitRect){ window->pos, v2_add(window->pos, window->size), (u32)window_i, window, WIDGET_NONE }));
+        const E2R_UI_WidgetHandle *widget_it;
+        list_iterate(&window->widgets, widget_i, widget_it)
+        {
+            u32 slot = _widget_slot(*widget_it);
+            const _WidgetHot *hot = _hot(slot);
+            list_append(&grid->rects, ((_HitRect){ hot->pos, v2_add(hot->pos, hot->size), (u32)window_i, window, slot }));
+        }
+    }
+    if (grid->rects.size == 0) return;
+
+    v2 min = grid->rects.data[0].min;
+    v2 max = grid->rects.data[0].max;
+    const _HitRect *rect;
+    list_iterate(&grid->rects, rect_i, rect)
+    {
+        min = V2(fminf(min.x, rect->min.x), fminf(min.y, rect->min.y));
+        max = V2(fmaxf(max.x, rect->max.x), fmaxf(max.y, rect->max.y));
+    }
+
+    f32 extent = fmaxf(max.x - min.x, max.y - min.y);
+    grid->origin = min;
+    grid->cell_size = fmaxf(HIT_GRID_CELL_SIZE, extent / (HIT_GRID_MAX_CELLS_PER_AXIS - 1));
+    grid->cols = (u32)((max.x - min.x) / grid->cell_size) + 1;
+    grid->rows = (u32)((max.y - min.y) / grid->cell_size) + 1;
+
+    // Counting sort: count the rects per cell, turn the counts into offsets, then fill the cells in rect order
+    u32 cell_count = grid->cols * grid->rows;
+    _u32_list_resize(&grid->cell_starts, cell_count + 1);
+    memset(grid->cell_starts.data, 0, (cell_count + 1) * sizeof(grid->cell_starts.data[0]));
+    list_iterate(&grid->rects, rect_i, rect)
+    {
+        u32 x0, y0, x1, y1;
+        _hit_grid_cell_range(grid, rect->min, rect->max, &x0, &y0, &x1, &y1);
+        for (u32 y = y0; y <= y1; y++)
+            for (u32 x = x0; x <= x1; x++) grid->cell_starts.data[y * grid->cols + x + 1]++;
+    }
+    for (u32 cell = 0; cell < cell_count; cell++)
+    {
+        grid->cell_starts.data[cell + 1] += grid->cell_starts.data[cell];
+    }
+
+    _u32_list_resize(&grid->cell_rects, grid->cell_starts.data[cell_count]);
+    list_iterate(&grid->rects, rect_i, rect)
+    {
+        u32 x0, y0, x1, y1;
+        _hit_grid_cell_range(grid, rect->min, rect->max, &x0, &y0, &x1, &y1);
+        for (u32 y = y0; y <= y1; y++)
+            for (u32 x = x0; x <= x1; x++) grid->cell_rects.data[grid->cell_starts.data[y * grid->cols + x]++] = (u32)rect_i;
+    }
+    // Filling advanced every start to the next cell's, so shift them back
+    memmove(grid->cell_starts.data + 1, grid->cell_starts.data, cell_count * sizeof(grid->cell_starts.data[0]));
+    grid->cell_starts.data[0] = 0;
+}
+
+// The topmost rect under p, a widget over its own window; NULL if p is over no visible window or widget
+static const _HitRect *_hit_test(v2 p)
 {
-    return e2r_is_mouse_pressed(GLFW_MOUSE_BUTTON_LEFT) &&
-        p_in_rect(e2r_get_mouse_pos(), rect_p, rect_size);
+    const _HitGrid *grid = &_ui_ctx->hit_grid;
+    if (grid->cols == 0 || p.x < grid->origin.x || p.y < grid->origin.y) return NULL;
+    u32 x = (u32)((p.x - grid->origin.x) / grid->cell_size);
+    u32 y = (u32)((p.y - grid->origin.y) / grid->cell_size);
+    if (x >= grid->cols || y >= grid->rows) return NULL;
+
+    const _HitRect *best = NULL;
+    u32 cell = y * grid->cols + x;
+    for (u32 i = grid->cell_starts.data[cell]; i < grid->cell_starts.data[cell + 1]; i++)
+    {
+        const _HitRect *rect = &grid->rects.data[grid->cell_rects.data[i]];
+        if (!p_in_rect(p, rect->min, v2_sub(rect->max, rect->min))) continue;
+        if (!best || rect->z > best->z || (rect->z == best->z && best->widget == WIDGET_NONE)) best = rect;
+    }
+    return best;
 }
 
 // =====================================
@@ -75,18 +317,33 @@ void _draw_hline(f32 x_min, f32 x_max, f32 y, f32 width, v4 color)
     e2r_draw_quad(min, size, color);
 }
 
-void _recalculate_window_layout(E2R_UI_Window *window);
+void _update_window_layout(E2R_UI_Window *window);
 void _update_implicit_interactions()
 {
     E2R_UI_Window **window_it;
     list_iterate(&_ui_ctx->window_list, window_i, window_it)
     {
-        E2R_UI_Window *window = *window_it;
+        _update_window_layout(*window_it);
+    }
 
-        if (clicked_in_rect(window->pos, window->size))
-        {
-            window->is_dragged = true;
-        }
+    // Only the topmost window under the mouse gets hovered or clicked
+    _build_hit_grid();
+    const _HitRect *hit = _hit_test(e2r_get_mouse_pos());
+    E2R_UI_Window *hovered_window = hit ? hit->window : NULL;
+    u32 hovered_widget = hit ? hit->widget : WIDGET_NONE;
+
+    if (hovered_window && e2r_is_mouse_pressed(GLFW_MOUSE_BUTTON_LEFT))
+    {
+        hovered_window->is_dragged = true;
+
+        // Raise to the top: windows are drawn and hit tested in list order
+        list_erase(&_ui_ctx->window_list, hit->z);
+        list_append(&_ui_ctx->window_list, hovered_window);
+    }
+
+    list_iterate(&_ui_ctx->window_list, window_i, window_it)
+    {
+        E2R_UI_Window *window = *window_it;
 
         if (e2r_is_mouse_released(GLFW_MOUSE_BUTTON_LEFT))
         {
@@ -95,38 +352,40 @@ void _update_implicit_interactions()
 
         if (window->is_dragged)
         {
-            v2 mouse_delta =e2r_get_mouse_delta();
+            v2 mouse_delta = e2r_get_mouse_delta();
             window->pos.x += mouse_delta.x;
             window->pos.y += mouse_delta.y;
+            _update_window_layout(window);
         }
 
-        _recalculate_window_layout(window);
-
-        E2R_UI_Widget *widget;
-        list_iterate(&window->widget_list, widget_i, widget)
+        const E2R_UI_WidgetHandle *widget_it;
+        list_iterate(&window->widgets, widget_i, widget_it)
         {
-            widget->is_hovered = false;
-            if (p_in_rect(e2r_get_mouse_pos(), widget->pos, widget->size))
-            {
-                widget->is_hovered = true;
-            }
-
-            switch (widget->kind)
+            u32 slot = _widget_slot(*widget_it);
+            _WidgetHot *hot = _hot(slot);
+            // Only flags that change how the widget looks mark the window for re-tessellation;
+            // hover is drawn on buttons, and on everything else only with debug drawing on
+            u8 flags_before = hot->flags;
+            u8 drawn_flags = WIDGET_ACTIVE;
+            if (hot->kind == E2R_UI_WIDGET_BUTTON || _ui_ctx->debug_enabled) drawn_flags |= WIDGET_HOVERED;
+
+            hot->flags &= ~(WIDGET_HOVERED | WIDGET_PRESSED);
+            if (slot == hovered_widget) hot->flags |= WIDGET_HOVERED;
+
+            switch (hot->kind)
             {
                 case E2R_UI_WIDGET_BUTTON:
                 {
-                    widget->button.is_pressed = false;
-
-                    if (widget->is_hovered && e2r_is_mouse_pressed(GLFW_MOUSE_BUTTON_LEFT))
+                    if ((hot->flags & WIDGET_HOVERED) && e2r_is_mouse_pressed(GLFW_MOUSE_BUTTON_LEFT))
                     {
-                        widget->button.is_active = true;
+                        hot->flags |= WIDGET_ACTIVE;
                     }
-                    if (widget->button.is_active && e2r_is_mouse_released(GLFW_MOUSE_BUTTON_LEFT))
+                    if ((hot->flags & WIDGET_ACTIVE) && e2r_is_mouse_released(GLFW_MOUSE_BUTTON_LEFT))
                     {
-                        widget->button.is_active = false;
-                        if (p_in_rect(e2r_get_mouse_pos(), widget->pos, widget->size))
+                        hot->flags &= ~WIDGET_ACTIVE;
+                        if (hot->flags & WIDGET_HOVERED)
                         {
-                            widget->button.is_pressed = true;
+                            hot->flags |= WIDGET_PRESSED;
                         }
                     }
                 }
@@ -136,44 +395,54 @@ void _update_implicit_interactions()
                 {
                     if (e2r_is_mouse_pressed(GLFW_MOUSE_BUTTON_LEFT))
                     {
-                        widget->text_input.is_active = widget->is_hovered;
+                        if (hot->flags & WIDGET_HOVERED) hot->flags |= WIDGET_ACTIVE;
+                        else hot->flags &= ~WIDGET_ACTIVE;
                     }
 
-                    if (widget->text_input.is_active)
+                    if (hot->flags & WIDGET_ACTIVE)
                     {
+                        E2R_UI_TextInput *text_input = &_cold(slot)->text_input;
+                        bool changed = false;
+
                         char c = e2r_get_next_input_char();
                         while (c)
                         {
-                            widget->text_input.text_buf[widget->text_input.text_size++] = c;
-                            widget->text_input.current_pos++;
+                            text_input->text_buf[text_input->text_size++] = c;
+                            text_input->current_pos++;
+                            changed = true;
                             c = e2r_get_next_input_char();
                         }
 
                         if (e2r_is_key_pressed(GLFW_KEY_BACKSPACE))
                         {
-                            if (widget->text_input.text_size > 0)
+                            if (text_input->text_size > 0)
                             {
-                                widget->text_input.text_size--;
-                                widget->text_input.current_pos--;
-                                widget->text_input.text_buf[widget->text_input.text_size] = '\0';
+                                text_input->text_size--;
+                                text_input->current_pos--;
+                                text_input->text_buf[text_input->text_size] = '\0';
+                                changed = true;
                             }
                         }
 
                         if (e2r_is_key_pressed(GLFW_KEY_LEFT))
                         {
-                            if (widget->text_input.current_pos > 0)
+                            if (text_input->current_pos > 0)
                             {
-                                widget->text_input.current_pos--;
+                                text_input->current_pos--;
+                                changed = true;
                             }
                         }
 
                         if (e2r_is_key_pressed(GLFW_KEY_RIGHT))
                         {
-                            if (widget->text_input.current_pos < widget->text_input.text_size)
+                            if (text_input->current_pos < text_input->text_size)
                             {
-                                widget->text_input.current_pos++;
+                                text_input->current_pos++;
+                                changed = true;
                             }
                         }
+
+                        if (changed) window->is_dirty = true;
                     }
 
                 }
@@ -181,87 +450,87 @@ void _update_implicit_interactions()
 
                 default: break;
             }
+
+            if ((hot->flags ^ flags_before) & drawn_flags) window->is_dirty = true;
         }
     }
 }
 
-void _render_widget(E2R_UI_Widget *w)
+void _render_widget(u32 slot)
 {
-    const FontAtlas *font_atlas = e2r_get_font_atlas_TEMP();
-    f32 pen_x = w->pos.x;
-    f32 pen_y = w->pos.y;
+    E2R_FontHandle font = e2r_get_default_font();
+    const _WidgetHot *hot = _hot(slot);
+    const _WidgetCold *w = _cold(slot);
+    f32 pen_x = hot->pos.x;
+    f32 pen_y = hot->pos.y;
 
-    if (_ui_ctx->debug_enabled && w->is_hovered)
+    if (_ui_ctx->debug_enabled && (hot->flags & WIDGET_HOVERED))
     {
-        e2r_draw_quad(w->pos, w->size, V4(0.7f, 0.2f, 0.2f, 1.0f));
+        e2r_draw_quad(hot->pos, hot->size, V4(0.7f, 0.2f, 0.2f, 1.0f));
     }
 
-    switch (w->kind)
+    switch (hot->kind)
     {
         case E2R_UI_WIDGET_LABEL:
         {
-            e2r_draw_line(w->label.text, &pen_x, &pen_y, font_atlas, _ui_styling->text_color);
+            e2r_draw_line(w->label.text, &pen_x, &pen_y, font, _ui_styling->text_color);
         }
         break;
 
         case E2R_UI_WIDGET_BULLET_LIST:
         {
-            const FontAtlas *font_atlas = e2r_get_font_atlas_TEMP();
+            E2R_FontHandle font = e2r_get_default_font();
             if (w->bullet_list.bullet_items.size > 0)
             {
                 const char **bullet_item;
                 list_iterate(&w->bullet_list.bullet_items, bullet_item_i, bullet_item)
                 {
-                    e2r_draw_line(*bullet_item, &pen_x, &pen_y, font_atlas, _ui_styling->text_color);
+                    e2r_draw_line(*bullet_item, &pen_x, &pen_y, font, _ui_styling->text_color);
                 }
             }
             else
             {
-                e2r_draw_line("Bullet List", &pen_x, &pen_y, font_atlas, _ui_styling->text_color);
+                e2r_draw_line("Bullet List", &pen_x, &pen_y, font, _ui_styling->text_color);
             }
         }
         break;
 
         case E2R_UI_WIDGET_BUTTON:
         {
-            StringRect text_rect = font_loader_get_string_rect(font_atlas, w->button.text);
+            E2R_TextRect text_rect = w->text_rect;
             f32 text_w = text_rect.max_x - text_rect.min_x;
             f32 text_h = text_rect.max_y - text_rect.min_y;
 
             v4 color = _ui_styling->button_color;
-            if (w->is_hovered) color = _ui_styling->button_hovered_color;
-            if (w->button.is_active) color = _ui_styling->button_active_color;
+            if (hot->flags & WIDGET_HOVERED) color = _ui_styling->button_hovered_color;
+            if (hot->flags & WIDGET_ACTIVE) color = _ui_styling->button_active_color;
 
-            e2r_draw_quad(w->pos, w->size, color);
+            e2r_draw_quad(hot->pos, hot->size, color);
 
-            f32 text_x = w->pos.x + _ui_styling->button_padding + w->size.x * 0.5f - text_w * 0.5f;
-            f32 text_y = w->pos.y - text_rect.min_y + w->size.y * 0.5f - text_h * 0.5f;
+            f32 text_x = hot->pos.x + _ui_styling->button_padding + hot->size.x * 0.5f - text_w * 0.5f;
+            f32 text_y = hot->pos.y - text_rect.min_y + hot->size.y * 0.5f - text_h * 0.5f;
 
-            e2r_draw_line(w->button.text, &text_x, &text_y, font_atlas, _ui_styling->text_color);
+            e2r_draw_line(w->button.text, &text_x, &text_y, font, _ui_styling->text_color);
         }
         break;
 
         case E2R_UI_WIDGET_TEXT_INPUT:
         {
             v4 color = _ui_styling->button_color;
-            if (w->text_input.is_active) color = _ui_styling->button_active_color;
-            e2r_draw_quad(w->pos, w->size, color);
+            if (hot->flags & WIDGET_ACTIVE) color = _ui_styling->button_active_color;
+            e2r_draw_quad(hot->pos, hot->size, color);
 
             if (w->text_input.text_size > 0)
             {
-                f32 text_x = w->pos.x + _ui_styling->button_padding;
-                f32 text_y = w->pos.y + _ui_styling->button_padding;
+                f32 text_x = hot->pos.x + _ui_styling->button_padding;
+                f32 text_y = hot->pos.y + _ui_styling->button_padding;
                 f32 pen_x = text_x;
                 f32 pen_y = text_y;
-                e2r_draw_line(w->text_input.text_buf, &pen_x, &pen_y, font_atlas, _ui_styling->text_color);
+                e2r_draw_line(w->text_input.text_buf, &pen_x, &pen_y, font, _ui_styling->text_color);
 
-                if (w->text_input.is_active)
+                if (hot->flags & WIDGET_ACTIVE)
                 {
-                    f32 cursor_x = 0.0f;
-                    for (int i = 0; i < w->text_input.current_pos; i++)
-                    {
-                        cursor_x += font_loader_get_advance_x(font_atlas, w->text_input.text_buf[i]);
-                    }
+                    f32 cursor_x = e2r_font_get_text_width(font, w->text_input.text_buf, w->text_input.current_pos);
 
                     v2 cursor_pos = V2(text_x + cursor_x, text_y);
                     v2 cursor_size = V2(_ui_styling->cursor_width, 20.0f);
@@ -276,7 +545,7 @@ void _render_widget(E2R_UI_Widget *w)
 
 void _render_window(E2R_UI_Window *window)
 {
-    const FontAtlas *font_atlas = e2r_get_font_atlas_TEMP();
+    E2R_FontHandle font = e2r_get_default_font();
     e2r_draw_quad(window->pos, window->size, _ui_styling->window_bg_color);
     const v2 window_min = window->pos;
     const v2 window_max = v2_add(window->pos, window->size);
@@ -285,9 +554,9 @@ void _render_window(E2R_UI_Window *window)
 
     const f32 pad = _ui_styling->window_padding;
     const f32 item_offset = 2 * pad;
-    const f32 ascender = font_loader_get_ascender(font_atlas);
+    const f32 ascender = e2r_font_get_ascender(font);
 
-    StringRect title_rect = font_loader_get_string_rect(font_atlas, window->title);
+    E2R_TextRect title_rect = window->title_rect;
     f32 title_w = title_rect.max_x - title_rect.min_x;
     f32 title_h = title_rect.max_y - title_rect.min_y;
 
@@ -308,15 +577,39 @@ void _render_window(E2R_UI_Window *window)
     f32 title_x = window_min.x + pad + window_w * 0.5f - title_w * 0.5f;
     f32 title_y = window_min.y - title_rect.min_y + header_h * 0.5f - title_h * 0.5f;
 
-    e2r_draw_line(window->title, &title_x, &title_y, font_atlas, _ui_styling->text_color);
+    e2r_draw_line(window->title, &title_x, &title_y, font, _ui_styling->text_color);
 
-    E2R_UI_Widget *widget;
-    list_iterate(&window->widget_list, widget_i, widget)
+    const E2R_UI_WidgetHandle *widget_it;
+    list_iterate(&window->widgets, widget_i, widget_it)
     {
-        _render_widget(widget);
+        _render_widget(_widget_slot(*widget_it));
     }
 }
 
+// Re-tessellates only dirty windows; the rest re-emit their cached quads, translated if the window moved
+void _render_window_cached(E2R_UI_Window *window)
+{
+    u32 glyph_generation = e2r_font_get_atlas_generation();
+    if (window->is_dirty || window->cached_glyph_generation != glyph_generation)
+    {
+        // Widgets may have been added or changed since begin_frame
+        _update_window_layout(window);
+
+        list_clear(&window->cached_quads);
+        e2r_draw_set_ui_target(&window->cached_quads);
+        _render_window(window);
+        e2r_draw_set_ui_target(NULL);
+
+        window->cached_pos = window->pos;
+        // From before tessellating: glyphs that didn't fit bump it, and the window retries next frame
+        window->cached_glyph_generation = glyph_generation;
+        window->is_dirty = false;
+    }
+
+    v2 offset = v2_sub(window->pos, window->cached_pos);
+    e2r_draw_ui_instances(window->cached_quads.data, window->cached_quads.size, offset);
+}
+
 void _render_windows()
 {
     E2R_UI_Window **window_it;
@@ -324,7 +617,7 @@ void _render_windows()
     {
         if ((*window_it)->is_visible)
         {
-            _render_window(*window_it);
+            _render_window_cached(*window_it);
         }
     }
 }
@@ -336,15 +629,17 @@ void _render()
 
 // =====================================
 
-void _recalculate_widget_size(E2R_UI_Widget *w)
+void _measure_widget(u32 slot)
 {
-    const FontAtlas *font_atlas = e2r_get_font_atlas_TEMP();
-    switch (w->kind)
+    E2R_FontHandle font = e2r_get_default_font();
+    _WidgetHot *hot = _hot(slot);
+    _WidgetCold *w = _cold(slot);
+    switch (hot->kind)
     {
         case E2R_UI_WIDGET_LABEL:
         {
-            StringRect text_rect = font_loader_get_string_rect(font_atlas, w->label.text);
-            w->size = V2(text_rect.max_x, text_rect.max_y);
+            w->text_rect = e2r_font_get_text_rect(font, w->label.text);
+            hot->size = V2(w->text_rect.max_x, w->text_rect.max_y);
         }
         break;
 
@@ -353,66 +648,95 @@ void _recalculate_widget_size(E2R_UI_Widget *w)
             const char **bullet_item;
             f32 max_x = 0.0f;
             f32 max_y = 0.0f;
-            f32 ascender = font_loader_get_ascender(font_atlas);
+            f32 ascender = e2r_font_get_ascender(font);
             if (w->bullet_list.bullet_items.size > 0)
             {
                 list_iterate(&w->bullet_list.bullet_items, bullet_item_i, bullet_item)
                 {
-                    StringRect text_rect = font_loader_get_string_rect(font_atlas, *bullet_item);
+                    E2R_TextRect text_rect = e2r_font_get_text_rect(font, *bullet_item);
                     if (text_rect.max_x > max_x) max_x = text_rect.max_x;
                     max_y += text_rect.max_y;
                 }   
             }
             else
             {
-                StringRect text_rect = font_loader_get_string_rect(font_atlas, "Bullet List");
+                E2R_TextRect text_rect = e2r_font_get_text_rect(font, "Bullet List");
                 max_x = text_rect.max_x;
                 max_y = text_rect.max_y;
             }
-            w->size = V2(max_x, max_y);
+            hot->size = V2(max_x, max_y);
         }
         break;
 
         case E2R_UI_WIDGET_BUTTON:
         {
-            StringRect text_rect = font_loader_get_string_rect(font_atlas, w->button.text);
-            f32 text_w = text_rect.max_x - text_rect.min_x;
-            f32 text_h = text_rect.max_y - text_rect.min_y;
-            w->size = V2(text_w + 2 * _ui_styling->button_padding, text_h + 2 * _ui_styling->button_padding);
+            w->text_rect = e2r_font_get_text_rect(font, w->button.text);
+            f32 text_w = w->text_rect.max_x - w->text_rect.min_x;
+            f32 text_h = w->text_rect.max_y - w->text_rect.min_y;
+            hot->size = V2(text_w + 2 * _ui_styling->button_padding, text_h + 2 * _ui_styling->button_padding);
         }
         break;
 
         case E2R_UI_WIDGET_TEXT_INPUT:
         {
-            w->size = V2(100.0f, 25.0f);
+            hot->size = V2(100.0f, 25.0f);
         }
         break;
     }
+
+    hot->flags &= ~WIDGET_NEEDS_MEASURE;
 }
 
-void _recalculate_window_layout(E2R_UI_Window *window)
+// Restacks the widgets only after something was added or re-measured; a moved window just shifts them
+void _update_window_layout(E2R_UI_Window *window)
 {
+    if (!window->needs_layout)
+    {
+        v2 delta = v2_sub(window->pos, window->layout_pos);
+        if (delta.x != 0.0f || delta.y != 0.0f)
+        {
+            const E2R_UI_WidgetHandle *widget_it;
+            list_iterate(&window->widgets, widget_i, widget_it)
+            {
+                _WidgetHot *hot = _hot(_widget_slot(*widget_it));
+                hot->pos = v2_add(hot->pos, delta);
+            }
+            window->layout_pos = window->pos;
+        }
+        return;
+    }
+
     f32 pen_x = window->pos.x;
     f32 pen_y = window->pos.y;
 
     pen_x += _ui_styling->window_padding;
 
-    const FontAtlas *font_atlas = e2r_get_font_atlas_TEMP();
-    StringRect title_rect = font_loader_get_string_rect(font_atlas, window->title);
-    const f32 header_h = _ui_styling->window_padding + title_rect.max_y + _ui_styling->window_padding;
+    const f32 header_h = _ui_styling->window_padding + window->title_rect.max_y + _ui_styling->window_padding;
     pen_y += header_h;
 
     pen_y += _ui_styling->window_padding;
 
-    E2R_UI_Widget *widget;
-    list_iterate(&window->widget_list, widget_i, widget)
+    const E2R_UI_WidgetHandle *widget_it;
+    list_iterate(&window->widgets, widget_i, widget_it)
     {
-        widget->pos = V2(pen_x, pen_y);
+        u32 slot = _widget_slot(*widget_it);
+        _WidgetHot *hot = _hot(slot);
+        hot->pos = V2(pen_x, pen_y);
 
-        _recalculate_widget_size(widget);
+        if (hot->flags & WIDGET_NEEDS_MEASURE) _measure_widget(slot);
 
-        pen_y += widget->size.y + _ui_styling->window_padding;
+        pen_y += hot->size.y + _ui_styling->window_padding;
     }
+
+    window->layout_pos = window->pos;
+    window->needs_layout = false;
+}
+
+void _invalidate_widget(u32 slot)
+{
+    _hot(slot)->flags |= WIDGET_NEEDS_MEASURE;
+    _cold(slot)->window->needs_layout = true;
+    _cold(slot)->window->is_dirty = true;
 }
 
 // =====================================
@@ -452,7 +776,9 @@ E2R_UI_Window *e2r_ui__create_window(v2 pos, v2 size, const char *title)
         .pos = pos,
         .size = size,
         .title = xstrdup(title),
-        .is_visible = true
+        .title_rect = e2r_font_get_text_rect(e2r_get_default_font(), title),
+        .is_visible = true,
+        .is_dirty = true
     };
 
     list_append(&_ui_ctx->window_list, window);
@@ -475,51 +801,60 @@ void e2r_ui__destroy_window(E2R_UI_Window *window)
     }
     bassertf(delete_index < _ui_ctx->window_list.size, "Window to delete not found");
     list_erase(&_ui_ctx->window_list, delete_index);
+
+    const E2R_UI_WidgetHandle *widget_it;
+    list_iterate(&window->widgets, widget_i, widget_it)
+    {
+        _free_widget(_widget_slot(*widget_it));
+    }
+    list_free(&window->widgets);
+    list_free(&window->cached_quads);
 }
 
 // ==========================================
 
-E2R_UI_Widget *e2r_ui__add_label(E2R_UI_Window *window)
+E2R_UI_WidgetHandle e2r_ui__add_label(E2R_UI_Window *window)
 {
-    E2R_UI_Widget widget = {
-        .kind = E2R_UI_WIDGET_LABEL,
-        .window = window,
-        .label.text = "Label"
-    };
-    list_append(&window->widget_list, widget);
-    _recalculate_window_layout(window);
-    return &window->widget_list.data[window->widget_list.size - 1];
+    E2R_UI_WidgetHandle w = _alloc_widget(window, E2R_UI_WIDGET_LABEL);
+    _cold(_widget_slot(w))->label.text = "Label";
+    return w;
 }
 
-E2R_UI_Widget *e2r_ui__add_bullet_list(E2R_UI_Window *window)
+E2R_UI_WidgetHandle e2r_ui__add_bullet_list(E2R_UI_Window *window)
 {
-    E2R_UI_Widget widget = {
-        .kind = E2R_UI_WIDGET_BULLET_LIST,
-        .window = window
-    };
-    list_append(&window->widget_list, widget);
-    return &window->widget_list.data[window->widget_list.size - 1];
+    return _alloc_widget(window, E2R_UI_WIDGET_BULLET_LIST);
 }
 
-E2R_UI_Widget *e2r_ui__add_button(E2R_UI_Window *window)
+E2R_UI_WidgetHandle e2r_ui__add_button(E2R_UI_Window *window)
 {
-    E2R_UI_Widget widget = {
-        .kind = E2R_UI_WIDGET_BUTTON,
-        .window = window,
-        .button.text = "Button"
-    };
-    list_append(&window->widget_list, widget);
-    return &window->widget_list.data[window->widget_list.size - 1];
+    E2R_UI_WidgetHandle w = _alloc_widget(window, E2R_UI_WIDGET_BUTTON);
+    _cold(_widget_slot(w))->button.text = "Button";
+    return w;
 }
 
-E2R_UI_Widget *e2r_ui__add_text_input(E2R_UI_Window *window)
+E2R_UI_WidgetHandle e2r_ui__add_text_input(E2R_UI_Window *window)
 {
-    E2R_UI_Widget widget = {
-        .kind = E2R_UI_WIDGET_TEXT_INPUT,
-        .window = window,
-    };
-    list_append(&window->widget_list, widget);
-    return &window->widget_list.data[window->widget_list.size - 1];
+    return _alloc_widget(window, E2R_UI_WIDGET_TEXT_INPUT);
+}
+
+void e2r_ui__remove_widget(E2R_UI_WidgetHandle w)
+{
+    u32 slot = _get_widget_slot(w);
+    E2R_UI_Window *window = _cold(slot)->window;
+
+    const E2R_UI_WidgetHandle *widget_it;
+    list_iterate(&window->widgets, widget_i, widget_it)
+    {
+        if (*widget_it == w)
+        {
+            list_erase(&window->widgets, widget_i);
+            break;
+        }
+    }
+    _free_widget(slot);
+
+    window->needs_layout = true;
+    window->is_dirty = true;
 }
 
 // ==========================================
@@ -529,37 +864,41 @@ void e2r_ui__toggle_window_visibility(E2R_UI_Window *window)
     window->is_visible = !window->is_visible;
 }
 
-void e2r_ui__set_label_text(E2R_UI_Widget *w, const char *text)
+void e2r_ui__set_label_text(E2R_UI_WidgetHandle w, const char *text)
 {
-    bassert(w->kind == E2R_UI_WIDGET_LABEL);
+    u32 slot = _get_widget_slot(w);
+    bassert(_hot(slot)->kind == E2R_UI_WIDGET_LABEL);
     // TODO: This will not work if the underlying str pointer changes
     // Will work for code segment strings for now
-    w->label.text = text;
-    _recalculate_window_layout(w->window);
+    _cold(slot)->label.text = text;
+    _invalidate_widget(slot);
 }
 
-void e2r_ui__add_bullet_list_item(E2R_UI_Widget *w, const char *item)
+void e2r_ui__add_bullet_list_item(E2R_UI_WidgetHandle w, const char *item)
 {
-    bassert(w->kind == E2R_UI_WIDGET_BULLET_LIST);
+    u32 slot = _get_widget_slot(w);
+    bassert(_hot(slot)->kind == E2R_UI_WIDGET_BULLET_LIST);
     // TODO: This will not work if the underlying str pointer changes
     // Will work for code segment strings for now
-    list_append(&w->bullet_list.bullet_items, item);
-    _recalculate_window_layout(w->window);
+    list_append(&_cold(slot)->bullet_list.bullet_items, item);
+    _invalidate_widget(slot);
 }
 
-void e2r_ui__set_button_text(E2R_UI_Widget *w, const char *text)
+void e2r_ui__set_button_text(E2R_UI_WidgetHandle w, const char *text)
 {
-    bassert(w->kind == E2R_UI_WIDGET_BUTTON);
+    u32 slot = _get_widget_slot(w);
+    bassert(_hot(slot)->kind == E2R_UI_WIDGET_BUTTON);
     // TODO: This will not work if the underlying str pointer changes
     // Will work for code segment strings for now
-    w->button.text = text;
-    _recalculate_window_layout(w->window);
+    _cold(slot)->button.text = text;
+    _invalidate_widget(slot);
 }
 
 // ==========================================
 
-bool e2r_ui__is_button_pressed(E2R_UI_Widget *w)
+bool e2r_ui__is_button_pressed(E2R_UI_WidgetHandle w)
 {
-    bassert(w->kind == E2R_UI_WIDGET_BUTTON);
-    return w->button.is_pressed;
+    u32 slot = _get_widget_slot(w);
+    bassert(_hot(slot)->kind == E2R_UI_WIDGET_BUTTON);
+    return _hot(slot)->flags & WIDGET_PRESSED;
 }
@@ -2,6 +2,7 @@
 
 #include "common/types.h"
 #include "common/util.h"
+#include "e2r_draw.h"
 
 #define TEXT_INPUT_BUF_SIZE 256
 
@@ -21,8 +22,6 @@ typedef struct
 typedef struct
 {
     const char *text;
-    bool is_active;
-    bool is_pressed;
 
 } E2R_UI_Button;
 
@@ -31,7 +30,6 @@ typedef struct
     char text_buf[TEXT_INPUT_BUF_SIZE];
     int text_size;
     int current_pos;
-    bool is_active;
 
 } E2R_UI_TextInput;
 
@@ -44,37 +42,32 @@ typedef enum
 
 } E2R_UI_WidgetKind;
 
-struct E2R_UI_Window;
-typedef struct
-{
-    E2R_UI_WidgetKind kind;
-    v2 pos;
-    v2 size;
-    struct E2R_UI_Window *window;
-    bool is_hovered;
-    union
-    {
-        E2R_UI_Label label;
-        E2R_UI_BulletList bullet_list;
-        E2R_UI_Button button;
-        E2R_UI_TextInput text_input;
-    };
-
-} E2R_UI_Widget;
+// Slot index in the low bits, generation in the high bits. Stays valid while the pool grows; once the widget is
+// removed the slot's generation moves on, and the stale handle asserts. Zero is never a valid handle.
+typedef u32 E2R_UI_WidgetHandle;
 
-list_define_type(E2R_UI_WidgetList, E2R_UI_Widget);
+list_define_type(E2R_UI_WidgetHandleList, E2R_UI_WidgetHandle);
 
 typedef struct E2R_UI_Window
 {
     v2 pos;
     v2 size;
     const char *title;
+    E2R_TextRect title_rect;
 
-    E2R_UI_WidgetList widget_list;
+    E2R_UI_WidgetHandleList widgets; // in layout order
+    v2 layout_pos; // window pos the widget positions were computed for
+    bool needs_layout;
 
     bool is_dragged;
     bool is_visible;
 
+    // Quads from the last time the window was rendered at cached_pos; moving only translates them
+    E2R_UIInstanceList cached_quads;
+    v2 cached_pos;
+    u32 cached_glyph_generation; // glyphs may have moved in the font atlas since, if it differs
+    bool is_dirty;
+
 } E2R_UI_Window;
 
 void e2r_ui__init(bool enable_debug);
@@ -85,14 +78,15 @@ void e2r_ui__end_frame();
 E2R_UI_Window *e2r_ui__create_window(v2 pos, v2 size, const char *title);
 void e2r_ui__destroy_window(E2R_UI_Window *window);
 
-E2R_UI_Widget *e2r_ui__add_label(E2R_UI_Window *window);
-E2R_UI_Widget *e2r_ui__add_bullet_list(E2R_UI_Window *window);
-E2R_UI_Widget *e2r_ui__add_button(E2R_UI_Window *window);
-E2R_UI_Widget *e2r_ui__add_text_input(E2R_UI_Window *window);
+E2R_UI_WidgetHandle e2r_ui__add_label(E2R_UI_Window *window);
+E2R_UI_WidgetHandle e2r_ui__add_bullet_list(E2R_UI_Window *window);
+E2R_UI_WidgetHandle e2r_ui__add_button(E2R_UI_Window *window);
+E2R_UI_WidgetHandle e2r_ui__add_text_input(E2R_UI_Window *window);
+void e2r_ui__remove_widget(E2R_UI_WidgetHandle w);
 
 void e2r_ui__toggle_window_visibility(E2R_UI_Window *window);
-void e2r_ui__set_label_text(E2R_UI_Widget *w, const char *text);
-void e2r_ui__add_bullet_list_item(E2R_UI_Widget *w, const char *item);
-void e2r_ui__set_button_text(E2R_UI_Widget *w, const char *text);
+void e2r_ui__set_label_text(E2R_UI_WidgetHandle w, const char *text);
+void e2r_ui__add_bullet_list_item(E2R_UI_WidgetHandle w, const char *item);
+void e2r_ui__set_button_text(E2R_UI_WidgetHandle w, const char *text);
 
-bool e2r_ui__is_button_pressed(E2R_UI_Widget *w);
+bool e2r_ui__is_button_pressed(E2R_UI_WidgetHandle w);
@@ -40,6 +40,28 @@ void process_3d_scene_inputs()
         e2r_toggle_mouse_capture();
     }
 
+    if (e2r_is_key_pressed(GLFW_KEY_V))
+    {
+        E2R_CullingMode mode = (e2r_get_culling_mode() + 1) % (E2R_CULLING_NONE + 1);
+        e2r_set_culling_mode(mode);
+        trace("Culling mode: %d", mode);
+    }
+
+    if (e2r_is_key_pressed(GLFW_KEY_R))
+    {
+        E2R_RecordingMode mode = (e2r_get_recording_mode() + 1) % (E2R_RECORDING_PARALLEL + 1);
+        e2r_set_recording_mode(mode);
+        trace("Recording mode: %d", mode);
+    }
+
+    if (e2r_is_key_pressed(GLFW_KEY_T))
+    {
+        E2R_FrameTimings timings = e2r_get_frame_timings();
+        trace("Frame time: CPU %.3f ms (avg %.3f), GPU %.3f ms (avg %.3f)",
+            timings.cpu_frame_ms, timings.avg_cpu_frame_ms,
+            timings.gpu_frame_ms, timings.avg_gpu_frame_ms);
+    }
+
     // Update camera based on mouse
     if (e2r_is_mouse_captured())
     {
@@ -108,28 +130,28 @@ int main()
 
     E2R_UI_Window *window1 = e2r_ui__create_window(V2(100.0f, 100.0f), V2(300.0f, 300.0f), "Hello world!");
 
-    E2R_UI_Widget *label = e2r_ui__add_label(window1);
+    E2R_UI_WidgetHandle label = e2r_ui__add_label(window1);
     e2r_ui__set_label_text(label, "Hellooooo!!!");
 
-    E2R_UI_Widget *label2 = e2r_ui__add_label(window1);
+    E2R_UI_WidgetHandle label2 = e2r_ui__add_label(window1);
     e2r_ui__set_label_text(label2, "Goodbye:(");
 
-    E2R_UI_Widget *label3 = e2r_ui__add_label(window1);
+    E2R_UI_WidgetHandle label3 = e2r_ui__add_label(window1);
     e2r_ui__set_label_text(label3, "HAHA");
 
-    E2R_UI_Widget *bullet_list1 = e2r_ui__add_bullet_list(window1);
+    E2R_UI_WidgetHandle bullet_list1 = e2r_ui__add_bullet_list(window1);
     e2r_ui__add_bullet_list_item(bullet_list1, "Hellooooo!!!");
     e2r_ui__add_bullet_list_item(bullet_list1, "Goodbye:(");
     e2r_ui__add_bullet_list_item(bullet_list1, "HAHA");
 
-    E2R_UI_Widget *button = e2r_ui__add_button(window1);
+    E2R_UI_WidgetHandle button = e2r_ui__add_button(window1);
     e2r_ui__set_button_text(button, button_txt1);
     bool button_toggled = false;
 
-    E2R_UI_Widget *text_input = e2r_ui__add_text_input(window1);
+    E2R_UI_WidgetHandle text_input = e2r_ui__add_text_input(window1);
 
     E2R_UI_Window *window2 = e2r_ui__create_window(V2(600.0f, 550.0f), V2(300.0f, 300.0f), "Second window");
-    E2R_UI_Widget *second_label = e2r_ui__add_label(window2);
+    E2R_UI_WidgetHandle second_label = e2r_ui__add_label(window2);
     e2r_ui__set_label_text(second_label, "Second window's label");
 
     while (e2r_is_running())
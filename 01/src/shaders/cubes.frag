@@ -1,13 +1,15 @@
 #version 450 core
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec4 fragColor;
 layout(location = 1) in vec2 fragUV;
 layout(location = 2) in vec3 fragNormal;
 layout(location = 3) in vec3 fragPos;
+layout(location = 4) in flat uint fragTexIndex;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 0, binding = 1) uniform sampler2D texSampler;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 layout(std140, set = 0, binding = 2) uniform UBO_Lighting
 {
@@ -39,6 +41,6 @@ void main()
 
     vec4 c = fragColor;
     vec4 l = vec4(ambient + diffuse + specular, 1.0);
-    vec4 t = texture(texSampler, fragUV);
+    vec4 t = texture(textures[nonuniformEXT(fragTexIndex)], fragUV);
     outColor = c * l * t;
 }
@@ -5,28 +5,31 @@ layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inUV;
 layout(location = 3) in vec4 inColor;
 
+// Per-instance
+layout(location = 4) in mat4 inModel;
+layout(location = 8) in vec4 inInstanceColor;
+layout(location = 9) in mat3 inNormalMatrix;
+layout(location = 12) in uint inTexIndex;
+
 layout(std140, set = 0, binding = 0) uniform UBO_3D
 {
     mat4 view_proj;
 
 } ubo_3d;
 
-layout(push_constant) uniform Push
-{
-   mat4 model;
-
-} push;
-
 layout(location = 0) out vec4 fragColor;
 layout(location = 1) out vec2 fragUV;
 layout(location = 2) out vec3 fragNormal;
 layout(location = 3) out vec3 fragPos;
+layout(location = 4) out flat uint fragTexIndex;
 
 void main()
 {
-    gl_Position = ubo_3d.view_proj * push.model * vec4(inPos, 1.0);
-    fragColor = inColor;
+    vec4 world_pos = inModel * vec4(inPos, 1.0);
+    gl_Position = ubo_3d.view_proj * world_pos;
+    fragColor = inColor * inInstanceColor;
     fragUV = inUV;
-    fragNormal = mat3(transpose(inverse(push.model))) * inNormal;
-    fragPos = vec3(push.model * vec4(inPos, 1.0));
+    fragNormal = inNormalMatrix * inNormal;
+    fragPos = vec3(world_pos);
+    fragTexIndex = inTexIndex;
 }
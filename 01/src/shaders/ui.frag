@@ -1,15 +1,25 @@
 #version 450 core
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec4 fragColor;
 layout(location = 1) in vec2 fragUV;
 layout(location = 2) in flat uint fragTexIndex;
 
-layout(set = 0, binding = 1) uniform sampler2D texSampler[2];
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 layout(location = 0) out vec4 outColor;
 
+// INSTANCE_UI_SDF_BIT in vertex.h
+const uint SDF_BIT = 1u << 31;
+
 void main()
 {
-    vec4 t = texture(texSampler[fragTexIndex], fragUV);
-    outColor = vec4(vec3(fragColor), t.a);
+    vec4 t = texture(textures[nonuniformEXT(fragTexIndex & ~SDF_BIT)], fragUV);
+
+    // Distance fields are 0.5 on the outline; antialias over about one screen pixel at any scale.
+    // fwidth is 0 where the field is flat, and smoothstep is undefined when both edges are equal
+    float edge_width = max(0.5 * fwidth(t.a), 1e-4);
+    float alpha = (fragTexIndex & SDF_BIT) != 0u ? smoothstep(0.5 - edge_width, 0.5 + edge_width, t.a) : t.a;
+
+    outColor = vec4(vec3(fragColor), alpha);
 }
@@ -1,9 +1,12 @@
 #version 450
 
-layout(location = 0) in vec3 inPos;
-layout(location = 1) in vec2 inUV;
-layout(location = 2) in vec4 inColor;
-layout(location = 3) in uint inTexIndex;
+// Per-quad instance
+layout(location = 0) in vec2 inPosMin;
+layout(location = 1) in vec2 inPosMax;
+layout(location = 2) in vec2 inUVMin;
+layout(location = 3) in vec2 inUVMax;
+layout(location = 4) in vec4 inColor;
+layout(location = 5) in uint inTexIndex;
 
 layout(location = 0) out vec4 fragColor;
 layout(location = 1) out vec2 fragUV;
@@ -13,10 +16,18 @@ layout(std140, set = 0, binding = 0) uniform UBO_2D {
     mat4 view_proj;
 } ubo_2d;
 
+// Corners min, (max.x, min.y), max, (min.x, max.y) as two triangles
+const vec2 corners[6] = vec2[](
+    vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+    vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+);
+
 void main()
 {
-    gl_Position = ubo_2d.view_proj * vec4(inPos, 1.0);
+    vec2 corner = corners[gl_VertexIndex];
+    vec2 pos = mix(inPosMin, inPosMax, corner);
+    gl_Position = ubo_2d.view_proj * vec4(pos, 0.0, 1.0);
     fragColor = inColor;
-    fragUV = inUV;
+    fragUV = mix(inUVMin, inUVMax, corner);
     fragTexIndex = inTexIndex;
 }
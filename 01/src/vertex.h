@@ -3,14 +3,19 @@
 #include <vulkan/vulkan.h>
 #include "common/types.h"
 
-typedef struct VertexUI
+// One per UI quad; ui.vert expands it into two triangles from gl_VertexIndex
+#define INSTANCE_UI_SDF_BIT (1u << 31) // set in tex_index when the texture's alpha is a distance field, see ui.frag
+
+typedef struct InstanceUI
 {
-    v3 pos;
-    v2 uv;
-    v4 color;
-    u32 tex_index;
+    v2 pos_min;
+    v2 pos_max;
+    v2 uv_min;
+    v2 uv_max;
+    u32 color; // RGBA8, read as VK_FORMAT_R8G8B8A8_UNORM
+    u32 tex_index; // e2r_texture_get_shader_index
 
-} VertexUI;
+} InstanceUI;
 
 typedef struct Vertex3D
 {
@@ -21,5 +26,16 @@ typedef struct Vertex3D
 
 } Vertex3D;
 
+// 128 bytes, matching the std430 Instance struct in cull.comp
+typedef struct Instance3D
+{
+    m4 model;
+    v4 color;
+    m3 normal_matrix; // filled by e2r_get_3d_render_data
+    u32 texture_index; // e2r_texture_get_shader_index
+    f32 _pad[2];
+
+} Instance3D;
+
 typedef u32 VertIndex;
 #define VERT_INDEX_TYPE VK_INDEX_TYPE_UINT32